@@ -0,0 +1,127 @@
+#include "ByteRing.hpp"
+
+#include <algorithm>
+
+void ByteRing::push(void const *data_, size_t count) {
+	char const *data = reinterpret_cast< char const * >(data_);
+
+	if (size() + count > storage.size()) {
+		//grow to the next power of two that fits, copying queued bytes to the start:
+		size_t capacity = std::max< size_t >(storage.size(), 256);
+		while (capacity < size() + count) capacity *= 2;
+
+		std::vector< char > grown(capacity);
+		Span parts[2];
+		size_t at = 0;
+		for (size_t i = 0, n = spans(parts); i < n; ++i) {
+			memcpy(grown.data() + at, parts[i].data, parts[i].size);
+			at += parts[i].size;
+		}
+		storage.swap(grown);
+		head = 0;
+		tail = at;
+	}
+
+	size_t mask = storage.size() - 1;
+	size_t start = tail & mask;
+	size_t first = std::min(count, storage.size() - start);
+	memcpy(storage.data() + start, data, first);
+	memcpy(storage.data(), data + first, count - first);
+	tail += count;
+}
+
+size_t ByteRing::spans_at(size_t offset, size_t count, Span out[2]) const {
+	assert(offset + count <= size());
+	if (count == 0) return 0;
+	size_t mask = storage.size() - 1;
+	size_t start = (head + offset) & mask;
+	size_t first = std::min(count, storage.size() - start);
+	out[0].data = storage.data() + start;
+	out[0].size = first;
+	if (first == count) return 1;
+	out[1].data = storage.data();
+	out[1].size = count - first;
+	return 2;
+}
+
+char *ByteQueue::prepare(size_t count) {
+	if (tail + count > storage.size()) {
+		if (head > 0 && head >= size()) {
+			//reclaim the consumed prefix (moves at most as many bytes as were consumed):
+			memmove(storage.data(), storage.data() + head, size());
+			tail -= head;
+			head = 0;
+		}
+		if (tail + count > storage.size()) {
+			storage.resize(std::max(storage.size() * 2, tail + count));
+		}
+	}
+	return storage.data() + tail;
+}
+
+void SendQueue::push(void const *data, size_t count) {
+	if (count == 0) return;
+	ring.push(data, count);
+	if (entries.empty() || entries.back().shared) {
+		entries.emplace_back();
+	}
+	entries.back().size += count;
+	total += count;
+}
+
+void SendQueue::push(SharedBuffer const &buffer) {
+	if (!buffer || buffer->empty()) return;
+	entries.emplace_back();
+	entries.back().shared = buffer;
+	entries.back().size = buffer->size();
+	total += buffer->size();
+}
+
+size_t SendQueue::gather(Span *spans, size_t max) const {
+	size_t used = 0;
+	size_t ring_offset = 0; //where the current ring entry starts within 'ring'
+	size_t skip = front_offset;
+	for (auto const &entry : entries) {
+		if (used == max) break;
+		size_t count = entry.size - skip;
+		if (entry.shared) {
+			spans[used].data = entry.shared->data() + skip;
+			spans[used].size = count;
+			used += 1;
+		} else {
+			Span parts[2];
+			size_t n = ring.spans_at(ring_offset, count, parts);
+			for (size_t i = 0; i < n && used < max; ++i) {
+				spans[used++] = parts[i];
+			}
+			ring_offset += count;
+		}
+		skip = 0;
+	}
+	return used;
+}
+
+void SendQueue::consume(size_t count) {
+	assert(count <= total);
+	total -= count;
+	sent += count;
+	while (count > 0) {
+		assert(!entries.empty());
+		Entry &front = entries.front();
+		size_t take = std::min(count, front.size - front_offset);
+		if (!front.shared) ring.consume(take);
+		front_offset += take;
+		count -= take;
+		if (front_offset == front.size) {
+			entries.pop_front();
+			front_offset = 0;
+		}
+	}
+}
+
+void SendQueue::clear() {
+	entries.clear();
+	front_offset = 0;
+	total = 0;
+	ring.clear();
+}
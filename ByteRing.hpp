@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+//Byte queues used for Connection's send and receive buffers.
+// Both have amortized O(1) append and consume-from-front, so draining a partially
+// sent or partially parsed buffer never shifts the remaining bytes on every call.
+
+//ByteRing is a growable ring buffer (capacity is always a power of two).
+// Queued bytes occupy at most two contiguous spans, which can be handed to a
+// gather-send (writev/sendmsg) to flush everything in one system call:
+struct ByteRing {
+	struct Span {
+		char const *data = nullptr;
+		size_t size = 0;
+	};
+
+	size_t size() const { return tail - head; }
+	bool empty() const { return tail == head; }
+
+	//append bytes, growing (and un-wrapping) the storage if needed:
+	void push(void const *data, size_t count);
+
+	//drop 'count' bytes from the front:
+	void consume(size_t count) {
+		assert(count <= size());
+		head += count;
+		if (head == tail) head = tail = 0;
+	}
+
+	void clear() { head = tail = 0; }
+
+	//fill 'spans' with the queued bytes, in order; returns number of spans used (0, 1, or 2):
+	size_t spans(Span spans[2]) const { return spans_at(0, size(), spans); }
+	//same, but for only 'count' bytes starting 'offset' bytes from the front:
+	size_t spans_at(size_t offset, size_t count, Span spans[2]) const;
+
+	//internals:
+	std::vector< char > storage;
+	size_t head = 0; //(head and tail only ever increase; index storage with & (storage.size() - 1))
+	size_t tail = 0;
+};
+
+//ByteQueue keeps its bytes contiguous (so a parser can look at them in place) and
+// consumes from the front by advancing an offset; the dead prefix is only reclaimed
+// when appending, and only once it is at least as large as the live data:
+struct ByteQueue {
+	char const *data() const { return storage.data() + head; }
+	size_t size() const { return tail - head; }
+	bool empty() const { return tail == head; }
+
+	void push(void const *data, size_t count) {
+		memcpy(prepare(count), data, count);
+		commit(count);
+	}
+
+	//get space for at least 'count' more bytes at the back (e.g. to recv() into directly);
+	// may move existing data, invalidating pointers returned by data():
+	char *prepare(size_t count);
+	//mark 'count' bytes of prepared space as filled:
+	void commit(size_t count) {
+		assert(tail + count <= storage.size());
+		tail += count;
+		added += count;
+	}
+
+	//drop 'count' bytes from the front (pointers into the queue stay valid):
+	void consume(size_t count) {
+		assert(count <= size());
+		head += count;
+		if (head == tail) head = tail = 0;
+	}
+
+	void clear() { head = tail = 0; }
+
+	uint64_t added = 0; //bytes ever committed (for stats)
+
+	//internals:
+	std::vector< char > storage;
+	size_t head = 0;
+	size_t tail = 0;
+};
+
+//SharedBuffer is an immutable, reference-counted message that can be queued on
+// any number of connections without copying (e.g. one serialized snapshot for a whole room):
+typedef std::shared_ptr< std::vector< char > const > SharedBuffer;
+
+//SendQueue is Connection's outgoing queue: small writes are copied into a ByteRing,
+// SharedBuffers are queued by reference, and gather() lists everything (in order)
+// for a single gather-send:
+struct SendQueue {
+	typedef ByteRing::Span Span;
+
+	size_t size() const { return total; }
+	bool empty() const { return total == 0; }
+
+	//copy bytes onto the end of the queue:
+	void push(void const *data, size_t count);
+	//queue a shared buffer (no copy; the queue holds a reference until it is sent):
+	void push(SharedBuffer const &buffer);
+
+	//fill up to 'max' spans with queued bytes, in order; returns number of spans used:
+	size_t gather(Span *spans, size_t max) const;
+	//drop 'count' bytes from the front (e.g., after they were sent):
+	void consume(size_t count);
+
+	void clear();
+
+	uint64_t sent = 0; //bytes ever consumed, i.e. sent (for stats)
+
+	//internals:
+	struct Entry {
+		SharedBuffer shared; //if null, the next 'size' bytes of 'ring'
+		size_t size = 0;
+	};
+	std::deque< Entry > entries;
+	size_t front_offset = 0; //bytes of entries.front() already consumed
+	size_t total = 0;
+	ByteRing ring;
+};
@@ -1,17 +1,88 @@
 #include "Connection.hpp"
+#include "Udp.hpp"
+#include "NetSim.hpp"
+#include "Log.hpp"
 
-#include <iostream>
 #include <cmath>
 #include <algorithm>
+#include <stdexcept>
+#include <system_error>
 #include <cassert>
 #include <cstring>
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+#ifdef CONNECTION_USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#endif
+
 //NOTE: much of the sockets code herein is based on http-tweak's single-header http server
 // see: https://github.com/ixchow/http-tweak
 
 //Also, some help and examples for getaddrinfo from: https://beej.us/guide/bgnet/html/multi/syscalls.html
 
 
+//---------------------------------
+//"ip:port" of an address, for logging:
+static std::string describe_address(struct addrinfo const *info) {
+	char ip[INET6_ADDRSTRLEN];
+	if (info->ai_family == AF_INET) {
+		struct sockaddr_in const *s = reinterpret_cast< struct sockaddr_in const * >(info->ai_addr);
+		inet_ntop(info->ai_family, &s->sin_addr, ip, sizeof(ip));
+		return std::string(ip) + ":" + std::to_string(ntohs(s->sin_port));
+	} else if (info->ai_family == AF_INET6) {
+		struct sockaddr_in6 const *s = reinterpret_cast< struct sockaddr_in6 const * >(info->ai_addr);
+		inet_ntop(info->ai_family, &s->sin6_addr, ip, sizeof(ip));
+		return std::string(ip) + ":" + std::to_string(ntohs(s->sin6_port));
+	} else {
+		return "[unknown ai_family]";
+	}
+}
+
+//Send as much of a connection's queued data as the socket will take, in one call:
+static ssize_t send_queued(Connection &c) {
+	const size_t MaxSpans = 64;
+	SendQueue::Span spans[MaxSpans];
+	size_t count = c.send_buffer.gather(spans, MaxSpans);
+	assert(count > 0);
+
+	#ifdef _WIN32
+	//(no gather-send here; the rest of the queue goes out on the next call)
+	return send(c.socket, spans[0].data, int(spans[0].size), 0);
+	#else
+	struct iovec iov[MaxSpans];
+	for (size_t i = 0; i < count; ++i) {
+		iov[i].iov_base = const_cast< char * >(spans[i].data);
+		iov[i].iov_len = spans[i].size;
+	}
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+	int flags = MSG_DONTWAIT;
+	#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL; //report EPIPE as an error instead of raising SIGPIPE
+	#endif
+	return sendmsg(c.socket, &msg, flags);
+	#endif
+}
+
+//Receive directly into the back of a connection's recv_buffer:
+static ssize_t recv_into(Connection &c, size_t max) {
+	char *into = c.recv_buffer.prepare(max);
+	#ifdef _WIN32
+	ssize_t ret = recv(c.socket, into, int(max), MSG_DONTWAIT);
+	#else
+	ssize_t ret = recv(c.socket, into, max, MSG_DONTWAIT);
+	#endif
+	if (ret > 0 && ret <= (ssize_t)max) c.recv_buffer.commit(size_t(ret));
+	return ret;
+}
+
 //---------------------------------
 //Polling helper used by both server and client:
 void poll_connections(
@@ -34,7 +105,7 @@ void poll_connections(
 	}
 
 	//add each connection's socket to read (and possibly write) sets:
-	for (auto c : connections) {
+	for (auto const &c : connections) {
 		if (c.socket != INVALID_SOCKET) {
 			max = std::max(max, int(c.socket));
 			FD_SET(c.socket, &read_fds);
@@ -52,7 +123,7 @@ void poll_connections(
 		int ret = select(max + 1, &read_fds, &write_fds, NULL, &tv);
 
 		if (ret < 0) {
-			std::cerr << "[" << where << "] Select returned an error; will attempt to read/write anyway." << std::endl;
+			log_warning("[{}] Select returned an error; will attempt to read/write anyway.", where);
 		} else if (ret == 0) {
 			//nothing to read or write.
 			return;
@@ -73,36 +144,34 @@ void poll_connections(
 			#endif
 				connections.emplace_back();
 				connections.back().socket = got;
-				std::cerr << "[" << where << "] client connected on " << connections.back().socket << "." << std::endl; //INFO
+				log_info("[{}] client connected on {}.", where, connections.back().socket);
 				if (on_event) on_event(&connections.back(), Connection::OnOpen);
 			}
 		}
 	}
 
 	const uint32_t BufferSize = 20000;
-	static thread_local char *buffer = new char[BufferSize];
 
 	//process requests:
 	for (auto &c : connections) {
 		//only read from valid sockets marked readable:
 		if (c.socket == INVALID_SOCKET || !FD_ISSET(c.socket, &read_fds)) continue;
 
-		ssize_t ret = recv(c.socket, buffer, BufferSize, MSG_DONTWAIT);
+		ssize_t ret = recv_into(c, BufferSize);
 		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
 			//~no problem~ but no data
 		} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
 			//~problem~ so remove connection
 			if (ret == 0) {
-				std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
+				log_info("[{}] port closed, disconnecting.", where);
 			} else if (ret < 0) {
-				std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
+				log_warning("[{}] recv() returned error {}({}), disconnecting.", where, errno, strerror(errno));
 			} else {
-				std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
+				log_warning("[{}] recv() returned strange number of bytes, disconnecting.", where);
 			}
 			c.close();
 			if (on_event) on_event(&c, Connection::OnClose);
 		} else { //ret > 0
-			c.recv_buffer.insert(c.recv_buffer.end(), buffer, buffer + ret);
 			if (on_event) on_event(&c, Connection::OnRecv);
 		}
 	}
@@ -112,34 +181,199 @@ void poll_connections(
 		//don't bother with connections unless they are valid, have something to send, and are marked writable:
 		if (c.socket == INVALID_SOCKET || c.send_buffer.empty() || !FD_ISSET(c.socket, &write_fds)) continue;
 		
-		#ifdef _WIN32
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), int(c.send_buffer.size()), MSG_DONTWAIT);
-		#else
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), c.send_buffer.size(), MSG_DONTWAIT);
-		#endif 
+		ssize_t ret = send_queued(c);
 		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
 			//~no problem~, but don't keep trying
 			break;
 		} else if (ret <= 0 || ret > (ssize_t)c.send_buffer.size()) {
 			if (ret < 0) {
-				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
+				log_warning("[{}] send() returned error {}, disconnecting.", where, errno);
 			} else { assert(ret == 0 || ret > (ssize_t)c.send_buffer.size());
-				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << c.send_buffer.size() << "], disconnecting." << std::endl;
+				log_warning("[{}] send() returned strange number of bytes [{} of {}], disconnecting.", where, ret, c.send_buffer.size());
 			}
 			c.close();
 			if (on_event) on_event(&c, Connection::OnClose);
 		} else { //ret seems reasonable
-			c.send_buffer.erase(c.send_buffer.begin(), c.send_buffer.begin() + ret);
+			c.send_buffer.consume(size_t(ret));
 		}
 	}
 
 		
 }
 
+
+#ifdef CONNECTION_USE_EPOLL
 //---------------------------------
+//Edge-triggered epoll helpers used by Server on linux:
+// each socket is registered once (on accept) and only sockets that get events or
+// have queued data are touched on a given poll.
+
+static void epoll_flush(char const *where, Connection &c, std::function< void(Connection *, Connection::Event event) > const &on_event, bool *closed) {
+	//write as much as possible; with edge-triggered notification we must keep going until EAGAIN:
+	while (c.socket != INVALID_SOCKET && c.writable && !c.send_buffer.empty()) {
+		ssize_t ret = send_queued(c);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//wait for EPOLLOUT:
+			c.writable = false;
+		} else if (ret <= 0 || ret > (ssize_t)c.send_buffer.size()) {
+			if (ret < 0) {
+				log_warning("[{}] send() returned error {}, disconnecting.", where, errno);
+			} else {
+				log_warning("[{}] send() returned strange number of bytes [{} of {}], disconnecting.", where, ret, c.send_buffer.size());
+			}
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+		} else { //ret seems reasonable
+			c.send_buffer.consume(size_t(ret));
+		}
+	}
+	if (c.socket == INVALID_SOCKET) *closed = true;
+}
+
+static void epoll_flush_pending(char const *where, Server &server, std::function< void(Connection *, Connection::Event event) > const &on_event, bool *closed) {
+	//NOTE: flushing may call on_event, which may queue more connections, so index rather than iterate:
+	for (size_t i = 0; i < server.pending.size(); ++i) {
+		Connection *c = server.pending[i];
+		c->is_pending = false;
+		epoll_flush(where, *c, on_event, closed);
+	}
+	server.pending.clear();
+}
+
+//accept every pending connection on the (edge-triggered) listen socket:
+static void epoll_accept(char const *where, Server &server, std::function< void(Connection *, Connection::Event event) > const &on_event, bool *closed) {
+	bool retrying = server.accept_retry;
+	server.accept_retry = false;
+	while (true) {
+		SOCKET got = accept4(server.listen_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (got == INVALID_SOCKET) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break; //backlog is empty
+			if (errno == EINTR || errno == ECONNABORTED) continue; //(a client that reset while queued doesn't hold up the rest)
+			//e.g. out of file descriptors (EMFILE / ENFILE) or buffers (ENOBUFS); no new edge
+			// fires for connections that are already queued, so try again next poll:
+			if (!retrying) log_warning("[{}] accept() returned error {}({}); will retry every poll.", where, errno, strerror(errno));
+			server.accept_retry = true;
+			break;
+		}
+		if (retrying) {
+			log_info("[{}] accept() working again.", where);
+			retrying = false;
+		}
+
+		server.connections.emplace_back();
+		Connection &c = server.connections.back();
+		c.socket = got;
+		c.pending = &server.pending;
+		c.writable = true;
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = &c;
+		if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, got, &ev) != 0) {
+			log_warning("[{}] failed to register client with epoll ({}), disconnecting.", where, strerror(errno));
+			c.close();
+			*closed = true;
+			continue;
+		}
+		log_info("[{}] client connected on {}.", where, c.socket);
+		if (on_event) on_event(&c, Connection::OnOpen);
+	}
+}
+
+static void epoll_poll(char const *where, Server &server, std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
+	bool closed = false;
 
+	//send anything queued since the last poll before (possibly) sleeping:
+	epoll_flush_pending(where, server, on_event, &closed);
 
-Server::Server(std::string const &port) {
+	//connections left in the backlog by a failed accept pass:
+	if (server.accept_retry) epoll_accept(where, server, on_event, &closed);
+
+	const int MaxEvents = 256;
+	static thread_local struct epoll_event events[MaxEvents];
+
+	int timeout_ms = (timeout <= 0.0 ? 0 : int(std::ceil(timeout * 1000.0)));
+	int count = epoll_wait(server.epoll_fd, events, MaxEvents, timeout_ms);
+	if (count < 0) {
+		if (errno != EINTR) {
+			log_warning("[{}] epoll_wait returned error {}({}).", where, errno, strerror(errno));
+		}
+		count = 0;
+	}
+
+	const uint32_t BufferSize = 20000;
+
+	for (int e = 0; e < count; ++e) {
+		if (events[e].data.ptr == &server.wake_fd) {
+			//just a wake-up; reset the eventfd counter:
+			uint64_t value;
+			while (read(server.wake_fd, &value, sizeof(value)) > 0) { }
+			continue;
+		}
+		if (events[e].data.ptr == nullptr) {
+			epoll_accept(where, server, on_event, &closed);
+			continue;
+		}
+
+		Connection &c = *reinterpret_cast< Connection * >(events[e].data.ptr);
+		if (c.socket == INVALID_SOCKET) continue; //closed earlier in this batch
+
+		if (events[e].events & EPOLLOUT) {
+			c.writable = true;
+			if (!c.send_buffer.empty()) c.mark_pending();
+		}
+
+		if (events[e].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			//read until EAGAIN, since we won't be told about this data again:
+			bool got_data = false;
+			while (c.socket != INVALID_SOCKET) {
+				ssize_t ret = recv_into(c, BufferSize);
+				if (ret < 0 && errno == EINTR) {
+					continue;
+				} else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					//~no problem~ but no more data
+					break;
+				} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
+					//~problem~ so remove connection
+					if (ret == 0) {
+						log_info("[{}] port closed, disconnecting.", where);
+					} else if (ret < 0) {
+						log_warning("[{}] recv() returned error {}({}), disconnecting.", where, errno, strerror(errno));
+					} else {
+						log_warning("[{}] recv() returned strange number of bytes, disconnecting.", where);
+					}
+					//deliver whatever arrived before the close:
+					if (got_data && on_event) on_event(&c, Connection::OnRecv);
+					got_data = false;
+					if (c.socket != INVALID_SOCKET) {
+						c.close();
+						if (on_event) on_event(&c, Connection::OnClose);
+					}
+				} else { //ret > 0
+					got_data = true;
+				}
+			}
+			if (got_data && on_event) on_event(&c, Connection::OnRecv);
+		}
+		if (c.socket == INVALID_SOCKET) closed = true;
+	}
+
+	//send responses generated by the callbacks above:
+	epoll_flush_pending(where, server, on_event, &closed);
+
+	//reap closed clients (only walk the list if something actually closed):
+	if (closed) {
+		server.connections.remove_if([](Connection const &c){ return c.socket == INVALID_SOCKET; });
+	}
+}
+#endif
+
+//---------------------------------
+
+
+Server::Server(std::string const &port, Transport transport) {
 
 	#ifdef _WIN32
 	{ //init winsock:
@@ -154,7 +388,7 @@ Server::Server(std::string const &port) {
 		struct addrinfo hints;
 		memset(&hints, 0, sizeof(hints));
 		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_socktype = (transport == TransportUDP ? SOCK_DGRAM : SOCK_STREAM);
 		hints.ai_flags = AI_PASSIVE;
 
 		struct addrinfo *res = nullptr;
@@ -163,29 +397,14 @@ Server::Server(std::string const &port) {
 			throw std::runtime_error("getaddrinfo error: " + std::string(gai_strerror(ret)));
 		}
 
-		std::cout << "[Server::Server] binding to " << port << ":" << std::endl;
+		log_info("[Server::Server] binding to {}:", port);
 		//based on example code in the 'man getaddrinfo' man page on OSX:
 		for (struct addrinfo *info = res; info != nullptr; info = info->ai_next) {
-			{ //DEBUG: dump info about this address:
-				std::cout << "\ttrying ";
-				char ip[INET6_ADDRSTRLEN];
-				if (info->ai_family == AF_INET) {
-					struct sockaddr_in *s = reinterpret_cast< struct sockaddr_in * >(info->ai_addr);
-					inet_ntop(res->ai_family, &s->sin_addr, ip, sizeof(ip));
-					std::cout << ip << ":" << ntohs(s->sin_port);
-				} else if (info->ai_family == AF_INET6) {
-					struct sockaddr_in6 *s = reinterpret_cast< struct sockaddr_in6 * >(info->ai_addr);
-					inet_ntop(res->ai_family, &s->sin6_addr, ip, sizeof(ip));
-					std::cout << ip << ":" << ntohs(s->sin6_port);
-				} else {
-					std::cout << "[unknown ai_family]";
-				}
-				std::cout << "... "; std::cout.flush();
-			}
+			std::string address = describe_address(info);
 
 			SOCKET s = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
 			if (s == INVALID_SOCKET) {
-				std::cout << "(failed to create socket: " << strerror(errno) << ")" << std::endl;
+				log_info("\ttrying {}... (failed to create socket: {})", address, strerror(errno));
 				continue;
 			}
 
@@ -198,16 +417,16 @@ Server::Server(std::string const &port) {
 				int ret = setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
 				#endif
 				if (ret != 0) {
-					std::cout << "[note: couldn't set SO_REUSEADDR] " << std::endl;
+					log_info("\ttrying {}... [note: couldn't set SO_REUSEADDR]", address);
 				}
 			}
 
 			int ret = bind(s, info->ai_addr, int(info->ai_addrlen));
 			if (ret < 0) {
-				std::cout << "(failed to bind: " << strerror(errno) << ")" << std::endl;
+				log_info("\ttrying {}... (failed to bind: {})", address, strerror(errno));
 				continue;
 			}
-			std::cout << "success!" << std::endl;
+			log_info("\ttrying {}... success!", address);
 
 			listen_socket = s;
 			break;
@@ -217,19 +436,70 @@ Server::Server(std::string const &port) {
 	}
 
 	if (listen_socket == INVALID_SOCKET) {
+		log_flush(); //(so the reasons above show up before the exception does)
 		throw std::runtime_error("Failed to bind to port " + port);
 	}
 
-	{ //listen on socket
+	if (transport == TransportUDP) {
+		//no listening; peers are told apart by address as their packets arrive:
+		udp = std::make_shared< UdpHost >();
+		#ifdef _WIN32
+		u_long one = 1;
+		ioctlsocket(listen_socket, FIONBIO, &one);
+		#endif
+	} else { //listen on socket
 		int ret = ::listen(listen_socket, 5);
 		if (ret < 0) {
 			closesocket(listen_socket);
 			throw std::system_error(errno, std::system_category(), "failed to listen on socket");
 		}
 	}
+
+	#ifdef CONNECTION_USE_EPOLL
+	{ //register listen socket with a new epoll instance:
+		int flags = fcntl(listen_socket, F_GETFL, 0);
+		fcntl(listen_socket, F_SETFL, flags | O_NONBLOCK);
+
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0) {
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+		}
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.ptr = nullptr; //nullptr marks the listen (or UDP) socket
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_socket, &ev) != 0) {
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to register listen socket with epoll");
+		}
+
+		wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.ptr = &wake_fd;
+		if (wake_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) != 0) {
+			throw std::system_error(errno, std::system_category(), "failed to set up wake eventfd");
+		}
+	}
+	#endif
+}
+
+void Server::wake() {
+	#ifdef CONNECTION_USE_EPOLL
+	uint64_t one = 1;
+	ssize_t ret = write(wake_fd, &one, sizeof(one));
+	(void)ret; //if the counter is somehow full, poll() is going to wake anyway
+	#endif
 }
 
 void Server::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
+	if (udp) {
+		udp_server_poll("Server::poll", *this, on_event, timeout);
+		return;
+	}
+
+	#ifdef CONNECTION_USE_EPOLL
+	epoll_poll("Server::poll", *this, on_event, timeout);
+	#else
 	poll_connections("Server::poll", connections, on_event, timeout, listen_socket);
 
 	//reap closed clients:
@@ -240,9 +510,10 @@ void Server::poll(std::function< void(Connection *, Connection::Event event) > c
 			connections.erase(old);
 		}
 	}
+	#endif
 }
 
-Client::Client(std::string const &host, std::string const &port) : connections(1), connection(connections.front()) {
+Client::Client(std::string const &host, std::string const &port, Transport transport) : connections(1), connection(connections.front()) {
 	#ifdef _WIN32
 	{ //init winsock:
 		WSADATA info;
@@ -256,8 +527,8 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 		struct addrinfo hints;
 		memset(&hints, 0, sizeof(hints));
 		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_protocol = IPPROTO_TCP;
+		hints.ai_socktype = (transport == TransportUDP ? SOCK_DGRAM : SOCK_STREAM);
+		hints.ai_protocol = (transport == TransportUDP ? IPPROTO_UDP : IPPROTO_TCP);
 
 		struct addrinfo *res = nullptr;
 		int ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
@@ -265,37 +536,22 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 			throw std::runtime_error("getaddrinfo error: " + std::string(gai_strerror(ret)));
 		}
 
-		std::cout << "[Client::Client] connecting to " << host << ":" << port << ":" << std::endl;
+		log_info("[Client::Client] connecting to {}:{}:", host, port);
 		//based on example code in the 'man getaddrinfo' man page on OSX:
 		for (struct addrinfo *info = res; info != nullptr; info = info->ai_next) {
-			{ //DEBUG: dump info about this address:
-				std::cout << "\ttrying ";
-				char ip[INET6_ADDRSTRLEN];
-				if (info->ai_family == AF_INET) {
-					struct sockaddr_in *s = reinterpret_cast< struct sockaddr_in * >(info->ai_addr);
-					inet_ntop(res->ai_family, &s->sin_addr, ip, sizeof(ip));
-					std::cout << ip << ":" << ntohs(s->sin_port);
-				} else if (info->ai_family == AF_INET6) {
-					struct sockaddr_in6 *s = reinterpret_cast< struct sockaddr_in6 * >(info->ai_addr);
-					inet_ntop(res->ai_family, &s->sin6_addr, ip, sizeof(ip));
-					std::cout << ip << ":" << ntohs(s->sin6_port);
-				} else {
-					std::cout << "[unknown ai_family]";
-				}
-				std::cout << "... "; std::cout.flush();
-			}
+			std::string address = describe_address(info);
 
 			SOCKET s = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
 			if (s == INVALID_SOCKET) {
-				std::cout << "(failed to create socket: " << strerror(errno) << ")" << std::endl;
+				log_info("\ttrying {}... (failed to create socket: {})", address, strerror(errno));
 				continue;
 			}
 			int ret = connect(s, info->ai_addr, int(info->ai_addrlen));
 			if (ret < 0) {
-				std::cout << "(failed to connect: " << strerror(errno) << ")" << std::endl;
+				log_info("\ttrying {}... (failed to connect: {})", address, strerror(errno));
 				continue;
 			}
-			std::cout << "success!" << std::endl;
+			log_info("\ttrying {}... success!", address);
 
 			connection.socket = s;
 			break;
@@ -304,13 +560,99 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 		freeaddrinfo(res);
 
 		if (!connection) {
+			log_flush(); //(so the reasons above show up before the exception does)
 			throw std::runtime_error("Failed to connect to any of the addresses tried for server.");
 		}
 	}
+
+	if (transport == TransportUDP) {
+		//(the socket is connect()ed, so it only ever talks to the server)
+		connection.udp = std::make_shared< UdpPeer >();
+		connection.udp->owns_socket = true;
+		#ifdef _WIN32
+		u_long one = 1;
+		ioctlsocket(connection.socket, FIONBIO, &one);
+		#endif
+	}
+}
+
+
+void Client::simulate_network(NetSimConfig const &config) {
+	connection.netsim = std::make_shared< NetSim >(config, !connection.udp);
+	if (config.bandwidth > 0.0) {
+		log_info("[Client] simulating {}ms (+/- {}ms) latency each way, {}% loss, {}% reordering, {} bytes/sec.",
+			config.latency * 1000.0, config.jitter * 1000.0, config.loss * 100.0, config.reorder * 100.0, config.bandwidth);
+	} else {
+		log_info("[Client] simulating {}ms (+/- {}ms) latency each way, {}% loss, {}% reordering.",
+			config.latency * 1000.0, config.jitter * 1000.0, config.loss * 100.0, config.reorder * 100.0);
+	}
 }
 
+//Client::poll over TCP with a NetSim attached: bytes go from send_buffer through
+// netsim.up to netsim.wire and out the socket, and from the socket into
+// netsim.arrived and through netsim.down to recv_buffer. The simulator's buffers
+// are swapped in for the connection's around the real poll:
+static void netsim_poll(char const *where, Client &client, std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
+	Connection &c = client.connection;
+	NetSim &sim = *c.netsim;
+	double t = NetSim::now();
+
+	//whatever was queued since the last poll is "sent" now:
+	if (!c.send_buffer.empty()) {
+		std::vector< char > sent;
+		sent.reserve(c.send_buffer.size());
+		while (!c.send_buffer.empty()) {
+			SendQueue::Span spans[16];
+			size_t count = c.send_buffer.gather(spans, 16);
+			size_t bytes = 0;
+			for (size_t i = 0; i < count; ++i) {
+				sent.insert(sent.end(), spans[i].data, spans[i].data + spans[i].size);
+				bytes += spans[i].size;
+			}
+			c.send_buffer.consume(bytes);
+		}
+		sim.up.push(sent.data(), sent.size(), t);
+	}
+	sim.up.pop_due(t, [&sim](char const *data, size_t size){
+		sim.wire.push(data, size);
+	});
+
+	//don't sleep past the next delivery:
+	timeout = std::max(0.0, std::min(timeout, sim.next_due() - t));
+
+	bool closed = false;
+	std::swap(c.send_buffer, sim.wire);
+	std::swap(c.recv_buffer, sim.arrived);
+	poll_connections(where, client.connections, [&closed](Connection *, Connection::Event event){
+		if (event == Connection::OnClose) closed = true;
+	}, timeout, INVALID_SOCKET);
+	std::swap(c.send_buffer, sim.wire);
+	std::swap(c.recv_buffer, sim.arrived);
+
+	t = NetSim::now();
+	if (!sim.arrived.empty()) {
+		sim.down.push(sim.arrived.data(), sim.arrived.size(), t);
+		sim.arrived.clear();
+	}
+	bool delivered = false;
+	sim.down.pop_due(t, [&c, &delivered](char const *data, size_t size){
+		c.recv_buffer.push(data, size);
+		delivered = true;
+	});
+	if (delivered && on_event) on_event(&c, Connection::OnRecv);
+	//(anything still in flight is dropped along with the connection)
+	if (closed && on_event) on_event(&c, Connection::OnClose);
+}
 
 void Client::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
+	if (connection.udp) {
+		udp_client_poll("Client::poll", *this, on_event, timeout);
+		return;
+	}
+	if (connection.netsim) {
+		netsim_poll("Client::poll", *this, on_event, timeout);
+		return;
+	}
 	poll_connections("Client::poll", connections, on_event, timeout, INVALID_SOCKET);
 }
 
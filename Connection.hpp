@@ -27,16 +27,24 @@ typedef int ssize_t;
 #include <unistd.h>
 #include <netdb.h>
 
+#ifdef __linux__
+//on linux, Server uses an edge-triggered epoll event loop instead of select():
+#define CONNECTION_USE_EPOLL 1
+#endif
+
 #define closesocket close
 typedef int SOCKET;
 constexpr const SOCKET INVALID_SOCKET = -1;
 #endif
 //--------- ---------------------------------- ---------
 
+#include "ByteRing.hpp"
+
 #include <vector>
 #include <list>
 #include <string>
 #include <functional>
+#include <memory>
 
 /* 
  * Connection is a simple wrapper around a TCP socket connection.
@@ -52,7 +60,7 @@ int main(int argc, char **argv) {
 		server.poll([](Connection *connection, Connection::Event evt){
 			if (evt == Connection::OnRecv) {
 				//extract and erase data from the connection's recv_buffer:
-				std::vector< uint8_t > data = connection->recv_buffer;
+				std::vector< char > data(connection->recv_buffer.data(), connection->recv_buffer.data() + connection->recv_buffer.size());
 				connection->recv_buffer.clear();
 				//send to other connections:
 
@@ -78,7 +86,20 @@ int main(int argc, char **argv) {
  */
 
 
-//Thin wrapper around a (polling-based) TCP socket connection:
+//Which kind of socket a Server or Client talks over (see Udp.hpp for the UDP transport):
+enum Transport {
+	TransportTCP,
+	TransportUDP
+};
+
+struct UdpPeer;
+struct UdpHost;
+struct NetSim;
+struct NetSimConfig;
+struct Connection;
+void udp_close(Connection &c); //(Udp.cpp) tell the peer we're leaving
+
+//Thin wrapper around a (polling-based) TCP socket connection (or a UDP peer):
 struct Connection {
 	//Helper that will append any type to the send buffer:
 	template< typename T >
@@ -87,14 +108,22 @@ struct Connection {
 	}
 	//Helper that will append raw bytes to the send buffer:
 	void send_raw(void const *data, size_t size) {
-		send_buffer.insert(send_buffer.end(), reinterpret_cast< uint8_t const * >(data), reinterpret_cast< uint8_t const * >(data) + size);
+		send_buffer.push(data, size);
+		mark_pending();
+	}
+	//Helper that will queue a shared (immutable) buffer without copying it:
+	void send_shared(SharedBuffer const &buffer) {
+		send_buffer.push(buffer);
+		mark_pending();
 	}
 
 	//Call 'close' to mark a connection for discard:
 	void close() {
 		if (socket != INVALID_SOCKET) {
-			::closesocket(socket);
+			if (udp) udp_close(*this); //(UDP peers on a server share its socket)
+			else ::closesocket(socket);
 			socket = INVALID_SOCKET;
+			mark_pending();
 		}
 	}
 
@@ -102,12 +131,28 @@ struct Connection {
 	explicit operator bool() { return socket != INVALID_SOCKET; }
 
 	//To send data over a connection, append it to send_buffer:
-	std::vector< char > send_buffer;
-	//When the connection receives data, it is appended to recv_buffer:
-	std::vector< char > recv_buffer;
+	// (queued bytes are flushed with a single gather-send per poll where the platform allows)
+	SendQueue send_buffer;
+	//When the connection receives data, it is appended to recv_buffer;
+	// consume() bytes from its front once they have been handled (see Protocol.hpp's next_message):
+	ByteQueue recv_buffer;
 
 	//internals:
 	SOCKET socket = INVALID_SOCKET;
+	std::shared_ptr< UdpPeer > udp; //sequencing and reliability state, if this is a UDP connection
+	std::shared_ptr< NetSim > netsim; //(Client only) simulated network conditions, see Client::simulate_network()
+
+	//(epoll backend) the owning Server keeps a list of connections that need flushing or reaping,
+	// so that each poll only touches sockets that actually have something going on:
+	std::vector< Connection * > *pending = nullptr;
+	bool is_pending = false;
+	bool writable = false; //edge-triggered: last send didn't hit EAGAIN (or EPOLLOUT seen since)
+	void mark_pending() {
+		if (pending && !is_pending) {
+			is_pending = true;
+			pending->push_back(this);
+		}
+	}
 
 	enum Event {
 		OnOpen,
@@ -117,7 +162,7 @@ struct Connection {
 };
 
 struct Server {
-	Server(std::string const &port); //pass the port number to listen on, as a string (servname, really)
+	Server(std::string const &port, Transport transport = TransportTCP); //pass the port number to listen on, as a string (servname, really)
 
 	//poll() updates the list of active connections and provides information to your callbacks:
 	void poll(
@@ -125,13 +170,25 @@ struct Server {
 		double timeout = 0.0 //timeout (seconds)
 	);
 
+	//wake() may be called from any thread to make a poll() that is waiting return early:
+	// (only supported with the epoll backend; otherwise poll() just waits out its timeout)
+	void wake();
+
 	std::list< Connection > connections;
-	SOCKET listen_socket = INVALID_SOCKET;
+	SOCKET listen_socket = INVALID_SOCKET; //(with TransportUDP, the socket every peer's packets arrive on)
+	std::shared_ptr< UdpHost > udp; //set if using TransportUDP
+
+	#ifdef CONNECTION_USE_EPOLL
+	int epoll_fd = -1;
+	int wake_fd = -1; //eventfd written by wake()
+	std::vector< Connection * > pending; //connections with queued sends or that were closed
+	bool accept_retry = false; //last accept pass stopped early (e.g. out of file descriptors); try again next poll
+	#endif
 };
 
 
 struct Client {
-	Client(std::string const &host, std::string const &port);
+	Client(std::string const &host, std::string const &port, Transport transport = TransportTCP);
 
 	//poll() checks the status of the active connection and provides information to your callbacks:
 	void poll(
@@ -139,6 +196,10 @@ struct Client {
 		double timeout = 0.0 //timeout (seconds)
 	);
 
+	//simulate_network() delays (and maybe drops) everything sent and received from now on
+	// according to 'config' -- see NetSim.hpp:
+	void simulate_network(NetSimConfig const &config);
+
 	std::list< Connection > connections; //will only ever contain exactly one connection
 	Connection &connection; //reference to the only connection in the connections list
 };
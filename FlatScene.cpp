@@ -0,0 +1,242 @@
+#include "FlatScene.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+
+//apply 'order' (new index -> old index) to one array:
+template< typename T >
+void permute(std::vector< T > &values, std::vector< uint32_t > const &order) {
+	std::vector< T > sorted;
+	sorted.reserve(order.size());
+	for (uint32_t old : order) {
+		sorted.emplace_back(std::move(values[old]));
+	}
+	values.swap(sorted);
+}
+
+//translate * rotate * scale, like Scene::Transform::make_local_to_parent:
+glm::mat4 make_local_to_parent(glm::vec3 const &position, glm::quat const &rotation, glm::vec3 const &scale) {
+	glm::mat3 r = glm::mat3_cast(rotation);
+	return glm::mat4(
+		glm::vec4(r[0] * scale.x, 0.0f),
+		glm::vec4(r[1] * scale.y, 0.0f),
+		glm::vec4(r[2] * scale.z, 0.0f),
+		glm::vec4(position, 1.0f)
+	);
+}
+
+} //namespace
+
+uint32_t FlatScene::Slots::allocate(uint32_t at) {
+	uint32_t slot;
+	if (!free.empty()) {
+		slot = free.back();
+		free.pop_back();
+	} else {
+		slot = uint32_t(index.size());
+		index.emplace_back(-1U);
+		generation.emplace_back(0);
+	}
+	index[slot] = at;
+	return slot;
+}
+
+void FlatScene::Slots::release(uint32_t slot) {
+	assert(slot < index.size() && index[slot] != -1U);
+	index[slot] = -1U;
+	generation[slot] += 1;
+	free.emplace_back(slot);
+}
+
+//---------------------------
+
+FlatScene::TransformHandle FlatScene::new_transform(TransformHandle parent) {
+	//(appending keeps the order topological, since the parent is already somewhere before)
+	uint32_t at = transforms.size();
+	transforms.parent.emplace_back(parent.slot == -1U ? -1U : index(parent));
+	transforms.position.emplace_back(0.0f, 0.0f, 0.0f);
+	transforms.rotation.emplace_back(0.0f, 0.0f, 0.0f, 1.0f); //(same default as Scene::Transform)
+	transforms.scale.emplace_back(1.0f, 1.0f, 1.0f);
+	transforms.local_to_world.emplace_back(1.0f);
+	transforms.dirty.emplace_back(1);
+
+	TransformHandle handle;
+	handle.slot = transform_slots.allocate(at);
+	handle.generation = transform_slots.generation[handle.slot];
+	transforms.slot.emplace_back(handle.slot);
+	return handle;
+}
+
+void FlatScene::delete_transform(TransformHandle transform) {
+	uint32_t at = index(transform);
+	//(left in place until the next update_world compacts it away; its children get detached then)
+	transforms.slot[at] = -1U;
+	transform_slots.release(transform.slot);
+	needs_reorder = true;
+}
+
+bool FlatScene::valid(TransformHandle transform) const {
+	return transform_slots.lookup(transform.slot, transform.generation) != -1U;
+}
+
+uint32_t FlatScene::index(TransformHandle transform) const {
+	uint32_t at = transform_slots.lookup(transform.slot, transform.generation);
+	assert(at != -1U && "Transform handle must name a live transform.");
+	return at;
+}
+
+void FlatScene::set_parent(TransformHandle transform, TransformHandle parent) {
+	uint32_t at = index(transform);
+	uint32_t new_parent = (parent.slot == -1U ? -1U : index(parent));
+	//no cycles (a deleted transform's children are already roots, even if not yet detached):
+	for (uint32_t p = new_parent; p != -1U && transforms.slot[p] != -1U; p = transforms.parent[p]) {
+		assert(p != at && "Can't parent a transform to itself or one of its descendants.");
+	}
+	transforms.parent[at] = new_parent;
+	transforms.dirty[at] = 1;
+	if (new_parent != -1U && new_parent > at) needs_reorder = true;
+}
+
+void FlatScene::set_position(TransformHandle transform, glm::vec3 const &position) {
+	uint32_t at = index(transform);
+	transforms.position[at] = position;
+	transforms.dirty[at] = 1;
+}
+
+void FlatScene::set_rotation(TransformHandle transform, glm::quat const &rotation) {
+	uint32_t at = index(transform);
+	transforms.rotation[at] = rotation;
+	transforms.dirty[at] = 1;
+}
+
+void FlatScene::set_scale(TransformHandle transform, glm::vec3 const &scale) {
+	uint32_t at = index(transform);
+	transforms.scale[at] = scale;
+	transforms.dirty[at] = 1;
+}
+
+void FlatScene::update_world() {
+	if (needs_reorder) reorder();
+
+	Transforms &t = transforms;
+	uint32_t count = t.size();
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t p = t.parent[i];
+		//(parents come first, so their flags and matrices are already settled)
+		if (p != -1U && t.dirty[p]) t.dirty[i] = 1;
+		if (!t.dirty[i]) continue;
+		glm::mat4 local_to_parent = make_local_to_parent(t.position[i], t.rotation[i], t.scale[i]);
+		t.local_to_world[i] = (p == -1U ? local_to_parent : t.local_to_world[p] * local_to_parent);
+	}
+	std::fill(t.dirty.begin(), t.dirty.end(), uint8_t(0));
+}
+
+glm::mat4 const &FlatScene::local_to_world(TransformHandle transform) const {
+	return transforms.local_to_world[index(transform)];
+}
+
+void FlatScene::reorder() {
+	Transforms &t = transforms;
+	uint32_t count = t.size();
+
+	//depth of every live transform (detaching children of deleted transforms along the way):
+	std::vector< uint32_t > depth(count, -1U);
+	std::vector< uint32_t > chain;
+	uint32_t max_depth = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (t.slot[i] == -1U) continue;
+		uint32_t at = i;
+		while (at != -1U && depth[at] == -1U) {
+			chain.emplace_back(at);
+			uint32_t p = t.parent[at];
+			if (p != -1U && t.slot[p] == -1U) {
+				t.parent[at] = -1U;
+				t.dirty[at] = 1;
+				p = -1U;
+			}
+			at = p;
+		}
+		uint32_t d = (at == -1U ? 0 : depth[at] + 1);
+		while (!chain.empty()) {
+			depth[chain.back()] = d;
+			max_depth = std::max(max_depth, d);
+			d += 1;
+			chain.pop_back();
+		}
+	}
+
+	//counting sort by depth (stable, so already-ordered siblings stay together):
+	std::vector< uint32_t > first(max_depth + 2, 0);
+	for (uint32_t i = 0; i < count; ++i) {
+		if (depth[i] != -1U) first[depth[i] + 1] += 1;
+	}
+	for (uint32_t d = 1; d < first.size(); ++d) {
+		first[d] += first[d-1];
+	}
+	std::vector< uint32_t > order(first.back()); //new index -> old index
+	std::vector< uint32_t > new_index(count, -1U); //old index -> new index
+	for (uint32_t i = 0; i < count; ++i) {
+		if (depth[i] == -1U) continue;
+		uint32_t to = first[depth[i]]++;
+		order[to] = i;
+		new_index[i] = to;
+	}
+
+	permute(t.parent, order);
+	permute(t.position, order);
+	permute(t.rotation, order);
+	permute(t.scale, order);
+	permute(t.local_to_world, order);
+	permute(t.dirty, order);
+	permute(t.slot, order);
+
+	for (uint32_t i = 0; i < t.size(); ++i) {
+		if (t.parent[i] != -1U) t.parent[i] = new_index[t.parent[i]];
+		assert(t.parent[i] == -1U || t.parent[i] < i);
+		transform_slots.index[t.slot[i]] = i;
+	}
+
+	needs_reorder = false;
+}
+
+//---------------------------
+
+FlatScene::ObjectHandle FlatScene::new_object(TransformHandle transform) {
+	assert(valid(transform) && "FlatScene::Object must be attached to a transform.");
+	uint32_t at = uint32_t(objects.size());
+	objects.emplace_back();
+	objects.back().transform = transform;
+
+	ObjectHandle handle;
+	handle.slot = object_slots.allocate(at);
+	handle.generation = object_slots.generation[handle.slot];
+	object_slot.emplace_back(handle.slot);
+	return handle;
+}
+
+void FlatScene::delete_object(ObjectHandle object) {
+	uint32_t at = object_slots.lookup(object.slot, object.generation);
+	assert(at != -1U && "Object handle must name a live object.");
+	object_slots.release(object.slot);
+
+	uint32_t last = uint32_t(objects.size()) - 1;
+	if (at != last) {
+		objects[at] = std::move(objects[last]);
+		object_slot[at] = object_slot[last];
+		object_slots.index[object_slot[at]] = at;
+	}
+	objects.pop_back();
+	object_slot.pop_back();
+}
+
+bool FlatScene::valid(ObjectHandle object) const {
+	return object_slots.lookup(object.slot, object.generation) != -1U;
+}
+
+FlatScene::Object &FlatScene::object(ObjectHandle object) {
+	uint32_t at = object_slots.lookup(object.slot, object.generation);
+	assert(at != -1U && "Object handle must name a live object.");
+	return objects[at];
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "GL.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+//"FlatScene" is a structure-of-arrays version of Scene's transforms and objects, for
+// scenes with tens of thousands of them:
+// - each transform field lives in its own array, and the arrays are kept in topological
+//   order (parents before children), so update_world() is one linear sweep;
+// - objects live in one dense array, so drawing them walks memory in order;
+// - transforms and objects are named by handles (slot + generation) instead of pointers,
+//   since the arrays get reordered and compacted; a handle to something that has been
+//   deleted just stops being valid.
+//
+//Scene owns one of these ('Scene::flat') and draws its objects along with its own.
+
+//handles (default-constructed handles name nothing):
+struct FlatTransformHandle {
+	uint32_t slot = -1U;
+	uint32_t generation = 0;
+};
+struct FlatObjectHandle {
+	uint32_t slot = -1U;
+	uint32_t generation = 0;
+};
+
+struct FlatScene {
+	typedef FlatTransformHandle TransformHandle;
+	typedef FlatObjectHandle ObjectHandle;
+
+	//maps handle slots to where things currently are in their arrays:
+	struct Slots {
+		std::vector< uint32_t > index; //slot -> array index (-1U if free)
+		std::vector< uint32_t > generation; //bumped whenever the slot is freed
+		std::vector< uint32_t > free; //free slots, reused first
+
+		uint32_t allocate(uint32_t at);
+		void release(uint32_t slot);
+		//array index for a handle, or -1U if it doesn't name anything:
+		uint32_t lookup(uint32_t slot, uint32_t generation_) const {
+			if (slot >= index.size() || generation[slot] != generation_) return -1U;
+			return index[slot];
+		}
+	};
+
+	//------ transforms ------
+
+	//parallel arrays, all indexed by transform index (which changes when the arrays are reordered -- hold on to handles instead):
+	struct Transforms {
+		std::vector< uint32_t > parent; //index of parent (always less than own index), or -1U
+		std::vector< glm::vec3 > position;
+		std::vector< glm::quat > rotation;
+		std::vector< glm::vec3 > scale;
+		std::vector< glm::mat4 > local_to_world; //as of the last update_world()
+		std::vector< uint8_t > dirty; //position/rotation/scale/parent changed since the last update_world()
+		std::vector< uint32_t > slot; //handle slot, or -1U for a deleted transform that hasn't been compacted away yet
+		uint32_t size() const { return uint32_t(parent.size()); }
+	} transforms;
+	Slots transform_slots;
+
+	//Create a transform (under 'parent', if given):
+	TransformHandle new_transform(TransformHandle parent = TransformHandle());
+	//Delete a transform; its children become roots. (NOTE: it is an error to delete a transform with attached objects)
+	void delete_transform(TransformHandle transform);
+
+	bool valid(TransformHandle transform) const;
+	//current array index (it is an error to pass an invalid handle here or to any function below):
+	uint32_t index(TransformHandle transform) const;
+
+	void set_parent(TransformHandle transform, TransformHandle parent = TransformHandle());
+	void set_position(TransformHandle transform, glm::vec3 const &position);
+	void set_rotation(TransformHandle transform, glm::quat const &rotation);
+	void set_scale(TransformHandle transform, glm::vec3 const &scale);
+
+	//Bring every local_to_world up to date: one pass in array order that only recomputes dirty
+	// transforms and the ones under them. If deletes or set_parent have broken the topological
+	// order, the arrays are compacted and re-sorted (by depth) first.
+	void update_world();
+	glm::mat4 const &local_to_world(TransformHandle transform) const;
+
+	//------ objects ------
+
+	//same information as Scene::Object:
+	struct Object {
+		TransformHandle transform;
+
+		//program info (programs with an 'Object' uniform block get these matrices from that instead):
+		GLuint program = 0;
+		GLuint program_mvp_mat4 = -1U; //uniform index for object-to-clip matrix (mat4)
+		GLuint program_mv_mat4x3 = -1U; //uniform index for model-to-lighting-space matrix (mat4x3)
+		GLuint program_itmv_mat3 = -1U; //uniform index for normal-to-lighting-space matrix (mat3)
+
+		//material info:
+		std::function< void() > set_uniforms; //will be called before rendering object, use to set material parameters (e.g. glossiness)
+		uint32_t material = 0; //objects with the same (nonzero) material and program promise identical set_uniforms; it is called once per run of them
+
+		//attribute info:
+		GLuint vao = 0;
+		GLuint start = 0;
+		GLuint count = 0;
+
+		//bounding box in local space (e.g. from MeshBuffer::Mesh) for view-frustum culling;
+		// objects without one are always drawn:
+		bool has_bounds = false;
+		glm::vec3 bounds_min = glm::vec3(0.0f);
+		glm::vec3 bounds_max = glm::vec3(0.0f);
+	};
+	std::vector< Object > objects; //dense, in no particular order
+	std::vector< uint32_t > object_slot; //object index -> handle slot
+	Slots object_slots;
+
+	//Create a new object attached to a transform:
+	ObjectHandle new_object(TransformHandle transform);
+	//Delete an object (the last object moves into its place):
+	void delete_object(ObjectHandle object);
+
+	bool valid(ObjectHandle object) const;
+	Object &object(ObjectHandle object);
+
+	//set when the transform arrays need compacting or re-sorting before the next sweep:
+	bool needs_reorder = false;
+	//(helper for update_world)
+	void reorder();
+};
@@ -0,0 +1,123 @@
+#include "Frustum.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+const uint32_t BoxBVH::LeafSize;
+
+Frustum::Frustum(glm::mat4 const &world_to_clip) {
+	//(rows of the matrix; a point is in view when -w <= x,y,z <= w in clip space)
+	glm::mat4 const &m = world_to_clip;
+	glm::vec4 row[4];
+	for (int r = 0; r < 4; ++r) {
+		row[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+	}
+	planes[0] = row[3] + row[0]; //left
+	planes[1] = row[3] - row[0]; //right
+	planes[2] = row[3] + row[1]; //bottom
+	planes[3] = row[3] - row[1]; //top
+	planes[4] = row[3] + row[2]; //near
+}
+
+FrustumTest Frustum::test(glm::vec3 const &min, glm::vec3 const &max) const {
+	FrustumTest result = FrustumInside;
+	for (glm::vec4 const &plane : planes) {
+		//corners of the box farthest along / against the plane's normal:
+		glm::vec3 outer = glm::vec3(plane.x > 0.0f ? max.x : min.x, plane.y > 0.0f ? max.y : min.y, plane.z > 0.0f ? max.z : min.z);
+		glm::vec3 inner = glm::vec3(plane.x > 0.0f ? min.x : max.x, plane.y > 0.0f ? min.y : max.y, plane.z > 0.0f ? min.z : max.z);
+		if (glm::dot(glm::vec3(plane), outer) + plane.w < 0.0f) return FrustumOutside;
+		if (glm::dot(glm::vec3(plane), inner) + plane.w < 0.0f) result = FrustumIntersects;
+	}
+	return result;
+}
+
+void transform_box(glm::mat4 const &local_to_world, glm::vec3 const &min, glm::vec3 const &max, glm::vec3 *world_min, glm::vec3 *world_max) {
+	assert(world_min && world_max);
+	//transform the center, and take the extent along each world axis from the (absolute) rotation/scale:
+	glm::vec3 center = 0.5f * (min + max);
+	glm::vec3 extent = 0.5f * (max - min);
+	glm::vec3 world_center = glm::vec3(local_to_world * glm::vec4(center, 1.0f));
+	glm::vec3 world_extent = glm::vec3(0.0f);
+	for (int c = 0; c < 3; ++c) {
+		world_extent += glm::abs(glm::vec3(local_to_world[c])) * extent[c];
+	}
+	*world_min = world_center - world_extent;
+	*world_max = world_center + world_extent;
+}
+
+//---------------------------
+
+void BoxBVH::build(glm::vec3 const *mins, glm::vec3 const *maxs, uint32_t count) {
+	nodes.clear();
+	order.resize(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		order[i] = i;
+	}
+	if (count == 0) return;
+
+	//split each node at the median box center along its longest axis, until leaves are small:
+	nodes.emplace_back();
+	nodes[0].begin = 0;
+	nodes[0].end = count;
+	std::vector< uint32_t > todo(1, 0);
+	while (!todo.empty()) {
+		uint32_t n = todo.back();
+		todo.pop_back();
+		uint32_t begin = nodes[n].begin;
+		uint32_t end = nodes[n].end;
+
+		glm::vec3 min = mins[order[begin]], max = maxs[order[begin]];
+		glm::vec3 center_min = 0.5f * (min + max), center_max = center_min;
+		for (uint32_t i = begin + 1; i < end; ++i) {
+			min = glm::min(min, mins[order[i]]);
+			max = glm::max(max, maxs[order[i]]);
+			glm::vec3 center = 0.5f * (mins[order[i]] + maxs[order[i]]);
+			center_min = glm::min(center_min, center);
+			center_max = glm::max(center_max, center);
+		}
+		nodes[n].min = min;
+		nodes[n].max = max;
+		if (end - begin <= LeafSize) continue;
+
+		glm::vec3 spread = center_max - center_min;
+		int axis = (spread.x >= spread.y && spread.x >= spread.z ? 0 : (spread.y >= spread.z ? 1 : 2));
+		uint32_t mid = begin + (end - begin) / 2;
+		std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](uint32_t a, uint32_t b) {
+			return mins[a][axis] + maxs[a][axis] < mins[b][axis] + maxs[b][axis];
+		});
+
+		uint32_t child = uint32_t(nodes.size());
+		nodes[n].child = child;
+		nodes.emplace_back();
+		nodes.emplace_back();
+		nodes[child].begin = begin;
+		nodes[child].end = mid;
+		nodes[child+1].begin = mid;
+		nodes[child+1].end = end;
+		todo.emplace_back(child);
+		todo.emplace_back(child+1);
+	}
+}
+
+void BoxBVH::query(Frustum const &frustum, glm::vec3 const *mins, glm::vec3 const *maxs, std::vector< uint32_t > *visible) const {
+	assert(visible);
+	if (nodes.empty()) return;
+	std::vector< uint32_t > todo(1, 0);
+	while (!todo.empty()) {
+		Node const &node = nodes[todo.back()];
+		todo.pop_back();
+		FrustumTest test = frustum.test(node.min, node.max);
+		if (test == FrustumOutside) continue;
+		if (test == FrustumInside) {
+			visible->insert(visible->end(), order.begin() + node.begin, order.begin() + node.end);
+		} else if (node.child == 0) {
+			for (uint32_t i = node.begin; i < node.end; ++i) {
+				if (frustum.visible(mins[order[i]], maxs[order[i]])) visible->emplace_back(order[i]);
+			}
+		} else {
+			todo.emplace_back(node.child);
+			todo.emplace_back(node.child + 1);
+		}
+	}
+}
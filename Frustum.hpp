@@ -0,0 +1,51 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+//"Frustum" is the part of the world a camera can see, as planes taken from a world-to-clip
+// matrix. A point p is inside when dot(plane, vec4(p, 1)) >= 0 for every plane.
+//
+//There is no far plane: Scene cameras use infinite perspective projections.
+
+enum FrustumTest {
+	FrustumOutside, //entirely outside (don't draw)
+	FrustumIntersects, //partly inside, or maybe (the test is conservative)
+	FrustumInside, //entirely inside
+};
+
+struct Frustum {
+	Frustum(glm::mat4 const &world_to_clip);
+
+	glm::vec4 planes[5]; //left, right, bottom, top, near (normals point inward)
+
+	//test a world-space axis-aligned box:
+	FrustumTest test(glm::vec3 const &min, glm::vec3 const &max) const;
+	bool visible(glm::vec3 const &min, glm::vec3 const &max) const { return test(min, max) != FrustumOutside; }
+};
+
+//world-space box around a transformed local-space box:
+void transform_box(glm::mat4 const &local_to_world, glm::vec3 const &min, glm::vec3 const &max, glm::vec3 *world_min, glm::vec3 *world_max);
+
+//"BoxBVH" is a bounding volume hierarchy over a list of boxes, for culling big sets of boxes
+// a subtree at a time: whole subtrees outside the frustum are skipped, and whole subtrees
+// inside it are accepted without testing their boxes.
+struct BoxBVH {
+	static const uint32_t LeafSize = 4; //(at most this many boxes per leaf)
+
+	struct Node {
+		glm::vec3 min, max; //bounds of everything below
+		uint32_t begin, end; //range of 'order' below this node
+		uint32_t child = 0; //index of first child (second child follows it); 0 for leaves
+	};
+	std::vector< Node > nodes; //nodes[0] is the root
+	std::vector< uint32_t > order; //box indices, arranged so every node's boxes are contiguous
+
+	//(re)build over 'count' boxes:
+	void build(glm::vec3 const *mins, glm::vec3 const *maxs, uint32_t count);
+	//append indices of boxes not entirely outside 'frustum' to 'visible' (in no particular order);
+	// 'mins'/'maxs' must be the boxes the tree was built from:
+	void query(Frustum const &frustum, glm::vec3 const *mins, glm::vec3 const *maxs, std::vector< uint32_t > *visible) const;
+};
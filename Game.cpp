@@ -1,6 +1,7 @@
 #include "Game.hpp"
+#include "Log.hpp"
 
-#include <iostream>
+#include <chrono>
 
 using namespace glm;
 
@@ -8,6 +9,13 @@ using namespace glm;
 const float Game::MAX_X = 10.f;
 const float Game::MAX_Y = 10.f;
 
+Game::~Game() {
+	//(runs before 'grid' is destroyed, which matters because ~Snake un-indexes itself from it)
+	for(Snake *snake : snakes) {
+		delete snake;
+	}
+}
+
 void Game::new_game(int players) {
 	for(Snake *snake : snakes) {
 		delete snake;
@@ -17,11 +25,14 @@ void Game::new_game(int players) {
 
 	for(int i=0; i<players; i++) {
 		snakes.push_back(new Snake(vec2(i * 2.f, 0.f), 2.f, Snake::Direction::UP));
+		snakes.back()->set_grid(&grid);
 	}
 }
 
 bool Game::update(float time, bool server) {
-	
+	typedef std::chrono::steady_clock Clock;
+	collision_ns = 0;
+
 	bool ret = false;
 	for (Snake *snake : snakes) {
 		if(snake->dead) {
@@ -36,23 +47,16 @@ bool Game::update(float time, bool server) {
 		}
 
 		if (server) {
-			if (snake->collision_with_self()) {
-				snake->dead = true;
-				//std::cout << "COLLISION" << std::endl;
-				continue;
+			Clock::time_point before = Clock::now();
+			bool hit = snake->collision_with_self()
+				|| abs(snake->head->front.x) >= MAX_X || abs(snake->head->front.y) >= MAX_Y;
+			for (Snake *other : snakes) {
+				if (hit) break;
+				hit = (other != snake && !other->dead && snake->collision_with_other(other));
 			}
-
-			if (abs(snake->head->front.x) >= MAX_X || abs(snake->head->front.y) >= MAX_Y) {
+			collision_ns += uint64_t(std::chrono::duration_cast< std::chrono::nanoseconds >(Clock::now() - before).count());
+			if (hit) {
 				snake->dead = true;
-				continue;
-			}
-
-			for (Snake *other : snakes) {
-				if (other != snake && !other->dead && snake->collision_with_other(other)) {
-					snake->dead = true;
-					//std::cout << "COLLISION2" << std::endl;
-					break;
-				}
 			}
 		}
 	}
@@ -60,50 +64,91 @@ bool Game::update(float time, bool server) {
 	return ret;
 }
 
-void Game::send_sync(std::list< Connection > &connections) {
-	// Total size is size of all snakes + signal byte + length param
-	int total_size = 1 + sizeof(int);
+void Game::send_sync(std::vector< Connection * > const &connections, uint32_t seq) {
+	//serialize once; every connection queues a reference to the same buffer:
+	std::shared_ptr< std::vector< char > > buf = std::make_shared< std::vector< char > >();
+	write_sync(buf.get(), seq);
+
+	SharedBuffer shared = buf;
+	for (Connection *conn : connections) {
+		if (conn) conn->send_shared(shared);
+	}
+}
+
+void Game::write_sync(std::vector< char > *out, uint32_t seq) {
+	assert(out);
+
+	int total_size = sizeof(uint32_t);
 	for(Snake * snake : snakes) {
 		total_size += snake->serial_length();
 	}
 
-	char * buf = (char *)malloc(total_size);
+	size_t begin = begin_message(out, MessageSync);
+	size_t offset = out->size();
+	out->resize(offset + total_size);
+	char * buf = out->data();
 
-	buf[0] = 'y';
-	memcpy(buf + 1, &total_size, sizeof(int));
-	int offset = 1 + sizeof(int);
+	memcpy(buf + offset, &seq, sizeof(uint32_t));
+	offset += sizeof(uint32_t);
 
 	for(Snake * snake : snakes) {
 		offset += snake->serialize(buf + offset);
 	}
 
-	for (Connection &conn : connections) {
-		conn.send_raw(buf, total_size);
+	assert(offset == out->size());
+	end_message(out, begin);
+}
+
+void Game::write_delta(std::vector< char > *out, uint32_t seq, uint32_t base, std::vector< int > const &base_heads) {
+	assert(out);
+	assert(base_heads.size() == snakes.size());
+
+	int total_size = 2 * sizeof(uint32_t);
+	for(size_t i = 0; i < snakes.size(); ++i) {
+		total_size += snakes[i]->delta_length(base_heads[i]);
 	}
 
-	assert(offset == total_size);
-	free(buf);
-}
+	size_t begin = begin_message(out, MessageDelta);
+	size_t offset = out->size();
+	out->resize(offset + total_size);
+	char * buf = out->data();
 
-void Game::recv_sync(Connection *conn) {
-	assert(conn->recv_buffer[0] == 'y');
-	if (conn->recv_buffer.size() < 5) {
-		return;
+	memcpy(buf + offset, &seq, sizeof(uint32_t));
+	offset += sizeof(uint32_t);
+	memcpy(buf + offset, &base, sizeof(uint32_t));
+	offset += sizeof(uint32_t);
+
+	for(size_t i = 0; i < snakes.size(); ++i) {
+		offset += snakes[i]->serialize_delta(base_heads[i], buf + offset);
 	}
 
-	int size;
-	memcpy(&size, conn->recv_buffer.data() + 1, sizeof(int));
-	if (conn->recv_buffer.size() >= size) {
-		char *data = (char *)malloc(size);
-		memcpy(data, conn->recv_buffer.data(), size);
-		conn->recv_buffer.erase(conn->recv_buffer.begin(), conn->recv_buffer.begin() + size);
+	assert(offset == out->size());
+	end_message(out, begin);
+}
+
+uint32_t Game::recv_sync(MessageView const &msg) {
+	assert(msg.type == MessageSync || msg.type == MessageDelta);
+
+	uint32_t seq;
+	memcpy(&seq, msg.data, sizeof(uint32_t));
+	uint32_t offset = (msg.type == MessageSync ? 1 : 2) * sizeof(uint32_t);
 
-		int offset = 1 + sizeof(int);
-		for(Snake * snake : snakes) {
-			offset += snake->deserialize(data + offset);
+	for(Snake * snake : snakes) {
+		//each snake's data starts with its own size; don't trust it past the end of the message:
+		int size;
+		if (offset + sizeof(int) > msg.size) break;
+		memcpy(&size, msg.data + offset, sizeof(int));
+		if (size < int(sizeof(int)) || offset + size > msg.size) break;
+
+		if (msg.type == MessageSync) {
+			offset += snake->deserialize(msg.data + offset);
+		} else {
+			offset += snake->deserialize_delta(msg.data + offset);
 		}
-		
-		assert(offset == size);
-		free(data);
 	}
+
+	if (offset != msg.size) {
+		log_warning("Malformed sync message.");
+	}
+	return seq;
 }
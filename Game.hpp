@@ -2,19 +2,31 @@
 
 #include <glm/glm.hpp>
 #include <vector>
+#include <cstdint>
 
 #include "Snake.hpp"
+#include "SpatialGrid.hpp"
 #include "Connection.hpp"
+#include "Protocol.hpp"
 
 struct Game {
+	Game() = default;
+	~Game(); //deletes 'snakes'
+	//(owns its snakes, so no copies):
+	Game(Game const &) = delete;
+	Game &operator=(Game const &) = delete;
 
 	// Game logic functions
 	void new_game(int players);
 	bool update(float time, bool server);
 
 	// Network functions
-	void send_sync(std::list< Connection > &connections);
-	void recv_sync(Connection *conn);
+	void send_sync(std::vector< Connection * > const &connections, uint32_t seq = 0); //(null entries are skipped)
+	void write_sync(std::vector< char > *out, uint32_t seq = 0); //append the same MessageSync frame send_sync sends
+	//append a MessageDelta frame against snapshot 'base', given each snake's head id at that snapshot:
+	void write_delta(std::vector< char > *out, uint32_t seq, uint32_t base, std::vector< int > const &base_heads);
+	//apply a MessageSync or MessageDelta; returns the snapshot's seq (to acknowledge):
+	uint32_t recv_sync(MessageView const &msg);
 
 	static const int BOARD_WIDTH = 9;
 	static const int BOARD_HEIGHT = 9;
@@ -23,5 +35,10 @@ struct Game {
 
 	glm::vec2 apple_pos;
 
+	//(server) nanoseconds spent on collision checks in the last update():
+	uint64_t collision_ns = 0;
+
 	std::vector<Snake *> snakes;
+	//every snake's segments, indexed by position for collision checks:
+	SpatialGrid grid = SpatialGrid(glm::vec2(MAX_X, MAX_Y), 1.f);
 };
@@ -3,6 +3,7 @@
 #include "MenuMode.hpp"
 #include "Load.hpp"
 #include "MeshBuffer.hpp"
+#include "Protocol.hpp"
 #include "Scene.hpp"
 #include "gl_errors.hpp" //helper for dumpping OpenGL error messages
 #include "read_chunk.hpp" //helper for reading a vector of structures from a file
@@ -10,6 +11,8 @@
 #include "compile_program.hpp" //helper to compile opengl shader programs
 #include "draw_text.hpp" //helper to... um.. draw text
 #include "vertex_color_program.hpp"
+#include "snake_program.hpp"
+#include "Log.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -30,6 +33,10 @@ Load< GLuint > meshes_for_vertex_color_program(LoadTagDefault, [](){
 	return new GLuint(meshes->make_vao_for_program(vertex_color_program->program));
 });
 
+Load< GLuint > meshes_for_snake_program(LoadTagDefault, [](){
+	return new GLuint(meshes->make_vao_for_program(snake_program->program));
+});
+
 Scene::Transform *paddle_transform = nullptr;
 Scene::Transform *ball_transform = nullptr;
 
@@ -38,32 +45,32 @@ Scene::Camera *camera = nullptr;
 GameMode::GameMode(Client &client_) : client(client_) {
 	{ // Create apple
 		apple_object = scene.new_object(scene.new_transform());
-		apple_object->program = vertex_color_program->program;
-		apple_object->program_mvp_mat4  = vertex_color_program->object_to_clip_mat4;
-		apple_object->program_mv_mat4x3 = vertex_color_program->object_to_light_mat4x3;
-		apple_object->program_itmv_mat3 = vertex_color_program->normal_to_light_mat3;
+		apple_object->program = vertex_color_program->program; //(matrices come from its 'Object' uniform block)
 
 		MeshBuffer::Mesh const &mesh = meshes->lookup("Apple.1");
 		apple_object->vao = *meshes_for_vertex_color_program;
 		apple_object->start = mesh.start;
 		apple_object->count = mesh.count;
+		apple_object->has_bounds = true;
+		apple_object->bounds_min = mesh.min;
+		apple_object->bounds_max = mesh.max;
 
-		apple_object->transform->rotation = angleAxis(3.1415f/2.f, vec3(1.f,0.f,0.f));
+		apple_object->transform->set_rotation(angleAxis(3.1415f/2.f, vec3(1.f,0.f,0.f)));
 	}
 
 	{ // Create frame
 		Scene::Object *frame = scene.new_object(scene.new_transform());
-		frame->program = vertex_color_program->program;
-		frame->program_mvp_mat4  = vertex_color_program->object_to_clip_mat4;
-		frame->program_mv_mat4x3 = vertex_color_program->object_to_light_mat4x3;
-		frame->program_itmv_mat3 = vertex_color_program->normal_to_light_mat3;
+		frame->program = vertex_color_program->program; //(matrices come from its 'Object' uniform block)
 
 		MeshBuffer::Mesh const &mesh = meshes->lookup("Frame");
 		frame->vao = *meshes_for_vertex_color_program;
 		frame->start = mesh.start;
 		frame->count = mesh.count;
+		frame->has_bounds = true;
+		frame->bounds_min = mesh.min;
+		frame->bounds_max = mesh.max;
 		
-		frame->transform->scale = vec3(Game::MAX_X / 5.f, Game::MAX_Y / 4.f, 1.f);
+		frame->transform->set_scale(vec3(Game::MAX_X / 5.f, Game::MAX_Y / 4.f, 1.f));
 	}
 }
 
@@ -71,13 +78,13 @@ void GameMode::load_objects() {
 	for (int i=0; i<state.snakes.size(); i++) {
 		Snake *snake = state.snakes[i];
 		Scene::SnakeObject * obj = scene.new_snake(snake);
-		obj->program = vertex_color_program->program;
-		obj->program_mvp_mat4  = vertex_color_program->object_to_clip_mat4;
-		obj->program_mv_mat4x3 = vertex_color_program->object_to_light_mat4x3;
-		obj->program_itmv_mat3 = vertex_color_program->normal_to_light_mat3;
+		obj->program = snake_program->program;
+		obj->program_world_to_clip_mat4 = snake_program->world_to_clip_mat4;
+		obj->program_instances_samplerBuffer = snake_program->instances_samplerBuffer;
+		obj->program_instance_base_int = snake_program->instance_base_int;
 
 		MeshBuffer::Mesh const &mesh = meshes->lookup(i == 0 ? "Green_Snake" : "Yellow_Snake");
-		obj->vao = *meshes_for_vertex_color_program;
+		obj->vao = *meshes_for_snake_program;
 		obj->start = mesh.start;
 		obj->count = mesh.count;
 
@@ -85,11 +92,17 @@ void GameMode::load_objects() {
 		MeshBuffer::Mesh const &joint = meshes->lookup("Green_Joint");
 		obj->joint_start = joint.start;
 		obj->joint_count = joint.count;
+
+		obj->has_bounds = true;
+		obj->segment_min = mesh.min;
+		obj->segment_max = mesh.max;
+		obj->joint_min = joint.min;
+		obj->joint_max = joint.max;
 	}
 
 	camera = scene.new_camera(scene.new_transform());
-	camera->transform->position = vec3(0.f, 0.f, 10.f);
-	camera->transform->rotation = angleAxis(0.f,vec3(0.f,0.f,1.f));
+	camera->transform->set_position(vec3(0.f, 0.f, 10.f));
+	camera->transform->set_rotation(angleAxis(0.f,vec3(0.f,0.f,1.f)));
 }
 
 GameMode::~GameMode() {
@@ -103,10 +116,10 @@ bool GameMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 	}
 
 	auto send_turn = [&](char new_dir) {
-		client.connection.send_raw("m", 1);
-		client.connection.send_raw(&new_dir, 1);
-		client.connection.send_raw(&player_snake->head->front.x, sizeof(float));
-		client.connection.send_raw(&player_snake->head->front.y, sizeof(float));
+		MoveMessage move;
+		move.dir = uint8_t(new_dir);
+		move.target = player_snake->head->front;
+		send_message(client.connection, move);
 	};
 
 	if (evt.type == SDL_KEYDOWN) {
@@ -128,6 +141,15 @@ bool GameMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 			return false;
 		}
 
+		if (lockstep.active) {
+			//(shows up right away; the server runs it at the same tick, or we get corrected)
+			if (lockstep.game.can_turn(lockstep.player, newdir)) {
+				lockstep.turn(newdir, client.connection);
+				lockstep.write_to(&state);
+			}
+			return true;
+		}
+
 		int dist = newdir - player_snake->dir;
 		if(abs(dist) == 1 || abs(dist) == 3) {
 			// Check to make sure not doubling back on own body
@@ -148,13 +170,18 @@ bool GameMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 void GameMode::update(float elapsed) {
 
 	if (started) {
-		state.update(elapsed, false);
+		if (lockstep.active) {
+			lockstep.update(elapsed, client.connection);
+			lockstep.write_to(&state); //(every frame, while corrections fade out)
+		} else {
+			state.update(elapsed, false);
+		}
 	}
 
 	
 
 	if (initiated){ 
-		apple_object->transform->position = vec3(state.apple_pos, 0.f);
+		apple_object->transform->set_position(vec3(state.apple_pos, 0.f));
 		
 		// Update camera
 		static float camera_yaw = 0.0f;
@@ -175,80 +202,73 @@ void GameMode::update(float elapsed) {
 			camera_yaw -= CAMERA_SPEED;
 		}
 
-		camera->transform->position = vec3(player_snake->head->front - vec2(-sin(camera_yaw), cos(camera_yaw))*4.f, 8.f);
-		camera->transform->rotation = angleAxis(camera_yaw, vec3(0.f, 0.f, 1.f)) * angleAxis(0.6f, vec3(1.f, 0.f,0.f));
+		camera->transform->set_position(vec3(player_snake->head->front - vec2(-sin(camera_yaw), cos(camera_yaw))*4.f, 8.f));
+		camera->transform->set_rotation(angleAxis(camera_yaw, vec3(0.f, 0.f, 1.f)) * angleAxis(0.6f, vec3(1.f, 0.f,0.f)));
 	}
 
 	client.poll([&](Connection *c, Connection::Event event){
 		if (event == Connection::OnOpen) {
 			//probably won't get this.
 		} else if (event == Connection::OnClose) {
-			std::cerr << "Lost connection to server." << std::endl;
+			log_warning("Lost connection to server.");
 		} else { assert(event == Connection::OnRecv);
-			if (!initiated) {
-				if (c->recv_buffer.size() >= 3 + 2 * sizeof(float)) {
-					assert(c->recv_buffer[0] == 'p');
-					char num_players = c->recv_buffer[1];
-					char my_player = c->recv_buffer[2];
-
-					state.new_game((int)num_players);
-					player_snake = state.snakes[my_player];
+			MessageView msg;
+			ParseResult result;
+			while ((result = next_message(*c, &msg, MessageToClient)) == ParseOk) {
+				PlayersMessage players;
+				MoveMessage move;
+				AppleMessage apple;
+				if (!initiated) {
+					if (!msg.read(&players) || players.slot >= players.count) {
+						log_warning("Expected players message, got '{}'.", message_info(msg.type)->name);
+						continue;
+					}
+					state.new_game((int)players.count);
+					player_snake = state.snakes[players.slot];
+					lockstep.player = players.slot;
 					load_objects();
 
-					memcpy(&state.apple_pos.x, c->recv_buffer.data() + 3, sizeof(float));
-					memcpy(&state.apple_pos.y, c->recv_buffer.data() + 3 + sizeof(float), sizeof(float));
+					state.apple_pos = players.apple;
 
-					c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 3 + 2 * sizeof(float));
-					std::cout << "Initiated" << std::endl;
+					log_info("Initiated");
 					initiated = true;
-					c->send_raw("h", 1); //send a 'hello' to the server, to signal ready for game
-				}
-			} else {
-				while(c->recv_buffer.size() > 0) {
-					if (c->recv_buffer[0] == 's') {
-						c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 1);
-						std::cout << "Started" << std::endl;
-						started = true;
-					} else if (c->recv_buffer[0] == 'm') {
-						if (c->recv_buffer.size() < 3 + sizeof(float) + sizeof(float))
-							return;
-						char moved_player = c->recv_buffer[1];
-						char new_dir = c->recv_buffer[2];
-						vec2 target;
-						memcpy(&target.x, c->recv_buffer.data() + 3, sizeof(float));
-						memcpy(&target.y, c->recv_buffer.data() + 3 + sizeof(float), sizeof(float));
-						c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 3 +
-																	sizeof(float) + sizeof(float));
-
-						state.snakes[moved_player]->revert_and_change(target, new_dir);
-
-
-						std::cout << "Received move from server" << std::endl;
-					} else if (c->recv_buffer[0] == 'y') {
-						state.recv_sync(c);
-					} else if (c->recv_buffer[0] == 'a') {
-						if (c->recv_buffer.size() < 1 + sizeof(float) + sizeof(float))
-							return;
-						memcpy(&state.apple_pos.x, c->recv_buffer.data() + 1, sizeof(float));
-						memcpy(&state.apple_pos.y, c->recv_buffer.data() + 1 + sizeof(float), sizeof(float));
-						c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 1 +
-																	sizeof(float) + sizeof(float));
-
-						std::cout << "Received apple pos: " << state.apple_pos.x << ", " << state.apple_pos.y << std::endl;
-					} else if (c->recv_buffer[0] == 'd') {
-						started = false;
-						lose = true;
-						return;
-					} else if (c->recv_buffer[0] == 'v') {
-						started = false;
-						win = true;
-						return;
-					} else {
-						std::cerr << "Unknown message header: " << c->recv_buffer[0] << std::endl;
-						c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 1);
+					send_message(*c, MessageHello); //send a 'hello' to the server, to signal ready for game
+				} else if (lockstep.handle(*c, msg)) {
+					if (lockstep.active) {
+						lockstep.write_to(&state);
 					}
+				} else if (msg.type == MessageStart) {
+					log_info("Started");
+					started = true;
+				} else if (msg.read(&move) && move.player < state.snakes.size()) {
+					state.snakes[move.player]->revert_and_change(move.target, move.dir);
+
+					log_debug("Received move from server");
+				} else if (msg.type == MessageSync || msg.type == MessageDelta) {
+					//let the server know which snapshot future deltas can be based on:
+					AckMessage ack;
+					ack.seq = state.recv_sync(msg);
+					if (ack.seq != 0) send_message(*c, ack);
+				} else if (msg.read(&apple)) {
+					state.apple_pos = apple.pos;
+
+					log_debug("Received apple pos: {}, {}", state.apple_pos.x, state.apple_pos.y);
+				} else if (msg.type == MessageDeath) {
+					started = false;
+					lose = true;
+					return;
+				} else if (msg.type == MessageVictory) {
+					started = false;
+					win = true;
+					return;
+				} else {
+					log_warning("Unexpected message '{}'.", message_info(msg.type)->name);
 				}
 			}
+			if (result == ParseError) {
+				log_warning("Malformed message from server; disconnecting.");
+				c->close();
+			}
 		}
 	});
 
@@ -290,13 +310,11 @@ void GameMode::draw(glm::uvec2 const &drawable_size) {
 	glBlendEquation(GL_FUNC_ADD);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	//set up light positions:
-	glUseProgram(vertex_color_program->program);
-
-	glUniform3fv(vertex_color_program->sun_color_vec3, 1, glm::value_ptr(glm::vec3(0.81f, 0.81f, 0.76f)));
-	glUniform3fv(vertex_color_program->sun_direction_vec3, 1, glm::value_ptr(glm::normalize(glm::vec3(-0.2f, 0.2f, 1.0f))));
-	glUniform3fv(vertex_color_program->sky_color_vec3, 1, glm::value_ptr(glm::vec3(0.2f, 0.2f, 0.3f)));
-	glUniform3fv(vertex_color_program->sky_direction_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 1.0f, 0.0f)));
+	//set up light positions (shared by all of the scene's programs through the 'Frame' uniform block):
+	scene.frame_uniforms.sun_color = glm::vec4(0.81f, 0.81f, 0.76f, 0.0f);
+	scene.frame_uniforms.sun_direction = glm::vec4(glm::normalize(glm::vec3(-0.2f, 0.2f, 1.0f)), 0.0f);
+	scene.frame_uniforms.sky_color = glm::vec4(0.2f, 0.2f, 0.3f, 0.0f);
+	scene.frame_uniforms.sky_direction = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
 
 	scene.draw(camera);
 
@@ -7,6 +7,7 @@
 #include "GL.hpp"
 #include "Connection.hpp"
 #include "Game.hpp"
+#include "Lockstep.hpp"
 
 #include <SDL.h>
 #include <glm/glm.hpp>
@@ -37,6 +38,7 @@ struct GameMode : public Mode {
 	bool started = false;
 	bool lose = false;
 	bool win = false;
+	LockstepClient lockstep; //(active if the server runs lockstep matches; 'state' is then a copy of lockstep.game)
 
 	void load_objects();
 
@@ -0,0 +1,526 @@
+#include "Lockstep.hpp"
+#include "SpatialGrid.hpp"
+#include "Log.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cmath>
+
+namespace {
+
+//Snake::Direction -> unit step:
+const glm::ivec2 DirSteps[4] = {
+	glm::ivec2(0, 1), glm::ivec2(-1, 0), glm::ivec2(0, -1), glm::ivec2(1, 0)
+};
+
+//same limits as Game::update / GameMode, in fixed point:
+const Fixed MaxX = Fixed(10) * FixedOne; //(Game::MAX_X)
+const Fixed MaxY = Fixed(10) * FixedOne; //(Game::MAX_Y)
+const int64_t HitDistance = FixedOne * 8 / 10; //two snake radii (SNAKE_RADIUS is 0.4)
+const int64_t AppleDistance = FixedOne;
+const Fixed MinTurnLength = FixedOne * 4 / 10;
+const Fixed MinUTurnLength = FixedOne * 9 / 10;
+
+int64_t length2(glm::ivec2 a, glm::ivec2 b) {
+	int64_t dx = int64_t(a.x) - b.x;
+	int64_t dy = int64_t(a.y) - b.y;
+	return dx * dx + dy * dy;
+}
+
+//id, dir, front, length:
+const uint32_t SegmentStateSize = sizeof(int32_t) + 1 + 2 * sizeof(int32_t) + sizeof(Fixed);
+
+} //namespace
+
+const int LockstepGame::TicksPerSecond;
+const Fixed LockstepGame::Speed;
+
+void LockstepGame::new_game(int players, uint32_t seed) {
+	tick = 0;
+	rng = (seed != 0 ? seed : 1);
+	snakes.assign(players, SnakeState());
+	for (int i = 0; i < players; ++i) {
+		//(as Game::new_game)
+		Segment head;
+		head.id = 0;
+		head.dir = 0; //Snake::Direction::UP
+		head.front = glm::ivec2(i * 2 * FixedOne, 0);
+		head.length = 2 * FixedOne;
+		snakes[i].body.emplace_back(head);
+		snakes[i].dir = head.dir;
+	}
+	new_apple();
+}
+
+void LockstepGame::new_apple() {
+	//(xorshift32: same numbers everywhere, and the whole state is one word)
+	auto next = [this]() {
+		rng ^= rng << 13;
+		rng ^= rng >> 17;
+		rng ^= rng << 5;
+		return rng;
+	};
+	int x = int(next() % (2 * Game::BOARD_WIDTH + 1)) - Game::BOARD_WIDTH;
+	int y = int(next() % (2 * Game::BOARD_HEIGHT + 1)) - Game::BOARD_HEIGHT;
+	apple = glm::ivec2(x * FixedOne, y * FixedOne);
+}
+
+bool LockstepGame::can_turn(int player, int dir) const {
+	if (player < 0 || player >= int(snakes.size()) || dir < 0 || dir > 3) return false;
+	SnakeState const &snake = snakes[player];
+	if (snake.dead || (dir - snake.dir) % 2 == 0) return false; //(only quarter turns)
+
+	Segment const &head = snake.body.back();
+	Segment const *prev = (snake.body.size() > 1 ? &snake.body[snake.body.size() - 2] : nullptr);
+	return head.length > MinTurnLength && (prev == nullptr || prev->dir == dir || head.length > MinUTurnLength);
+}
+
+void LockstepGame::turn(int player, int dir) {
+	if (!can_turn(player, dir)) return;
+	SnakeState &snake = snakes[player];
+
+	Segment seg;
+	seg.id = snake.body.back().id + 1;
+	seg.dir = uint8_t(dir);
+	seg.front = snake.body.back().front;
+	seg.length = 0;
+	snake.body.emplace_back(seg);
+	snake.dir = uint8_t(dir);
+}
+
+bool LockstepGame::hits(glm::ivec2 pt, Segment const &seg) const {
+	//segments are axis-aligned, so the closest point is just 'pt' clamped to the segment's box:
+	glm::ivec2 back = seg.front - DirSteps[seg.dir] * seg.length;
+	glm::ivec2 lo = glm::min(seg.front, back);
+	glm::ivec2 hi = glm::max(seg.front, back);
+	glm::ivec2 closest = glm::ivec2(std::min(std::max(pt.x, lo.x), hi.x), std::min(std::max(pt.y, lo.y), hi.y));
+	return length2(pt, closest) <= HitDistance * HitDistance;
+}
+
+void LockstepGame::step() {
+	bool eaten = false;
+	for (size_t i = 0; i < snakes.size(); ++i) {
+		SnakeState &snake = snakes[i];
+		if (snake.dead) continue;
+
+		//move the head, then pull the tail along (as Snake::update):
+		Segment &head = snake.body.back();
+		head.front += DirSteps[head.dir] * Speed;
+		head.length += Speed;
+
+		snake.extra_length -= Speed;
+		if (snake.extra_length < 0) {
+			Fixed dist = -snake.extra_length;
+			snake.extra_length = 0;
+			while (dist > 0) {
+				Segment &tail = snake.body.front();
+				if (tail.length > dist || snake.body.size() == 1) {
+					tail.length = std::max(0, tail.length - dist);
+					break;
+				}
+				dist -= tail.length;
+				snake.body.pop_front();
+			}
+		}
+
+		glm::ivec2 pt = snake.body.back().front;
+		if (!eaten && length2(pt, apple) <= AppleDistance * AppleDistance) {
+			snake.extra_length += FixedOne;
+			eaten = true;
+		}
+
+		//everything but the head and the two segments before it (as Snake::collision_with_self):
+		for (size_t s = 0; s + 3 < snake.body.size(); ++s) {
+			if (hits(pt, snake.body[s])) {
+				snake.dead = true;
+				break;
+			}
+		}
+		if (snake.dead) continue;
+
+		if (std::abs(pt.x) >= MaxX || std::abs(pt.y) >= MaxY) {
+			snake.dead = true;
+			continue;
+		}
+
+		for (size_t o = 0; o < snakes.size() && !snake.dead; ++o) {
+			if (o == i || snakes[o].dead) continue;
+			for (Segment const &seg : snakes[o].body) {
+				if (hits(pt, seg)) {
+					snake.dead = true;
+					break;
+				}
+			}
+		}
+	}
+
+	if (eaten) {
+		new_apple();
+	}
+	++tick;
+}
+
+uint32_t LockstepGame::checksum() const {
+	//FNV-1a over every field:
+	uint32_t hash = 2166136261u;
+	auto mix = [&hash](uint32_t v) {
+		for (int b = 0; b < 4; ++b) {
+			hash ^= (v >> (8 * b)) & 0xff;
+			hash *= 16777619u;
+		}
+	};
+	mix(tick);
+	mix(rng);
+	mix(uint32_t(apple.x));
+	mix(uint32_t(apple.y));
+	for (SnakeState const &snake : snakes) {
+		mix(snake.dir);
+		mix(snake.dead ? 1 : 0);
+		mix(uint32_t(snake.extra_length));
+		mix(uint32_t(snake.body.size()));
+		for (Segment const &seg : snake.body) {
+			mix(uint32_t(seg.id));
+			mix(seg.dir);
+			mix(uint32_t(seg.front.x));
+			mix(uint32_t(seg.front.y));
+			mix(uint32_t(seg.length));
+		}
+	}
+	return hash;
+}
+
+void LockstepGame::write_state(std::vector< char > *out) const {
+	assert(out);
+	size_t begin = begin_message(out, MessageLockState);
+	auto send_data = [out](void const *data, size_t size) {
+		out->insert(out->end(), reinterpret_cast< char const * >(data), reinterpret_cast< char const * >(data) + size);
+	};
+
+	send_data(&tick, sizeof(uint32_t));
+	send_data(&rng, sizeof(uint32_t));
+	send_data(&apple.x, sizeof(int32_t));
+	send_data(&apple.y, sizeof(int32_t));
+	uint8_t count = uint8_t(snakes.size());
+	send_data(&count, 1);
+
+	for (SnakeState const &snake : snakes) {
+		send_data(&snake.dir, 1);
+		uint8_t dead = (snake.dead ? 1 : 0);
+		send_data(&dead, 1);
+		send_data(&snake.extra_length, sizeof(Fixed));
+		uint32_t segments = uint32_t(snake.body.size());
+		send_data(&segments, sizeof(uint32_t));
+		for (Segment const &seg : snake.body) {
+			send_data(&seg.id, sizeof(int32_t));
+			send_data(&seg.dir, 1);
+			send_data(&seg.front.x, sizeof(int32_t));
+			send_data(&seg.front.y, sizeof(int32_t));
+			send_data(&seg.length, sizeof(Fixed));
+		}
+	}
+
+	end_message(out, begin);
+}
+
+bool LockstepGame::read_state(MessageView const &msg) {
+	if (msg.type != MessageLockState) return false;
+
+	uint32_t offset = 0;
+	auto recv_data = [&offset, &msg](void *data, uint32_t size) {
+		if (offset + size > msg.size) return false;
+		memcpy(data, msg.data + offset, size);
+		offset += size;
+		return true;
+	};
+
+	LockstepGame read;
+	uint8_t count;
+	if (!recv_data(&read.tick, sizeof(uint32_t))
+	 || !recv_data(&read.rng, sizeof(uint32_t))
+	 || !recv_data(&read.apple.x, sizeof(int32_t))
+	 || !recv_data(&read.apple.y, sizeof(int32_t))
+	 || !recv_data(&count, 1)) return false;
+
+	read.snakes.resize(count);
+	for (SnakeState &snake : read.snakes) {
+		uint8_t dead;
+		uint32_t segments;
+		if (!recv_data(&snake.dir, 1)
+		 || !recv_data(&dead, 1)
+		 || !recv_data(&snake.extra_length, sizeof(Fixed))
+		 || !recv_data(&segments, sizeof(uint32_t))) return false;
+		snake.dead = (dead != 0);
+		//(check the count against what's left before allocating anything)
+		if (snake.dir > 3 || segments == 0 || segments > (msg.size - offset) / SegmentStateSize) return false;
+		snake.body.resize(segments);
+		for (Segment &seg : snake.body) {
+			if (!recv_data(&seg.id, sizeof(int32_t))
+			 || !recv_data(&seg.dir, 1)
+			 || !recv_data(&seg.front.x, sizeof(int32_t))
+			 || !recv_data(&seg.front.y, sizeof(int32_t))
+			 || !recv_data(&seg.length, sizeof(Fixed))) return false;
+			if (seg.dir > 3) return false;
+		}
+	}
+	if (offset != msg.size) return false;
+
+	*this = std::move(read);
+	return true;
+}
+
+void LockstepGame::write_to(Game *game) const {
+	assert(game);
+	assert(game->snakes.size() == snakes.size());
+
+	game->apple_pos = glm::vec2(to_float(apple.x), to_float(apple.y));
+	for (size_t i = 0; i < snakes.size(); ++i) {
+		SnakeState const &from = snakes[i];
+		Snake *snake = game->snakes[i];
+
+		//(the same id-matching that applying a snapshot does, so unchanged segments are left alone)
+		snake->trim_head(from.body.back().id);
+		for (Segment const &seg : from.body) {
+			Snake::BodySegment *to = snake->segment_for_id(seg.id);
+			to->dir = seg.dir;
+			to->front = glm::vec2(to_float(seg.front.x), to_float(seg.front.y));
+			to->length = to_float(seg.length);
+			if (snake->grid) {
+				snake->grid->update(snake, to);
+			}
+		}
+		snake->trim_tail(from.body.front().id);
+
+		snake->dir = from.dir;
+		snake->extra_length = to_float(from.extra_length);
+		snake->dead = from.dead;
+	}
+}
+
+//---------------------------------
+
+const uint32_t LockstepClient::MaxPrediction;
+const size_t LockstepClient::RollbackTicks;
+constexpr float LockstepClient::SmoothSeconds;
+
+bool LockstepClient::handle(Connection &c, MessageView const &msg) {
+	TurnMessage turn;
+	TickMessage check;
+	if (msg.type == MessageLockState) {
+		if (!game.read_state(msg)) {
+			log_warning("Malformed lockstep state.");
+			return true;
+		}
+		active = true;
+		desynced = false;
+		history.reset(game);
+		rewind_to = UINT32_MAX;
+		//anything from before the state is already part of it (our own later turns still stand):
+		while (!inputs.empty() && inputs.front().turn.tick < game.tick) inputs.pop_front();
+		while (!checks.empty() && checks.front().first < game.tick) checks.pop_front();
+		confirmed = std::max(confirmed, game.tick);
+		corrections.assign(game.snakes.size(), std::vector< Correction >());
+	} else if (msg.read(&turn)) {
+		//(while desynced, turns still count: the state we're waiting for may be from before them)
+		if (!active) return true;
+
+		LockstepGame::Turn t;
+		t.tick = turn.tick;
+		t.player = turn.player;
+		t.dir = turn.dir;
+
+		if (int(t.player) == player) {
+			//our own turn coming back; predictions are sent back in order:
+			auto f = std::find_if(inputs.begin(), inputs.end(), [](Input const &in){ return in.predicted; });
+			if (f != inputs.end()) {
+				if (f->turn.tick == t.tick && f->turn.dir == t.dir) {
+					f->predicted = false;
+					return true;
+				}
+				//the server had already simulated the tick we asked for, so we're behind it;
+				// run that much further ahead from now on:
+				if (t.tick > f->turn.tick) {
+					time += float(t.tick - f->turn.tick) / LockstepGame::TicksPerSecond;
+				}
+				if (f->turn.tick < game.tick) rewind_to = std::min(rewind_to, f->turn.tick);
+				inputs.erase(f);
+			}
+		}
+
+		if (!desynced && t.tick < history.oldest()) {
+			//too far back to redo (only a confused server would send this):
+			desync(c);
+			return true;
+		}
+		add(t, false);
+	} else if (msg.read(&check)) {
+		confirmed = std::max(confirmed, check.confirmed);
+		if (!active || desynced) return true;
+		checks.emplace_back(check.tick, check.checksum);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+void LockstepClient::add(LockstepGame::Turn const &turn, bool predicted) {
+	Input in;
+	in.turn = turn;
+	in.predicted = predicted;
+	//(after any other turns for the same tick, since turns apply in the order the server got them)
+	auto at = std::find_if(inputs.begin(), inputs.end(), [&turn](Input const &other){ return other.turn.tick > turn.tick; });
+	inputs.insert(at, in);
+	if (turn.tick < game.tick) {
+		rewind_to = std::min(rewind_to, turn.tick);
+	}
+}
+
+void LockstepClient::turn(int dir, Connection &c) {
+	if (!active || desynced || player < 0) return;
+
+	LockstepGame::Turn t;
+	t.tick = game.tick;
+	t.player = uint8_t(player);
+	t.dir = uint8_t(dir);
+	add(t, true);
+
+	TurnMessage msg;
+	msg.tick = t.tick;
+	msg.player = t.player;
+	msg.dir = t.dir;
+	send_message(c, msg);
+}
+
+int LockstepClient::update(float elapsed, Connection &c) {
+	if (!active || desynced) return 0;
+
+	if (rewind_to != UINT32_MAX) {
+		resimulate();
+	}
+
+	const float TickSeconds = 1.f / LockstepGame::TicksPerSecond;
+	//(after a stall, catch up quickly, but never bank more than we could predict anyway)
+	time = std::min(time + elapsed, MaxPrediction * TickSeconds);
+
+	int stepped = 0;
+	while (time >= TickSeconds && game.tick < confirmed + MaxPrediction) {
+		time -= TickSeconds;
+		advance();
+		++stepped;
+	}
+
+	//every turn before a checked tick came before the check, so those ticks are final now --
+	// except for our own turns the server hasn't sent back yet (they'll come back scheduled
+	// after the check, and take the prediction with them):
+	auto pending = std::find_if(inputs.begin(), inputs.end(), [](Input const &in){ return in.predicted; });
+	while (!checks.empty() && checks.front().first <= game.tick) {
+		if (pending != inputs.end() && pending->turn.tick < checks.front().first) break;
+		std::pair< uint32_t, uint32_t > check = checks.front();
+		checks.pop_front();
+		//(a check for a tick we no longer have just goes unchecked)
+		if (history.has(check.first) && history.at(check.first).checksum() != check.second) {
+			desync(c);
+			return stepped;
+		}
+	}
+
+	while (!inputs.empty() && inputs.front().turn.tick < history.oldest()) {
+		inputs.pop_front();
+	}
+
+	float fade = std::exp(-elapsed / SmoothSeconds);
+	for (std::vector< Correction > &list : corrections) {
+		for (Correction &correction : list) {
+			correction.front *= fade;
+			correction.length *= fade;
+		}
+		list.erase(std::remove_if(list.begin(), list.end(), [](Correction const &correction){
+			return glm::dot(correction.front, correction.front) < 1e-6f && std::abs(correction.length) < 1e-3f;
+		}), list.end());
+	}
+
+	return stepped;
+}
+
+void LockstepClient::advance() {
+	for (Input const &in : inputs) {
+		if (in.turn.tick > game.tick) break;
+		if (in.turn.tick == game.tick) game.turn(in.turn.player, in.turn.dir);
+	}
+	game.step();
+	history.save(game);
+}
+
+void LockstepClient::resimulate() {
+	uint32_t from = rewind_to;
+	uint32_t to = game.tick;
+	rewind_to = UINT32_MAX;
+	if (from >= to || !history.has(from)) return;
+
+	LockstepGame before = game; //(what we've been drawing, to ease away from)
+
+	history.rewind(from);
+	game = history.at(from);
+	while (game.tick < to) {
+		advance();
+	}
+	rollbacks += 1;
+	rollback_ticks += to - from;
+
+	//each segment starts out drawn where it was (including any correction still fading);
+	// segments that weren't there before grow out from their back end:
+	for (size_t i = 0; i < game.snakes.size(); ++i) {
+		std::deque< LockstepGame::Segment > const &old_body = before.snakes[i].body;
+		std::vector< Correction > const &old_list = corrections[i];
+		std::vector< Correction > list;
+		for (LockstepGame::Segment const &seg : game.snakes[i].body) {
+			glm::vec2 front = glm::vec2(to_float(seg.front.x), to_float(seg.front.y));
+			float length = to_float(seg.length);
+
+			Correction correction;
+			correction.id = seg.id;
+			int32_t index = seg.id - old_body.front().id; //(ids are consecutive)
+			if (index >= 0 && index < int32_t(old_body.size())) {
+				LockstepGame::Segment const &old = old_body[index];
+				correction.front = glm::vec2(to_float(old.front.x), to_float(old.front.y)) - front;
+				correction.length = to_float(old.length) - length;
+				for (Correction const &fading : old_list) {
+					if (fading.id != seg.id) continue;
+					correction.front += fading.front;
+					correction.length += fading.length;
+				}
+			} else {
+				correction.front = -glm::vec2(DirSteps[seg.dir]) * length;
+				correction.length = -length;
+			}
+			if (glm::dot(correction.front, correction.front) >= 1e-6f || std::abs(correction.length) >= 1e-3f) {
+				list.emplace_back(correction);
+			}
+		}
+		corrections[i].swap(list);
+	}
+}
+
+void LockstepClient::write_to(Game *to) const {
+	game.write_to(to);
+	for (size_t i = 0; i < corrections.size() && i < to->snakes.size(); ++i) {
+		Snake *snake = to->snakes[i];
+		for (Correction const &correction : corrections[i]) {
+			//(skip segments that have gone since; looking them up would add them back)
+			if (correction.id < snake->tail->id || correction.id > snake->head->id) continue;
+			Snake::BodySegment *seg = snake->segment_for_id(correction.id);
+			seg->front += correction.front;
+			seg->length = std::max(0.f, seg->length + correction.length);
+		}
+	}
+}
+
+void LockstepClient::desync(Connection &c) {
+	if (desynced) return;
+	log_warning("Lockstep state doesn't match the server's at tick {}; asking for it again.", game.tick);
+	desynced = true;
+	desyncs += 1;
+	DesyncMessage msg;
+	msg.tick = game.tick;
+	send_message(c, msg);
+}
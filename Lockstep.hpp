@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Connection.hpp"
+#include "Protocol.hpp"
+#include "Game.hpp"
+#include "Rollback.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <deque>
+#include <utility>
+#include <cstdint>
+
+//Lockstep mode: instead of streaming snapshots, the server only sends turns (each one
+// scheduled for a tick that it hasn't simulated yet) and every client runs the same
+// simulation. The simulation is all integer math, so every machine gets bit-identical
+// results; the server sends a checksum now and then, and a client that disagrees asks
+// for the full state again.
+//
+//Positions and lengths are 16.16 fixed-point board units:
+typedef int32_t Fixed;
+const int FixedShift = 16;
+const Fixed FixedOne = Fixed(1) << FixedShift;
+inline float to_float(Fixed f) { return float(f) / float(FixedOne); }
+
+//LockstepGame follows the same rules as Game::update(..., true) on the server (and
+// keeps segment ids the same way Snake does, so it can be copied into a Game to draw).
+struct LockstepGame {
+	static const int TicksPerSecond = 60;
+	static const Fixed Speed = 6 * FixedOne / TicksPerSecond; //per tick (Snake::speed is 6 units/s)
+
+	struct Segment {
+		int32_t id = 0;
+		uint8_t dir = 0; //Snake::Direction
+		glm::ivec2 front = glm::ivec2(0);
+		Fixed length = 0;
+	};
+	struct SnakeState {
+		std::deque< Segment > body; //tail first; back() is the head
+		uint8_t dir = 0;
+		Fixed extra_length = 0;
+		bool dead = false;
+	};
+	struct Turn {
+		uint32_t tick = 0; //applied just before stepping from this tick
+		uint8_t player = 0;
+		uint8_t dir = 0;
+	};
+
+	uint32_t tick = 0; //steps taken since the match started
+	uint32_t rng = 1; //xorshift state for apples
+	glm::ivec2 apple = glm::ivec2(0);
+	std::vector< SnakeState > snakes;
+
+	void new_game(int players, uint32_t seed);
+	//same rule GameMode uses for the player's own snake (no turning back onto the body):
+	bool can_turn(int player, int dir) const;
+	void turn(int player, int dir); //(ignored unless can_turn)
+	void step();
+	uint32_t checksum() const;
+
+	//append a MessageLockState frame with the whole state:
+	void write_state(std::vector< char > *out) const;
+	//replace the whole state from a MessageLockState; returns false (changing nothing) if malformed:
+	bool read_state(MessageView const &msg);
+
+	//copy into 'game' (which must have the same number of snakes) for drawing:
+	void write_to(Game *game) const;
+
+	//helpers:
+	void new_apple();
+	bool hits(glm::ivec2 pt, Segment const &seg) const;
+};
+
+//LockstepClient is the client side of lockstep mode. It runs 'game' in real time, ahead
+// of what the server has confirmed, predicting that other snakes keep going straight and
+// applying our own turns right away (asking the server for the same tick). When a turn
+// arrives for a tick we've already simulated, it goes back to that tick and simulates
+// forward again; the difference is eased in when drawing instead of snapping.
+struct LockstepClient {
+	static const uint32_t MaxPrediction = 20; //ticks past 'confirmed' we'll simulate (and so the deepest rollback)
+	static const size_t RollbackTicks = MaxPrediction + 12; //(room for checks that come in a little late)
+	static constexpr float SmoothSeconds = 0.1f; //corrections fade out with this time constant
+
+	LockstepGame game; //our prediction
+	Rollback< LockstepGame > history{RollbackTicks}; //'game' at each recent tick (before that tick's turns)
+	int player = -1; //our snake
+	bool active = false; //got a state from the server (i.e., it is running in lockstep mode)
+	bool desynced = false; //asked for the state again; waiting for it
+
+	struct Input {
+		LockstepGame::Turn turn;
+		bool predicted = false; //our own turn, not sent back by the server yet
+	};
+	std::deque< Input > inputs; //turns from the oldest saved tick on, in tick order
+	uint32_t rewind_to = UINT32_MAX; //earliest tick a newly arrived turn changed (UINT32_MAX: none)
+	uint32_t confirmed = 0; //the server has sent every turn before this tick
+	std::deque< std::pair< uint32_t, uint32_t > > checks; //(tick, checksum) from the server, not checked yet
+	float time = 0.f; //real time not yet simulated
+
+	//offsets (drawn minus simulated) of segments that moved in a rollback, fading out:
+	struct Correction {
+		int32_t id = 0;
+		glm::vec2 front = glm::vec2(0.f);
+		float length = 0.f;
+	};
+	std::vector< std::vector< Correction > > corrections; //per snake
+
+	//stats:
+	uint32_t desyncs = 0;
+	uint32_t rollbacks = 0;
+	uint32_t rollback_ticks = 0; //total ticks simulated again
+
+	//handle a lockstep message (returns false for anything else); may reply on 'c':
+	bool handle(Connection &c, MessageView const &msg);
+	//turn our own snake now, and send the turn to the server:
+	void turn(int dir, Connection &c);
+	//catch up on rollbacks and step as many ticks as 'elapsed' seconds cover; returns ticks stepped:
+	int update(float elapsed, Connection &c);
+	//copy 'game' into 'to' with corrections applied, for drawing:
+	void write_to(Game *to) const;
+
+	//helpers:
+	void add(LockstepGame::Turn const &turn, bool predicted);
+	void advance(); //apply turns for game.tick, step, and save
+	void resimulate(); //go back to rewind_to and step forward to where we were
+	void desync(Connection &c);
+};
@@ -0,0 +1,192 @@
+#include "Log.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+
+namespace {
+
+LogLevel level_from_env() {
+	char const *env = getenv("GAME_LOG");
+	if (!env) return LogInfo;
+	std::string name = env;
+	if (name == "debug") return LogDebug;
+	if (name == "info") return LogInfo;
+	if (name == "warning") return LogWarning;
+	if (name == "error") return LogError;
+	std::cerr << "Ignoring unknown GAME_LOG level '" << name << "' (expected debug, info, warning, or error)." << std::endl;
+	return LogInfo;
+}
+
+uint64_t now_ns() {
+	return uint64_t(std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+//Logger owns the ring (a bounded multi-producer queue: producers claim slots with a
+// compare-exchange on 'tail', each slot's 'sequence' says whether it is free, filled,
+// or being written) and the thread that drains it:
+struct Logger {
+	static const size_t Capacity = 4096; //records (power of two)
+
+	Logger() : ring(Capacity), start(now_ns()) {
+		for (size_t i = 0; i < Capacity; ++i) {
+			ring[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		thread = std::thread(&Logger::drain, this);
+	}
+	~Logger() {
+		quit = true;
+		thread.join();
+	}
+
+	LogRecord *claim() {
+		size_t pos = tail.load(std::memory_order_relaxed);
+		while (true) {
+			LogRecord &record = ring[pos & (Capacity - 1)];
+			size_t seq = record.sequence.load(std::memory_order_acquire);
+			intptr_t diff = intptr_t(seq) - intptr_t(pos);
+			if (diff == 0) {
+				if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return &record;
+			} else if (diff < 0) {
+				//(the drain thread hasn't freed this slot yet)
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return nullptr;
+			} else {
+				pos = tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	//(a claimed record's sequence number is still its position in the ring)
+	void commit(LogRecord *record) {
+		size_t pos = record->sequence.load(std::memory_order_relaxed);
+		record->sequence.store(pos + 1, std::memory_order_release);
+	}
+
+	//drain thread: format whatever is ready, write it in one go, then nap briefly:
+	void drain() {
+		std::ostringstream out, err;
+		while (true) {
+			bool stopping = quit.load();
+			size_t count = 0;
+			while (true) {
+				LogRecord &record = ring[head & (Capacity - 1)];
+				if (record.sequence.load(std::memory_order_acquire) != head + 1) break;
+				format(record, (record.level >= LogWarning ? err : out));
+				record.sequence.store(head + Capacity, std::memory_order_release);
+				++head;
+				++count;
+			}
+			written.store(head, std::memory_order_release);
+
+			uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+			if (lost) {
+				err << "[log] dropped " << lost << " message" << (lost == 1 ? "" : "s") << " (ring full).\n";
+			}
+			if (!out.str().empty()) {
+				std::cout << out.str();
+				std::cout.flush();
+				out.str("");
+			}
+			if (!err.str().empty()) {
+				std::cerr << err.str();
+				std::cerr.flush();
+				err.str("");
+			}
+
+			//(checked 'quit' before draining, so nothing logged before ~Logger is lost)
+			if (stopping) break;
+			if (count == 0) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+	}
+
+	void format(LogRecord const &record, std::ostream &to) {
+		char const *levels[] = { "debug", "info", "warning", "error" };
+		double seconds = double(record.time - start) * 1e-9;
+		char stamp[32];
+		snprintf(stamp, sizeof(stamp), "[%9.3f] ", seconds);
+		to << stamp;
+		if (record.level != LogInfo) to << levels[record.level] << ": ";
+
+		size_t at = 0;
+		for (char const *c = record.format; *c; ++c) {
+			if (c[0] != '{' || c[1] != '}') {
+				to << *c;
+				continue;
+			}
+			++c;
+			if (at >= record.used) {
+				to << "{?}"; //(argument didn't fit)
+				continue;
+			}
+			LogArgType type = LogArgType(record.args[at]);
+			char const *value = record.args + at + 1;
+			if (type == LogArgString) {
+				size_t length = uint8_t(record.args[at + 1]);
+				to.write(record.args + at + 2, std::streamsize(length));
+				at += 2 + length;
+			} else if (type == LogArgChar) {
+				to << *value;
+				at += 1 + 1;
+			} else {
+				union { int64_t i; uint64_t u; double d; } v;
+				memcpy(&v, value, 8);
+				if (type == LogArgInt) to << v.i;
+				else if (type == LogArgUInt) to << v.u;
+				else if (type == LogArgDouble) to << v.d;
+				else to << reinterpret_cast< void const * >(uintptr_t(v.u));
+				at += 1 + 8;
+			}
+		}
+		to << '\n';
+	}
+
+	std::vector< LogRecord > ring;
+	uint64_t start;
+
+	char pad0[64];
+	std::atomic< size_t > tail{0}; //next position to claim (producers)
+	std::atomic< uint64_t > dropped{0};
+	char pad1[64];
+	size_t head = 0; //next position to drain (drain thread)
+	std::atomic< size_t > written{0}; //everything before this has been written
+	std::atomic< bool > quit{false};
+
+	std::thread thread;
+};
+
+//(started on first use; drained and joined at exit)
+Logger &logger() {
+	static Logger instance;
+	return instance;
+}
+
+} //namespace
+
+std::atomic< uint8_t > log_level(level_from_env());
+
+LogRecord *log_claim() {
+	LogRecord *record = logger().claim();
+	if (record) record->used = 0;
+	return record;
+}
+
+void log_commit(LogRecord *record, LogLevel level, char const *format) {
+	record->format = format;
+	record->level = level;
+	record->time = now_ns();
+	logger().commit(record);
+}
+
+void log_flush() {
+	Logger &l = logger();
+	size_t target = l.tail.load(std::memory_order_acquire);
+	//(records claimed but not yet committed by other threads would hold this up, but only briefly)
+	while (l.written.load(std::memory_order_acquire) < target) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
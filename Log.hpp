@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <type_traits>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+//Asynchronous logging: log_info("[{}] client connected on {}.", where, socket) copies
+// its arguments (binary, untouched) into a lock-free ring and returns; a background
+// thread formats and writes them. Callers never take a lock, make a system call, or
+// wait for the terminal, so it's safe from the simulation, I/O, and audio threads.
+//
+//Rules:
+// - 'format' must be a string literal (only the pointer is stored); each '{}' is
+//   replaced by the next argument.
+// - arguments can be numbers, enums, chars, strings (copied, and cut short if the
+//   record fills up), and pointers (printed as addresses).
+// - if the ring is full the message is dropped (and the drop is counted and reported),
+//   rather than blocking.
+//
+//Debug and info messages go to stdout, warnings and errors to stderr. Messages below
+// the current level (GAME_LOG=debug|info|warning|error, default info) cost one atomic load.
+
+enum LogLevel : uint8_t {
+	LogDebug = 0,
+	LogInfo = 1,
+	LogWarning = 2,
+	LogError = 3,
+};
+
+extern std::atomic< uint8_t > log_level;
+
+inline bool log_enabled(LogLevel level) {
+	return level >= log_level.load(std::memory_order_relaxed);
+}
+inline void set_log_level(LogLevel level) {
+	log_level.store(level, std::memory_order_relaxed);
+}
+
+//wait until everything logged so far has been written (e.g. before exiting on an error):
+void log_flush();
+
+//---------------------------------
+//internals:
+
+enum LogArgType : uint8_t {
+	LogArgInt,
+	LogArgUInt,
+	LogArgDouble,
+	LogArgChar,
+	LogArgString,
+	LogArgPointer,
+};
+
+//one ring slot; arguments are packed into 'args' as (type, value) pairs:
+struct LogRecord {
+	static const size_t ArgBytes = 224;
+	std::atomic< size_t > sequence{0};
+	char const *format = nullptr;
+	uint64_t time = 0; //steady_clock nanoseconds
+	LogLevel level = LogInfo;
+	uint8_t used = 0; //bytes of 'args' filled
+	char args[ArgBytes];
+};
+
+//writes arguments into a claimed record, stopping (quietly) when it is full:
+struct LogArgs {
+	LogRecord &record;
+	template< typename T >
+	void put(LogArgType type, T const &value) {
+		if (record.used + 1 + sizeof(T) > LogRecord::ArgBytes) return;
+		record.args[record.used] = char(type);
+		memcpy(record.args + record.used + 1, &value, sizeof(T));
+		record.used += uint8_t(1 + sizeof(T));
+	}
+	void put_string(char const *str, size_t length) {
+		if (size_t(record.used) + 2 > LogRecord::ArgBytes) return;
+		length = std::min< size_t >(length, std::min< size_t >(255, LogRecord::ArgBytes - record.used - 2));
+		record.args[record.used] = char(LogArgString);
+		record.args[record.used + 1] = char(uint8_t(length));
+		memcpy(record.args + record.used + 2, str, length);
+		record.used += uint8_t(2 + length);
+	}
+};
+
+template< typename T >
+typename std::enable_if< std::is_integral< T >::value && std::is_signed< T >::value >::type
+log_put(LogArgs &a, T value) { a.put(LogArgInt, int64_t(value)); }
+template< typename T >
+typename std::enable_if< std::is_integral< T >::value && !std::is_signed< T >::value >::type
+log_put(LogArgs &a, T value) { a.put(LogArgUInt, uint64_t(value)); }
+template< typename T >
+typename std::enable_if< std::is_enum< T >::value >::type
+log_put(LogArgs &a, T value) { a.put(LogArgInt, int64_t(value)); }
+template< typename T >
+typename std::enable_if< std::is_floating_point< T >::value >::type
+log_put(LogArgs &a, T value) { a.put(LogArgDouble, double(value)); }
+inline void log_put(LogArgs &a, char value) { a.put(LogArgChar, value); }
+inline void log_put(LogArgs &a, char const *value) { if (value) a.put_string(value, strlen(value)); else a.put_string("(null)", 6); }
+inline void log_put(LogArgs &a, std::string const &value) { a.put_string(value.data(), value.size()); }
+inline void log_put(LogArgs &a, void const *value) { a.put(LogArgPointer, uint64_t(uintptr_t(value))); }
+
+inline void log_put_all(LogArgs &) { }
+template< typename T, typename... Rest >
+void log_put_all(LogArgs &a, T const &first, Rest const &... rest) {
+	log_put(a, first);
+	log_put_all(a, rest...);
+}
+
+//claim a ring slot (nullptr if the ring is full) and publish it once filled in:
+LogRecord *log_claim();
+void log_commit(LogRecord *record, LogLevel level, char const *format);
+
+template< typename... Args >
+void log_message(LogLevel level, char const *format, Args const &... args) {
+	if (!log_enabled(level)) return;
+	LogRecord *record = log_claim();
+	if (!record) return;
+	LogArgs a{*record};
+	log_put_all(a, args...);
+	log_commit(record, level, format);
+}
+
+//---------------------------------
+
+template< typename... Args >
+void log_debug(char const *format, Args const &... args) { log_message(LogDebug, format, args...); }
+template< typename... Args >
+void log_info(char const *format, Args const &... args) { log_message(LogInfo, format, args...); }
+template< typename... Args >
+void log_warning(char const *format, Args const &... args) { log_message(LogWarning, format, args...); }
+template< typename... Args >
+void log_error(char const *format, Args const &... args) { log_message(LogError, format, args...); }
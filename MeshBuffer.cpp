@@ -17,6 +17,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 	std::ifstream file(filename, std::ios::binary);
 
 	GLuint total = 0;
+	std::vector< glm::vec3 > positions; //(kept to compute mesh bounds)
 	//read + upload data chunk:
 	if (filename.size() >= 2 && filename.substr(filename.size()-2) == ".p") {
 		struct Vertex {
@@ -33,6 +34,10 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 		total = GLuint(data.size()); //store total for later checks on index
+		positions.reserve(data.size());
+		for (Vertex const &v : data) {
+			positions.emplace_back(v.Position);
+		}
 
 		//store attrib locations:
 		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -53,6 +58,10 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 		total = GLuint(data.size()); //store total for later checks on index
+		positions.reserve(data.size());
+		for (Vertex const &v : data) {
+			positions.emplace_back(v.Position);
+		}
 
 		//store attrib locations:
 		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -75,6 +84,10 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 		total = GLuint(data.size()); //store total for later checks on index
+		positions.reserve(data.size());
+		for (Vertex const &v : data) {
+			positions.emplace_back(v.Position);
+		}
 
 		//store attrib locations:
 		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -99,6 +112,10 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 		total = GLuint(data.size()); //store total for later checks on index
+		positions.reserve(data.size());
+		for (Vertex const &v : data) {
+			positions.emplace_back(v.Position);
+		}
 
 		//store attrib locations:
 		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -134,6 +151,13 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 			Mesh mesh;
 			mesh.start = entry.vertex_begin;
 			mesh.count = entry.vertex_end - entry.vertex_begin;
+			if (mesh.count > 0) {
+				mesh.min = mesh.max = positions[entry.vertex_begin];
+				for (uint32_t v = entry.vertex_begin + 1; v < entry.vertex_end; ++v) {
+					mesh.min = glm::min(mesh.min, positions[v]);
+					mesh.max = glm::max(mesh.max, positions[v]);
+				}
+			}
 			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
 			if (!inserted) {
 				std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
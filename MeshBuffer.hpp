@@ -1,7 +1,11 @@
 #pragma once
 
 #include "GL.hpp"
+
+#include <glm/glm.hpp>
+
 #include <map>
+#include <string>
 
 //"MeshBuffer" holds a collection of meshes loaded from a file
 // (note that meshes in a single collection will share a vbo/vao)
@@ -38,6 +42,9 @@ struct MeshBuffer {
 	struct Mesh {
 		GLuint start = 0;
 		GLuint count = 0;
+		//bounding box of the mesh's vertices (for culling):
+		glm::vec3 min = glm::vec3(0.0f);
+		glm::vec3 max = glm::vec3(0.0f);
 	};
 	const Mesh &lookup(std::string const &name) const;
 	
@@ -0,0 +1,239 @@
+#include "Metrics.hpp"
+#include "Log.hpp"
+
+#include <sstream>
+#include <chrono>
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//---------------------------------
+
+namespace {
+
+int highest_bit(uint64_t value) {
+	#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return int(index);
+	#else
+	return 63 - __builtin_clzll(value);
+	#endif
+}
+
+} //namespace
+
+const int Histogram::SubBits;
+const size_t Histogram::BucketCount;
+
+Histogram::Histogram(std::string const &name_, std::string const &help_) : name(name_), help(help_) {
+	for (auto &bucket : buckets) {
+		bucket.store(0, std::memory_order_relaxed);
+	}
+}
+
+size_t Histogram::bucket_of(uint64_t value) {
+	//values below 2^(SubBits+1) get their own bucket; above that, each power of two is
+	// split into 2^SubBits buckets by the bits just below the highest one:
+	if (value < (uint64_t(2) << SubBits)) return size_t(value);
+	int shift = highest_bit(value) - SubBits;
+	return (size_t(shift) << SubBits) + size_t(value >> shift);
+}
+
+uint64_t Histogram::bucket_top(size_t bucket) {
+	if (bucket < (size_t(2) << SubBits)) return uint64_t(bucket);
+	int shift = int(bucket >> SubBits) - 1;
+	uint64_t top = uint64_t(bucket) - (uint64_t(shift) << SubBits);
+	return ((top + 1) << shift) - 1; //(wraps to UINT64_MAX for the very last bucket)
+}
+
+void Histogram::record(uint64_t value) {
+	buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(value, std::memory_order_relaxed);
+	uint64_t seen = max.load(std::memory_order_relaxed);
+	while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed)) { }
+}
+
+void Histogram::write(std::ostream &out) const {
+	//(copy the counts first, so quantiles are consistent with each other even while recording continues)
+	std::vector< uint64_t > counts(BucketCount);
+	uint64_t total = 0;
+	for (size_t b = 0; b < BucketCount; ++b) {
+		counts[b] = buckets[b].load(std::memory_order_relaxed);
+		total += counts[b];
+	}
+	uint64_t largest = max.load(std::memory_order_relaxed);
+
+	out << "# HELP " << name << " " << help << "\n";
+	out << "# TYPE " << name << " summary\n";
+	size_t b = 0;
+	uint64_t below = 0; //values in buckets before 'b'
+	for (double q : {0.5, 0.9, 0.99, 0.999}) {
+		//(smallest bucket with at least q of the values at or below it; reported as its top, capped by the max)
+		uint64_t rank = uint64_t(q * double(total));
+		while (b < BucketCount && below + counts[b] <= rank) {
+			below += counts[b];
+			++b;
+		}
+		uint64_t value = (b < BucketCount ? std::min(bucket_top(b), largest) : largest);
+		out << name << "{quantile=\"" << q << "\"} " << (total ? value : 0) << "\n";
+	}
+	out << name << "_sum " << sum.load(std::memory_order_relaxed) << "\n";
+	out << name << "_count " << total << "\n";
+	out << name << "_max " << largest << "\n";
+}
+
+void Counter::write(std::ostream &out) const {
+	out << "# HELP " << name << " " << help << "\n";
+	out << "# TYPE " << name << " " << (gauge ? "gauge" : "counter") << "\n";
+	out << name << " " << int64_t(value.load(std::memory_order_relaxed)) << "\n";
+}
+
+//---------------------------------
+
+Metrics::Metrics() {
+	histograms = {
+		&room_tick, &batch, &step_late, &collision, &serialize, &snapshot_bytes,
+		&inbox, &outbox, &connection_in, &connection_out,
+	};
+	counters = {
+		&connections_total, &rooms, &matches_started, &matches_finished,
+	};
+}
+
+void Metrics::connection_closed(Connection const &c) {
+	connection_in.record(c.recv_buffer.added);
+	connection_out.record(c.send_buffer.sent);
+}
+
+void Metrics::write(std::ostream &out) const {
+	for (Counter const *counter : counters) {
+		counter->write(out);
+	}
+	for (Histogram const *histogram : histograms) {
+		histogram->write(out);
+	}
+}
+
+//---------------------------------
+
+MetricsEndpoint::MetricsEndpoint(std::string const &port, Metrics const &metrics_, std::function< void() > const &wake_)
+	: metrics(metrics_), wake(wake_) {
+	//(only reachable from this machine)
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	struct addrinfo *res = nullptr;
+	int ret = getaddrinfo("127.0.0.1", port.c_str(), &hints, &res);
+	if (ret != 0) {
+		throw std::runtime_error("getaddrinfo error: " + std::string(gai_strerror(ret)));
+	}
+	for (struct addrinfo *info = res; info != nullptr && listen_socket == INVALID_SOCKET; info = info->ai_next) {
+		SOCKET s = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		if (s == INVALID_SOCKET) continue;
+		int one = 1;
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast< char const * >(&one), sizeof(one));
+		if (bind(s, info->ai_addr, int(info->ai_addrlen)) != 0 || ::listen(s, 8) != 0) {
+			closesocket(s);
+			continue;
+		}
+		listen_socket = s;
+	}
+	freeaddrinfo(res);
+	if (listen_socket == INVALID_SOCKET) {
+		throw std::runtime_error("Failed to open metrics endpoint on port " + port);
+	}
+
+	log_info("[MetricsEndpoint] serving metrics on 127.0.0.1:{}", port);
+	thread = std::thread(&MetricsEndpoint::serve, this);
+}
+
+MetricsEndpoint::~MetricsEndpoint() {
+	quit = true;
+	thread.join();
+	closesocket(listen_socket);
+}
+
+void MetricsEndpoint::answer_now(std::function< void(std::ostream &) > const &write) {
+	std::ostringstream out;
+	write(out);
+
+	std::lock_guard< std::mutex > guard(answer_mutex);
+	if (!wanted.load(std::memory_order_relaxed)) return; //(the request gave up)
+	io_text = out.str();
+	answered = true;
+	wanted.store(false, std::memory_order_relaxed);
+	answered_cv.notify_all();
+}
+
+std::string MetricsEndpoint::collect() {
+	std::ostringstream out;
+	metrics.write(out);
+
+	//ask the I/O thread for its part:
+	std::unique_lock< std::mutex > lock(answer_mutex);
+	answered = false;
+	wanted.store(true, std::memory_order_release);
+	if (wake) wake();
+	if (answered_cv.wait_for(lock, std::chrono::seconds(1), [this](){ return answered; })) {
+		out << io_text;
+	} else {
+		wanted.store(false, std::memory_order_relaxed);
+		out << "# (the I/O thread didn't answer in time)\n";
+	}
+	return out.str();
+}
+
+void MetricsEndpoint::serve() {
+	//wait for a connection, checking 'quit' now and then:
+	auto wait_readable = [](SOCKET s, double seconds) {
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(s, &fds);
+		struct timeval tv;
+		tv.tv_sec = long(seconds);
+		tv.tv_usec = long((seconds - long(seconds)) * 1e6);
+		return select(int(s) + 1, &fds, NULL, NULL, &tv) > 0;
+	};
+
+	while (!quit) {
+		if (!wait_readable(listen_socket, 0.25)) continue;
+		SOCKET s = accept(listen_socket, NULL, NULL);
+		if (s == INVALID_SOCKET) continue;
+
+		//read (and ignore) whatever request was sent; plain 'nc' sends nothing, so don't wait long:
+		char request[1024];
+		if (wait_readable(s, 0.1)) {
+			recv(s, request, sizeof(request), 0);
+		}
+
+		std::string body = collect();
+		std::ostringstream response;
+		response << "HTTP/1.0 200 OK\r\n"
+			<< "Content-Type: text/plain; version=0.0.4\r\n"
+			<< "Content-Length: " << body.size() << "\r\n"
+			<< "\r\n" << body;
+		std::string data = response.str();
+
+		#ifdef MSG_NOSIGNAL
+		int const flags = MSG_NOSIGNAL; //(a reader that hangs up early shouldn't kill the server)
+		#else
+		int const flags = 0;
+		#endif
+		size_t sent = 0;
+		while (sent < data.size()) {
+			auto ret = send(s, data.data() + sent, int(data.size() - sent), flags);
+			if (ret <= 0) break;
+			sent += size_t(ret);
+		}
+		closesocket(s);
+	}
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Connection.hpp" //(for the socket types)
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+//Server instrumentation: histograms and counters that any thread can record into with
+// a few relaxed atomic adds, rendered as text only when someone asks (see MetricsEndpoint).
+
+//Histogram counts values in log-linear buckets (HDR-style): exact below 128, and within
+// 1/64 (about 1.6%) of the true value above that, over the whole uint64_t range.
+struct Histogram {
+	Histogram(std::string const &name, std::string const &help);
+	Histogram(Histogram const &) = delete;
+
+	void record(uint64_t value);
+
+	static const int SubBits = 6; //64 buckets per power of two (above 128)
+	static const size_t BucketCount = (64 - SubBits + 1) << SubBits;
+	static size_t bucket_of(uint64_t value);
+	static uint64_t bucket_top(size_t bucket); //largest value that lands in 'bucket'
+
+	//'name_count', 'name_sum', 'name_max', and a few quantiles:
+	void write(std::ostream &out) const;
+
+	std::string name, help;
+	std::atomic< uint64_t > count{0}, sum{0}, max{0};
+	std::atomic< uint64_t > buckets[BucketCount];
+};
+
+//Counter is a single value; 'gauge' ones go up and down, the rest only go up:
+struct Counter {
+	Counter(std::string const &name, std::string const &help, bool gauge = false) : name(name), help(help), gauge(gauge) { }
+	Counter(Counter const &) = delete;
+
+	void add(int64_t amount = 1) { value.fetch_add(uint64_t(amount), std::memory_order_relaxed); }
+	void set(int64_t to) { value.store(uint64_t(to), std::memory_order_relaxed); }
+
+	void write(std::ostream &out) const;
+
+	std::string name, help;
+	bool gauge;
+	std::atomic< uint64_t > value{0};
+};
+
+//Everything the server measures. Times are in nanoseconds:
+struct Metrics {
+	Metrics();
+
+	//simulation:
+	Histogram room_tick{"room_tick_ns", "time one room took to tick, for ticks that stepped"};
+	Histogram batch{"step_batch_ns", "time to tick every room, for ticks that stepped"};
+	Histogram step_late{"step_late_ns", "how late fixed steps started"};
+	Histogram collision{"collision_ns", "collision checks in one step of one room (not lockstep rooms)"};
+	Histogram serialize{"snapshot_serialize_ns", "time to build one snapshot (full or delta)"};
+	Histogram snapshot_bytes{"snapshot_bytes", "size of one snapshot (full or delta)"};
+
+	//queues:
+	Histogram inbox{"room_inbox_events", "events a room handled in one tick"};
+	Histogram outbox{"room_outbox_items", "output a room queued in one tick (drained by the I/O thread)"};
+
+	//connections (recorded when they close):
+	Histogram connection_in{"connection_bytes_in", "bytes received over a connection's lifetime"};
+	Histogram connection_out{"connection_bytes_out", "bytes sent over a connection's lifetime"};
+
+	Counter connections_total{"connections_total", "connections accepted"};
+	Counter rooms{"rooms", "rooms being ticked", true};
+	Counter matches_started{"matches_started_total", "matches that started"};
+	Counter matches_finished{"matches_finished_total", "matches that ended (including forfeits)"};
+
+	std::vector< Histogram const * > histograms;
+	std::vector< Counter const * > counters;
+
+	//(I/O thread) record a connection's totals as it goes away:
+	void connection_closed(Connection const &c);
+
+	void write(std::ostream &out) const;
+};
+
+//MetricsEndpoint answers every connection to a local port with a plain-text dump of
+// 'metrics' (e.g. 'curl http://localhost:9100/'), from its own thread. Recording costs
+// the same whether or not anyone is connected; formatting only happens per request.
+//
+//Some stats (e.g. per-connection ones) belong to the I/O thread. For those, a request
+// calls 'wake' and waits (briefly) for the I/O thread to fill them in through answer():
+struct MetricsEndpoint {
+	MetricsEndpoint(std::string const &port, Metrics const &metrics, std::function< void() > const &wake);
+	~MetricsEndpoint();
+	MetricsEndpoint(MetricsEndpoint const &) = delete;
+
+	//(I/O thread) call after every poll; if a request is waiting, 'write(std::ostream &)' fills in
+	// the I/O thread's part (otherwise this is one atomic load):
+	template< typename F >
+	void answer(F const &write) {
+		if (wanted.load(std::memory_order_acquire)) answer_now(write);
+	}
+	void answer_now(std::function< void(std::ostream &) > const &write);
+
+	//internals:
+	Metrics const &metrics;
+	std::function< void() > wake;
+	SOCKET listen_socket = INVALID_SOCKET;
+	std::thread thread;
+	std::atomic< bool > quit{false};
+
+	std::atomic< bool > wanted{false}; //a request is waiting on the I/O thread
+	std::mutex answer_mutex;
+	std::condition_variable answered_cv;
+	bool answered = false;
+	std::string io_text;
+
+	void serve(); //endpoint thread main loop
+	std::string collect(); //full response body
+};
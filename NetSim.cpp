@@ -0,0 +1,122 @@
+#include "NetSim.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+#include <cstdlib>
+#include <limits>
+#include <chrono>
+
+NetSimConfig NetSimConfig::parse(std::string const &spec) {
+	NetSimConfig config;
+	std::istringstream in(spec);
+	std::string item;
+	while (std::getline(in, item, ',')) {
+		if (item.empty()) continue;
+		size_t eq = item.find('=');
+		if (eq == std::string::npos) {
+			throw std::runtime_error("Expected key=value in network simulation spec, got '" + item + "'.");
+		}
+		std::string key = item.substr(0, eq);
+		std::string value = item.substr(eq + 1);
+		char *end = nullptr;
+		double number = strtod(value.c_str(), &end);
+		if (value.empty() || *end != '\0' || number < 0.0) {
+			throw std::runtime_error("Bad value '" + value + "' for '" + key + "' in network simulation spec.");
+		}
+		if (key == "latency") config.latency = number / 1000.0;
+		else if (key == "jitter") config.jitter = number / 1000.0;
+		else if (key == "bandwidth") config.bandwidth = number;
+		else if (key == "reorder") config.reorder = number;
+		else if (key == "loss") config.loss = number;
+		else if (key == "seed") config.seed = uint32_t(number);
+		else throw std::runtime_error("Unknown key '" + key + "' in network simulation spec (expected latency, jitter, bandwidth, reorder, loss, or seed).");
+	}
+	if (config.reorder > 1.0 || config.loss > 1.0) {
+		throw std::runtime_error("'reorder' and 'loss' are fractions, so must be at most 1.");
+	}
+	return config;
+}
+
+NetSimConfig NetSimConfig::from_env() {
+	char const *env = getenv("GAME_NETSIM");
+	if (!env) return NetSimConfig();
+	return parse(env);
+}
+
+//---------------------------------
+
+NetSimLink::NetSimLink(NetSimConfig const &config_, bool stream_, uint32_t seed) : config(config_), stream(stream_), rnd(seed) {
+}
+
+void NetSimLink::push(char const *data, size_t size, double t) {
+	if (size == 0) return;
+	packets += 1;
+	bytes += size;
+
+	std::uniform_real_distribution< double > unit(0.0, 1.0);
+
+	//time for the data to get onto the wire:
+	double sent = t;
+	if (config.bandwidth > 0.0) {
+		free_at = std::max(free_at, t) + double(size) / config.bandwidth;
+		sent = free_at;
+	}
+
+	double delay = config.latency;
+	if (config.jitter > 0.0) {
+		delay = std::max(0.0, delay + (2.0 * unit(rnd) - 1.0) * config.jitter);
+	}
+	double arrival = sent + delay;
+
+	if (config.loss > 0.0 && unit(rnd) < config.loss) {
+		dropped += 1;
+		if (!stream) return;
+		//TCP notices after about a retransmission timeout (at least 200ms on linux):
+		arrival += std::max(0.2, 2.0 * (config.latency + config.jitter));
+	}
+
+	if (stream) {
+		//a byte stream can't arrive out of order:
+		arrival = std::max(arrival, last_arrival);
+		last_arrival = arrival;
+	} else if (config.reorder > 0.0 && unit(rnd) < config.reorder) {
+		//hold it back by another trip's worth, so packets sent after it get there first:
+		reordered += 1;
+		arrival += std::max(config.latency, 0.01);
+	}
+
+	in_flight.emplace(arrival, std::vector< char >(data, data + size)); //(ties stay in send order)
+}
+
+void NetSimLink::pop_due(double t, std::function< void(char const *data, size_t size) > const &deliver) {
+	while (!in_flight.empty() && in_flight.begin()->first <= t) {
+		std::vector< char > data = std::move(in_flight.begin()->second);
+		in_flight.erase(in_flight.begin());
+		deliver(data.data(), data.size());
+	}
+}
+
+double NetSimLink::next_due() const {
+	if (in_flight.empty()) return std::numeric_limits< double >::infinity();
+	return in_flight.begin()->first;
+}
+
+//---------------------------------
+
+static uint32_t pick_seed(uint32_t seed) {
+	return (seed != 0 ? seed : std::random_device()());
+}
+
+NetSim::NetSim(NetSimConfig const &config_, bool stream) : config(config_),
+	up(config_, stream, pick_seed(config_.seed)),
+	down(config_, stream, pick_seed(config_.seed) + 1) {
+}
+
+double NetSim::next_due() const {
+	return std::min(up.next_due(), down.next_due());
+}
+
+double NetSim::now() {
+	return std::chrono::duration< double >(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
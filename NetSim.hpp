@@ -0,0 +1,88 @@
+#pragma once
+
+#include "ByteRing.hpp"
+
+#include <map>
+#include <vector>
+#include <string>
+#include <random>
+#include <functional>
+#include <cstdint>
+
+//NetSim is an in-process network condition simulator for testing how the game
+// behaves over a bad connection (e.g., 50-300ms round trips) without any external tools.
+//
+//Turn it on for a Client and everything it sends and receives is held back
+// according to the configured conditions (see Client::poll in Connection.cpp and
+// udp_client_poll in Udp.cpp):
+//
+//	client.simulate_network(NetSimConfig::parse("latency=100,jitter=20,loss=0.05"));
+//
+//Delays apply in both directions, so the round trip is about twice 'latency'.
+//Over UDP, each packet is delayed, dropped, or reordered on its own; over TCP the
+// stream stays in order and a "lost" chunk instead arrives one retransmission
+// timeout late (holding up everything behind it, as TCP would).
+
+struct NetSimConfig {
+	double latency = 0.0; //one-way delay, seconds
+	double jitter = 0.0; //each delivery is delayed by an extra [-jitter, +jitter] seconds (never below zero)
+	double bandwidth = 0.0; //bytes per second in each direction (0 = unlimited)
+	double reorder = 0.0; //fraction of packets held back long enough for later ones to overtake them (UDP only)
+	double loss = 0.0; //fraction of packets dropped (TCP: retransmitted late)
+	uint32_t seed = 0; //for repeatable runs (0 = random)
+
+	bool enabled() const {
+		return latency > 0.0 || jitter > 0.0 || bandwidth > 0.0 || reorder > 0.0 || loss > 0.0;
+	}
+
+	//parse "key=value,key=value,..." with keys as above; latency and jitter are
+	// given in milliseconds and bandwidth in bytes per second. Throws on a bad spec:
+	static NetSimConfig parse(std::string const &spec);
+	//parse the GAME_NETSIM environment variable (if it is set):
+	static NetSimConfig from_env();
+};
+
+//One direction of a simulated link:
+struct NetSimLink {
+	NetSimLink(NetSimConfig const &config, bool stream, uint32_t seed);
+
+	//queue data sent at time 't' (seconds, see NetSim::now()):
+	void push(char const *data, size_t size, double t);
+	//hand everything that has arrived by time 't' to 'deliver', in arrival order:
+	void pop_due(double t, std::function< void(char const *data, size_t size) > const &deliver);
+	//when the next delivery is due (infinity if nothing is in flight):
+	double next_due() const;
+
+	NetSimConfig config;
+	bool stream; //if true, keep data in order and never drop it (TCP)
+
+	//statistics:
+	uint64_t packets = 0;
+	uint64_t bytes = 0;
+	uint64_t dropped = 0; //(stream: retransmitted)
+	uint64_t reordered = 0;
+
+	//internals:
+	std::multimap< double, std::vector< char > > in_flight; //by arrival time
+	double free_at = 0.0; //when the link finishes sending what it has (bandwidth limit)
+	double last_arrival = 0.0; //(stream) arrival of the newest chunk
+	std::mt19937 rnd;
+};
+
+struct NetSim {
+	NetSim(NetSimConfig const &config, bool stream);
+
+	NetSimConfig config;
+	NetSimLink up; //what we send
+	NetSimLink down; //what we receive
+
+	//when the next delivery in either direction is due:
+	double next_due() const;
+
+	//current time on the steady clock, in seconds:
+	static double now();
+
+	//internals used by Client::poll over TCP:
+	SendQueue wire; //bytes 'up' has delivered that the socket hasn't taken yet
+	ByteQueue arrived; //bytes read from the socket this poll, on their way to 'down'
+};
@@ -0,0 +1,173 @@
+#include "Protocol.hpp"
+
+#include <cassert>
+
+MessageInfo const *message_info(uint8_t type) {
+	struct Registry {
+		MessageInfo infos[256];
+		Registry() {
+			auto add = [this](MessageType type, char const *name, uint32_t min_size, uint32_t max_size, bool reliable, MessageDirection directions) {
+				infos[type].name = name;
+				infos[type].min_size = min_size;
+				infos[type].max_size = max_size;
+				infos[type].reliable = reliable;
+				infos[type].directions = directions;
+			};
+			add(MessagePlayers, "players", PlayersMessage::Size, PlayersMessage::Size, true, MessageToClient);
+			add(MessageHello, "hello", 0, 0, true, MessageToServer);
+			add(MessageStart, "start", 0, 0, true, MessageToClient);
+			add(MessageMove, "move", MoveMessage::Size, MoveMessage::Size, true, MessageBothWays);
+			add(MessageApple, "apple", AppleMessage::Size, AppleMessage::Size, true, MessageToClient);
+			//snapshots are latest-wins; a lost one is superseded by the next:
+			add(MessageSync, "sync", sizeof(uint32_t), 1 << 20, false, MessageToClient);
+			add(MessageDelta, "delta", 2 * sizeof(uint32_t), 1 << 20, false, MessageToClient);
+			add(MessageAck, "ack", AckMessage::Size, AckMessage::Size, false, MessageToServer);
+			add(MessageDeath, "death", 0, 0, true, MessageToClient);
+			add(MessageVictory, "victory", 0, 0, true, MessageToClient);
+			//(lockstep turns, checks and states all build on each other, so they are all reliable)
+			add(MessageLockState, "lock state", 2 * sizeof(uint32_t) + 2 * sizeof(int32_t) + 1, 1 << 20, true, MessageToClient);
+			add(MessageTurn, "turn", TurnMessage::Size, TurnMessage::Size, true, MessageBothWays);
+			add(MessageTick, "tick", TickMessage::Size, TickMessage::Size, true, MessageToClient);
+			add(MessageDesync, "desync", DesyncMessage::Size, DesyncMessage::Size, true, MessageToServer);
+		}
+	};
+	static Registry registry;
+	MessageInfo const &info = registry.infos[type];
+	return (info.name ? &info : nullptr);
+}
+
+//---------------------------------
+
+void PlayersMessage::write(char *to) const {
+	to[0] = char(count);
+	to[1] = char(slot);
+	memcpy(to + 2, &apple.x, sizeof(float));
+	memcpy(to + 2 + sizeof(float), &apple.y, sizeof(float));
+}
+
+void PlayersMessage::read(char const *from) {
+	count = uint8_t(from[0]);
+	slot = uint8_t(from[1]);
+	memcpy(&apple.x, from + 2, sizeof(float));
+	memcpy(&apple.y, from + 2 + sizeof(float), sizeof(float));
+}
+
+void MoveMessage::write(char *to) const {
+	to[0] = char(player);
+	to[1] = char(dir);
+	memcpy(to + 2, &target.x, sizeof(float));
+	memcpy(to + 2 + sizeof(float), &target.y, sizeof(float));
+}
+
+void MoveMessage::read(char const *from) {
+	player = uint8_t(from[0]);
+	dir = uint8_t(from[1]);
+	memcpy(&target.x, from + 2, sizeof(float));
+	memcpy(&target.y, from + 2 + sizeof(float), sizeof(float));
+}
+
+void AppleMessage::write(char *to) const {
+	memcpy(to, &pos.x, sizeof(float));
+	memcpy(to + sizeof(float), &pos.y, sizeof(float));
+}
+
+void AppleMessage::read(char const *from) {
+	memcpy(&pos.x, from, sizeof(float));
+	memcpy(&pos.y, from + sizeof(float), sizeof(float));
+}
+
+void AckMessage::write(char *to) const {
+	memcpy(to, &seq, sizeof(uint32_t));
+}
+
+void AckMessage::read(char const *from) {
+	memcpy(&seq, from, sizeof(uint32_t));
+}
+
+void TurnMessage::write(char *to) const {
+	memcpy(to, &tick, sizeof(uint32_t));
+	to[sizeof(uint32_t)] = char(player);
+	to[sizeof(uint32_t) + 1] = char(dir);
+}
+
+void TurnMessage::read(char const *from) {
+	memcpy(&tick, from, sizeof(uint32_t));
+	player = uint8_t(from[sizeof(uint32_t)]);
+	dir = uint8_t(from[sizeof(uint32_t) + 1]);
+}
+
+void TickMessage::write(char *to) const {
+	memcpy(to, &tick, sizeof(uint32_t));
+	memcpy(to + sizeof(uint32_t), &checksum, sizeof(uint32_t));
+	memcpy(to + 2 * sizeof(uint32_t), &confirmed, sizeof(uint32_t));
+}
+
+void TickMessage::read(char const *from) {
+	memcpy(&tick, from, sizeof(uint32_t));
+	memcpy(&checksum, from + sizeof(uint32_t), sizeof(uint32_t));
+	memcpy(&confirmed, from + 2 * sizeof(uint32_t), sizeof(uint32_t));
+}
+
+void DesyncMessage::write(char *to) const {
+	memcpy(to, &tick, sizeof(uint32_t));
+}
+
+void DesyncMessage::read(char const *from) {
+	memcpy(&tick, from, sizeof(uint32_t));
+}
+
+//---------------------------------
+
+ParseResult next_message(Connection &c, MessageView *view, MessageDirection direction) {
+	assert(view);
+
+	size_t available = c.recv_buffer.size();
+	if (available < MessageHeaderSize) return ParseIncomplete;
+
+	char const *frame = c.recv_buffer.data();
+	uint8_t type = uint8_t(frame[0]);
+	uint32_t size;
+	memcpy(&size, frame + 1, sizeof(uint32_t));
+
+	//(checked before waiting for the payload, so nobody gets to make us buffer a big frame we'd never accept)
+	MessageInfo const *info = message_info(type);
+	if (!info || !(info->directions & direction)) return ParseError;
+	if (size < info->min_size || size > info->max_size) return ParseError;
+
+	if (available < MessageHeaderSize + size) return ParseIncomplete;
+
+	view->type = MessageType(type);
+	view->data = frame + MessageHeaderSize;
+	view->size = size;
+	c.recv_buffer.consume(MessageHeaderSize + size);
+	return ParseOk;
+}
+
+void write_message(std::vector< char > *out, MessageType type, void const *payload, uint32_t size) {
+	assert(out);
+	size_t at = begin_message(out, type);
+	out->insert(out->end(), reinterpret_cast< char const * >(payload), reinterpret_cast< char const * >(payload) + size);
+	end_message(out, at);
+}
+
+size_t begin_message(std::vector< char > *out, MessageType type) {
+	assert(out);
+	size_t at = out->size();
+	out->resize(at + MessageHeaderSize, '\0');
+	(*out)[at] = char(type);
+	return at;
+}
+
+void end_message(std::vector< char > *out, size_t begin) {
+	assert(out && begin + MessageHeaderSize <= out->size());
+	uint32_t size = uint32_t(out->size() - begin - MessageHeaderSize);
+	memcpy(out->data() + begin + 1, &size, sizeof(uint32_t));
+}
+
+void send_message(Connection &c, MessageType type, void const *payload, uint32_t size) {
+	char header[MessageHeaderSize];
+	header[0] = char(type);
+	memcpy(header + 1, &size, sizeof(uint32_t));
+	c.send_raw(header, MessageHeaderSize);
+	if (size) c.send_raw(payload, size);
+}
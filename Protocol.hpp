@@ -0,0 +1,189 @@
+#pragma once
+
+#include "Connection.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+//Every message between client and server is sent as a length-prefixed frame:
+//   [type : uint8][payload size : uint32][payload : size bytes]
+// (multi-byte values are in host byte order, as they always have been in this game)
+//
+//Receiving is done with next_message(), which hands out views directly into the
+// connection's recv_buffer and consumes frames from its front without moving any bytes,
+// so parsing a burst of messages never shifts the rest of the buffer around:
+//
+//	MessageView msg;
+//	while (next_message(*c, &msg, MessageToServer) == ParseOk) {
+//		MoveMessage move;
+//		if (msg.read(&move)) { ... }
+//	}
+
+enum MessageType : uint8_t {
+	MessagePlayers = 'p', //server -> client: PlayersMessage, sent when a client is put in a room
+	MessageHello = 'h', //client -> server: (empty) client is ready to play
+	MessageStart = 's', //server -> client: (empty) match started
+	MessageMove = 'm', //both ways: MoveMessage, a snake turned
+	MessageApple = 'a', //server -> client: AppleMessage, apple moved
+	MessageSync = 'y', //server -> client: Game::write_sync payload (snapshot seq + all snakes)
+	MessageDelta = 'z', //server -> client: Game::write_delta payload (snapshot seq + changes since an acknowledged snapshot)
+	MessageAck = 'k', //client -> server: AckMessage, latest snapshot applied
+	MessageDeath = 'd', //server -> client: (empty) you lost
+	MessageVictory = 'v', //server -> client: (empty) you won
+	//lockstep rooms (see Lockstep.hpp) send these instead of snapshots:
+	MessageLockState = 'l', //server -> client: LockstepGame::write_state payload (whole simulation state)
+	MessageTurn = 't', //both ways: TurnMessage, a turn for a tick (client: asked for; server: scheduled)
+	MessageTick = 'c', //server -> client: TickMessage, checksum of a tick and how far clients may simulate
+	MessageDesync = 'x', //client -> server: DesyncMessage, checksum mismatch (please resend the state)
+};
+
+const uint32_t MessageHeaderSize = 1 + sizeof(uint32_t);
+
+//which way a message travels (a bit mask, so a type can go both ways):
+enum MessageDirection : uint8_t {
+	MessageToClient = 1,
+	MessageToServer = 2,
+	MessageBothWays = MessageToClient | MessageToServer,
+};
+
+//registry of known message types and the payload sizes they allow:
+struct MessageInfo {
+	char const *name = nullptr;
+	uint32_t min_size = 0;
+	uint32_t max_size = 0;
+	bool reliable = true; //false: may be dropped if a newer one gets there first (UDP transport)
+	uint8_t directions = 0; //MessageDirection bits; frames going the other way are rejected by next_message
+};
+//returns nullptr for unknown types:
+MessageInfo const *message_info(uint8_t type);
+
+//------ typed payloads ------
+//Each payload struct gives its MessageType and (fixed) wire Size, and knows how to read/write itself:
+
+struct PlayersMessage {
+	static const MessageType Type = MessagePlayers;
+	static const uint32_t Size = 2 + 2 * sizeof(float);
+	uint8_t count = 0; //players in the room
+	uint8_t slot = 0; //which snake is yours
+	glm::vec2 apple = glm::vec2(0.0f);
+	void write(char *to) const;
+	void read(char const *from);
+};
+
+struct MoveMessage {
+	static const MessageType Type = MessageMove;
+	static const uint32_t Size = 2 + 2 * sizeof(float);
+	uint8_t player = 0; //ignored by the server (it knows who sent the message)
+	uint8_t dir = 0;
+	glm::vec2 target = glm::vec2(0.0f); //turn point (ignored by lockstep rooms)
+	void write(char *to) const;
+	void read(char const *from);
+};
+
+struct AppleMessage {
+	static const MessageType Type = MessageApple;
+	static const uint32_t Size = 2 * sizeof(float);
+	glm::vec2 pos = glm::vec2(0.0f);
+	void write(char *to) const;
+	void read(char const *from);
+};
+
+struct AckMessage {
+	static const MessageType Type = MessageAck;
+	static const uint32_t Size = sizeof(uint32_t);
+	uint32_t seq = 0; //snapshot sequence number from a sync or delta
+	void write(char *to) const;
+	void read(char const *from);
+};
+
+struct TurnMessage {
+	static const MessageType Type = MessageTurn;
+	static const uint32_t Size = sizeof(uint32_t) + 2;
+	uint32_t tick = 0; //apply just before stepping from this tick
+	uint8_t player = 0; //ignored by the server
+	uint8_t dir = 0;
+	void write(char *to) const;
+	void read(char const *from);
+};
+
+struct TickMessage {
+	static const MessageType Type = MessageTick;
+	static const uint32_t Size = 3 * sizeof(uint32_t);
+	uint32_t tick = 0;
+	uint32_t checksum = 0; //LockstepGame::checksum() after reaching 'tick'
+	uint32_t confirmed = 0; //every turn before this tick has been sent
+	void write(char *to) const;
+	void read(char const *from);
+};
+
+struct DesyncMessage {
+	static const MessageType Type = MessageDesync;
+	static const uint32_t Size = sizeof(uint32_t);
+	uint32_t tick = 0; //where the checksum didn't match
+	void write(char *to) const;
+	void read(char const *from);
+};
+
+//------ receiving ------
+
+//A received frame; 'data' points into the connection's recv_buffer and is only
+// valid until the connection next receives data (i.e., the next poll()):
+struct MessageView {
+	MessageType type = MessageType(0);
+	char const *data = nullptr;
+	uint32_t size = 0;
+
+	//decode a typed payload; returns false if this frame isn't a well-formed T:
+	template< typename T >
+	bool read(T *out) const {
+		if (type != T::Type || size != T::Size) return false;
+		out->read(data);
+		return true;
+	}
+};
+
+enum ParseResult {
+	ParseOk, //'view' holds the next message
+	ParseIncomplete, //need more data
+	ParseError //garbage (unknown type, bad size, or a type that doesn't go this way); the connection should be closed
+};
+
+//'direction' is the way frames arriving on 'c' travel (servers read MessageToServer frames):
+ParseResult next_message(Connection &c, MessageView *view, MessageDirection direction);
+
+//------ sending ------
+
+//append a frame to a byte buffer:
+void write_message(std::vector< char > *out, MessageType type, void const *payload = nullptr, uint32_t size = 0);
+
+template< typename T >
+void write_message(std::vector< char > *out, T const &msg) {
+	size_t at = out->size();
+	out->resize(at + MessageHeaderSize + T::Size);
+	char *frame = out->data() + at;
+	frame[0] = char(T::Type);
+	uint32_t size = T::Size;
+	memcpy(frame + 1, &size, sizeof(uint32_t));
+	msg.write(frame + MessageHeaderSize);
+}
+
+//for variable-sized payloads written in place: begin_message() writes a header and returns
+// its offset; end_message() patches in the payload size once everything after it is written:
+size_t begin_message(std::vector< char > *out, MessageType type);
+void end_message(std::vector< char > *out, size_t begin);
+
+//queue a frame on a connection:
+void send_message(Connection &c, MessageType type, void const *payload = nullptr, uint32_t size = 0);
+
+template< typename T >
+void send_message(Connection &c, T const &msg) {
+	char frame[MessageHeaderSize + T::Size];
+	frame[0] = char(T::Type);
+	uint32_t size = T::Size;
+	memcpy(frame + 1, &size, sizeof(uint32_t));
+	msg.write(frame + MessageHeaderSize);
+	c.send_raw(frame, sizeof(frame));
+}
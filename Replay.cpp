@@ -0,0 +1,200 @@
+#include "Replay.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <cassert>
+#include <cstring>
+
+const uint8_t Replay::Version;
+const uint32_t Replay::CheckTicks;
+
+namespace {
+
+const char Magic[4] = {'S', 'N', 'R', 'P'};
+
+void put(std::vector< char > *out, void const *data, size_t size) {
+	out->insert(out->end(), reinterpret_cast< char const * >(data), reinterpret_cast< char const * >(data) + size);
+}
+
+void put_varint(std::vector< char > *out, uint32_t value) {
+	while (value >= 0x80) {
+		out->push_back(char(uint8_t(value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out->push_back(char(uint8_t(value)));
+}
+
+//reads from a buffer, throwing if it runs out:
+struct Reader {
+	char const *data;
+	size_t size;
+	size_t at; //next byte to read
+
+	void get(void *to, size_t count) {
+		if (size - at < count) throw std::runtime_error("Replay data ends in the middle of a record.");
+		memcpy(to, data + at, count);
+		at += count;
+	}
+	uint32_t get_varint() {
+		uint32_t value = 0;
+		for (int shift = 0; shift < 35; shift += 7) {
+			uint8_t byte;
+			get(&byte, 1);
+			value |= uint32_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) return value;
+		}
+		throw std::runtime_error("Replay has an overlong tick count.");
+	}
+};
+
+} //namespace
+
+void Replay::start(Game &game, float step_seconds_) {
+	players = uint8_t(game.snakes.size());
+	step_seconds = step_seconds_;
+	apple = game.apple_pos;
+	records.clear();
+}
+
+void Replay::move(uint32_t tick, int slot, int dir, glm::vec2 target) {
+	ReplayRecord record;
+	record.type = ReplayMove;
+	record.tick = tick;
+	record.slot = uint8_t(slot);
+	record.dir = uint8_t(dir);
+	record.pos = target;
+	records.emplace_back(record);
+}
+
+void Replay::new_apple(uint32_t tick, glm::vec2 pos) {
+	ReplayRecord record;
+	record.type = ReplayApple;
+	record.tick = tick;
+	record.pos = pos;
+	records.emplace_back(record);
+}
+
+void Replay::check(uint32_t tick, Game &game) {
+	ReplayRecord record;
+	record.type = ReplayCheck;
+	record.tick = tick;
+	record.checksum = replay_checksum(game);
+	records.emplace_back(record);
+}
+
+void Replay::end(uint32_t tick, Game &game) {
+	ReplayRecord record;
+	record.type = ReplayEnd;
+	record.tick = tick;
+	record.checksum = replay_checksum(game);
+	record.dead = replay_dead(game);
+	records.emplace_back(record);
+}
+
+void Replay::write(std::vector< char > *out) const {
+	assert(out);
+	put(out, Magic, 4);
+	put(out, &Version, 1);
+	put(out, &players, 1);
+	put(out, &step_seconds, sizeof(float));
+	put(out, &apple, 2 * sizeof(float));
+
+	uint32_t tick = 0;
+	for (ReplayRecord const &record : records) {
+		assert(record.tick >= tick);
+		out->push_back(char(record.type));
+		put_varint(out, record.tick - tick);
+		tick = record.tick;
+		if (record.type == ReplayMove) {
+			put(out, &record.slot, 1);
+			put(out, &record.dir, 1);
+			put(out, &record.pos, 2 * sizeof(float));
+		} else if (record.type == ReplayApple) {
+			put(out, &record.pos, 2 * sizeof(float));
+		} else if (record.type == ReplayCheck) {
+			put(out, &record.checksum, sizeof(uint64_t));
+		} else { assert(record.type == ReplayEnd);
+			put(out, &record.checksum, sizeof(uint64_t));
+			put(out, &record.dead, 1);
+		}
+	}
+}
+
+void Replay::read(char const *data, size_t size) {
+	Reader in{data, size, 0};
+	char magic[4];
+	uint8_t version;
+	in.get(magic, 4);
+	in.get(&version, 1);
+	if (memcmp(magic, Magic, 4) != 0) throw std::runtime_error("Not a replay (bad magic number).");
+	if (version != Version) throw std::runtime_error("Replay is version " + std::to_string(version) + "; expected " + std::to_string(Version) + ".");
+	in.get(&players, 1);
+	in.get(&step_seconds, sizeof(float));
+	in.get(&apple, 2 * sizeof(float));
+	if (!(step_seconds > 0.0f)) throw std::runtime_error("Replay has a bad step length.");
+
+	records.clear();
+	uint32_t tick = 0;
+	while (in.at < in.size) {
+		ReplayRecord record;
+		uint8_t type;
+		in.get(&type, 1);
+		record.type = ReplayRecordType(type);
+		tick += in.get_varint();
+		record.tick = tick;
+		if (record.type == ReplayMove) {
+			in.get(&record.slot, 1);
+			in.get(&record.dir, 1);
+			in.get(&record.pos, 2 * sizeof(float));
+			if (record.slot >= players || record.dir >= 4) throw std::runtime_error("Replay has a move for a player or direction that doesn't exist.");
+		} else if (record.type == ReplayApple) {
+			in.get(&record.pos, 2 * sizeof(float));
+		} else if (record.type == ReplayCheck) {
+			in.get(&record.checksum, sizeof(uint64_t));
+		} else if (record.type == ReplayEnd) {
+			in.get(&record.checksum, sizeof(uint64_t));
+			in.get(&record.dead, 1);
+		} else {
+			throw std::runtime_error("Replay has an unknown record type (" + std::to_string(int(type)) + ").");
+		}
+		records.emplace_back(record);
+	}
+}
+
+void Replay::save(std::string const &filename) const {
+	std::vector< char > data;
+	write(&data);
+	std::ofstream file(filename, std::ios::binary);
+	file.write(data.data(), data.size());
+	if (!file) throw std::runtime_error("Failed to write replay '" + filename + "'.");
+}
+
+void Replay::load(std::string const &filename) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) throw std::runtime_error("Failed to open replay '" + filename + "'.");
+	std::vector< char > data((std::istreambuf_iterator< char >(file)), std::istreambuf_iterator< char >());
+	read(data.data(), data.size());
+}
+
+uint64_t replay_checksum(Game &game) {
+	std::vector< char > state;
+	game.write_sync(&state);
+	put(&state, &game.apple_pos, 2 * sizeof(float));
+
+	//FNV-1a:
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : state) {
+		hash ^= uint8_t(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+uint8_t replay_dead(Game const &game) {
+	uint8_t dead = 0;
+	for (size_t i = 0; i < game.snakes.size() && i < 8; ++i) {
+		if (game.snakes[i]->dead) dead |= uint8_t(1 << i);
+	}
+	return dead;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Game.hpp"
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//A 'Replay' records everything a (non-lockstep) match's Game::update depends on -- the
+// new_game parameters, every apple placement, and every move with the step it came
+// before -- plus checksums of the state along the way. Re-running those inputs through
+// Game::update (see replay.cpp) must land on the same checksums; a mismatch means the
+// simulation changed behavior.
+//
+//Ticks count fixed steps since the match started (Room::ticks): a move recorded at tick t
+// was applied before step t+1; an apple or check recorded at tick t came right after step t.
+//
+//File layout (native byte order, like the network protocol):
+//	header: "SNRP" version:u8 players:u8 step_seconds:f32 apple:f32,f32
+//	records, each: type:u8 ticks_since_previous_record:varint payload
+//		ReplayMove:  slot:u8 dir:u8 target:f32,f32
+//		ReplayApple: pos:f32,f32
+//		ReplayCheck: checksum:u64
+//		ReplayEnd:   checksum:u64 dead:u8 (bit per snake)
+
+enum ReplayRecordType : uint8_t {
+	ReplayMove = 'm',
+	ReplayApple = 'a',
+	ReplayCheck = 'c',
+	ReplayEnd = 'e',
+};
+
+struct ReplayRecord {
+	ReplayRecordType type = ReplayCheck;
+	uint32_t tick = 0;
+	uint8_t slot = 0; //(move)
+	uint8_t dir = 0; //(move)
+	glm::vec2 pos = glm::vec2(0.0f); //(move) target, (apple) position
+	uint64_t checksum = 0; //(check, end)
+	uint8_t dead = 0; //(end)
+};
+
+struct Replay {
+	static const uint8_t Version = 1;
+	static const uint32_t CheckTicks = 60; //a checksum every 60 steps
+
+	uint8_t players = 0;
+	float step_seconds = 0.0f;
+	glm::vec2 apple = glm::vec2(0.0f); //apple before the first step
+	std::vector< ReplayRecord > records; //in the order they happened
+
+	//recording:
+	void start(Game &game, float step_seconds);
+	void move(uint32_t tick, int slot, int dir, glm::vec2 target);
+	void new_apple(uint32_t tick, glm::vec2 pos);
+	void check(uint32_t tick, Game &game);
+	void end(uint32_t tick, Game &game);
+	bool ended() const { return !records.empty() && records.back().type == ReplayEnd; }
+
+	//encode / decode (read throws on malformed data):
+	void write(std::vector< char > *out) const;
+	void read(char const *data, size_t size);
+	void save(std::string const &filename) const;
+	void load(std::string const &filename);
+};
+
+//hash of everything a snapshot carries (plus the apple):
+uint64_t replay_checksum(Game &game);
+//bit per dead snake:
+uint8_t replay_dead(Game const &game);
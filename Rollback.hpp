@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+//Rollback keeps copies of a simulation's state for its last few ticks, so that when an
+// input for a past tick turns up, the simulation can go back to that tick and step
+// forward again with it.
+//
+//'State' is any copyable type with a 'uint32_t tick' member. Memory is fixed at
+// 'capacity' states (slots are reused in place, so steady-state saving doesn't allocate
+// unless a state grows), and a rewind can go back at most capacity - 1 ticks.
+
+template< typename State >
+struct Rollback {
+	explicit Rollback(size_t capacity) : slots(capacity) {
+		assert(capacity > 0);
+	}
+
+	//forget everything and start from 'state':
+	void reset(State const &state) {
+		count = 0;
+		save(state);
+	}
+
+	//record 'state' as the latest tick (it must be the tick after the last one saved):
+	void save(State const &state) {
+		assert(count == 0 || state.tick == newest() + 1);
+		slots[state.tick % slots.size()] = state;
+		newest_tick = state.tick;
+		if (count < slots.size()) ++count;
+	}
+
+	bool empty() const { return count == 0; }
+	uint32_t newest() const { assert(count); return newest_tick; }
+	uint32_t oldest() const { assert(count); return newest_tick - uint32_t(count - 1); }
+	bool has(uint32_t tick) const { return count && tick <= newest_tick && newest_tick - tick < count; }
+
+	State const &at(uint32_t tick) const {
+		assert(has(tick));
+		return slots[tick % slots.size()];
+	}
+
+	//drop every tick after 'tick' (the caller is about to step forward from it again):
+	void rewind(uint32_t tick) {
+		assert(has(tick));
+		count -= newest_tick - tick;
+		newest_tick = tick;
+	}
+
+	//internals:
+	std::vector< State > slots; //state for tick t is in slots[t % capacity]
+	size_t count = 0; //ticks saved (newest_tick and the count - 1 before it)
+	uint32_t newest_tick = 0;
+};
@@ -0,0 +1,562 @@
+#include "Room.hpp"
+#include "Snake.hpp"
+#include "Log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cassert>
+#include <ctime>
+
+Room::Room(uint32_t seed, bool lockstep_, float step_seconds_) : players(PlayerCount, nullptr), step_seconds(step_seconds_), rnd(seed),
+	joined(PlayerCount, false), ready(PlayerCount, false), lost(PlayerCount, false),
+	snapshots(SnapshotHistory), acked(PlayerCount, 0), lockstep(lockstep_),
+	staged(PlayerCount), staged_shared(PlayerCount), freed(PlayerCount, false) {
+	state.new_game(PlayerCount);
+	if (lockstep) {
+		//(the lockstep game places its own apples)
+		lock.new_game(PlayerCount, rnd());
+		state.apple_pos = vec2(to_float(lock.apple.x), to_float(lock.apple.y));
+	} else {
+		new_apple();
+	}
+}
+
+void Room::record() {
+	assert(!lockstep && !started);
+	replay.reset(new Replay());
+	replay->start(state, step_seconds);
+}
+
+void Room::new_apple() {
+	state.apple_pos = vec2(((int)(rnd() % (2 * Game::BOARD_WIDTH + 1))) - Game::BOARD_WIDTH,
+							((int)(rnd() % (2 * Game::BOARD_HEIGHT + 1))) - Game::BOARD_HEIGHT);
+}
+
+void Room::send(int slot, MessageType type) {
+	assert(slot >= 0 && slot < int(staged.size()));
+	assert(!staged_shared[slot]);
+	if (!joined[slot]) return;
+	write_message(&staged[slot], type);
+}
+
+void Room::broadcast(MessageType type) {
+	for (int slot = 0; slot < int(staged.size()); ++slot) {
+		send(slot, type);
+	}
+}
+
+void Room::tick(bool simulate, bool snapshot) {
+	Event evt;
+	uint64_t events = 0;
+	while (inbox.pop(&evt)) {
+		handle(evt);
+		++events;
+	}
+	if (metrics && events) metrics->inbox.record(events);
+
+	if (simulate && started && !finished) {
+		step();
+	}
+	if (snapshot && started && !finished && !lockstep) {
+		sync();
+	}
+
+	//hand this tick's output to the I/O thread:
+	uint64_t items = 0;
+	for (int slot = 0; slot < int(staged.size()); ++slot) {
+		if (staged[slot].empty() && !staged_shared[slot] && !freed[slot]) continue;
+		Outgoing out;
+		out.slot = int8_t(slot);
+		out.freed = freed[slot];
+		out.data.swap(staged[slot]);
+		out.shared.swap(staged_shared[slot]);
+		//the I/O thread drains outboxes every poll, so a full outbox only lasts briefly:
+		while (!outbox.push(std::move(out))) {
+			std::this_thread::yield();
+		}
+		freed[slot] = false;
+		++items;
+	}
+	if (metrics && items) metrics->outbox.record(items);
+
+	if (replay && finished && started && !replay->ended()) {
+		replay->end(ticks, state);
+	}
+}
+
+void Room::handle(Event const &evt) {
+	int slot = evt.slot;
+	assert(slot >= 0 && slot < PlayerCount);
+
+	if (evt.type == Event::Join) {
+		joined[slot] = true;
+		acked[slot] = 0;
+
+		PlayersMessage players;
+		players.count = uint8_t(PlayerCount);
+		players.slot = uint8_t(slot);
+		players.apple = state.apple_pos;
+		send(slot, players);
+		if (lockstep) {
+			lock.write_state(&staged[slot]);
+		}
+	} else if (evt.type == Event::Hello) {
+		if (!joined[slot] || started || finished) return;
+		ready[slot] = true;
+
+		for (int i = 0; i < PlayerCount; ++i) {
+			if (!joined[i] || !ready[i]) return;
+		}
+
+		log_info("Starting game");
+		started = true;
+		if (metrics) metrics->matches_started.add();
+		broadcast(MessageStart);
+		if (lockstep) {
+			send_check(); //(lets clients start stepping)
+		}
+	} else if (evt.type == Event::Move) {
+		if (!joined[slot] || finished) return;
+
+		if (lockstep) {
+			if (started) schedule(slot, evt.dir, lock.tick + LockstepDelay);
+			return;
+		}
+
+		MoveMessage move;
+		move.player = uint8_t(slot);
+		move.dir = uint8_t(evt.dir);
+		move.target = state.snakes[slot]->revert_and_change(evt.target, evt.dir, 2.f);
+		if (replay) replay->move(ticks, slot, evt.dir, evt.target);
+
+		for (int other = 0; other < PlayerCount; ++other) {
+			if (other == slot) continue;
+			send(other, move);
+		}
+
+		log_debug("Updated dir: {}, for player: {}", move.dir, move.player);
+	} else if (evt.type == Event::Turn) {
+		if (!joined[slot] || finished || !lockstep || !started) return;
+		//as asked, unless that tick has already been simulated:
+		schedule(slot, evt.dir, std::min(std::max(evt.seq, lock.tick), lock.tick + LockstepMaxLead));
+	} else if (evt.type == Event::Ack) {
+		if (evt.seq <= sync_seq && evt.seq > acked[slot]) {
+			acked[slot] = evt.seq;
+		}
+	} else if (evt.type == Event::Desync) {
+		if (!lockstep || !joined[slot]) return;
+		log_info("Player {} out of sync at tick {}; resending state at tick {}.", slot, evt.seq, lock.tick);
+		lock.write_state(&staged[slot]);
+	} else if (evt.type == Event::Leave) {
+		joined[slot] = false;
+		ready[slot] = false;
+		staged[slot].clear();
+		staged_shared[slot].reset();
+		if (finished) return;
+
+		if (started) {
+			//match forfeited; everyone still playing wins:
+			for (int i = 0; i < PlayerCount; ++i) {
+				if (!lost[i]) send(i, MessageVictory);
+			}
+			finished = true;
+		} else if (std::find(joined.begin(), joined.end(), true) == joined.end()) {
+			//nobody left waiting in here:
+			finished = true;
+		} else {
+			//the slot can go to the next connection (RoomManager::flush reopens the room):
+			freed[slot] = true;
+		}
+	} else {
+		assert(0 && "Unknown room event.");
+	}
+}
+
+void Room::step() {
+	++ticks;
+	if (lockstep) {
+		while (!scheduled.empty() && scheduled.front().tick == lock.tick) {
+			lock.turn(scheduled.front().player, scheduled.front().dir);
+			scheduled.pop_front();
+		}
+		lock.step();
+	} else {
+		bool eaten = state.update(step_seconds, true);
+		if (metrics) metrics->collision.record(state.collision_ns);
+		if (eaten) {
+			// New apple pos
+			new_apple();
+			if (replay) replay->new_apple(ticks, state.apple_pos);
+			AppleMessage apple;
+			apple.pos = state.apple_pos;
+			broadcast(apple);
+		}
+	}
+
+	// Check for dead sneks
+	int alive = 0;
+	for (int i = 0; i < PlayerCount; ++i) {
+		if (lockstep ? lock.snakes[i].dead : state.snakes[i]->dead) {
+			if (!lost[i]) {
+				// Send death
+				lost[i] = true;
+				send(i, MessageDeath);
+			}
+		} else {
+			alive++;
+		}
+	}
+
+	if (alive <= 1) {
+		log_info("DEAD: {}", PlayerCount - alive);
+
+		// Send victory
+		for (int i = 0; i < PlayerCount; ++i) {
+			if (!lost[i]) send(i, MessageVictory);
+		}
+		finished = true;
+		return;
+	}
+
+	if (lockstep && lock.tick % LockstepCheckTicks == 0) {
+		send_check();
+	}
+	if (replay && ticks % Replay::CheckTicks == 0) {
+		replay->check(ticks, state);
+	}
+}
+
+void Room::sync() {
+	uint32_t seq = ++sync_seq;
+	Snapshot &snapshot = snapshots[seq % SnapshotHistory];
+	snapshot.seq = seq;
+	snapshot.heads.clear();
+	for (Snake *snake : state.snakes) {
+		snapshot.heads.emplace_back(snake->head->id);
+	}
+
+	//players that acknowledged the same baseline get the same buffer, so each version is serialized once:
+	std::vector< std::pair< uint32_t, SharedBuffer > > built; //(baseline, message); baseline 0 = full
+	for (int slot = 0; slot < PlayerCount; ++slot) {
+		if (!joined[slot]) continue;
+
+		uint32_t base = acked[slot];
+		if (base == 0 || seq - base >= SnapshotHistory || snapshots[base % SnapshotHistory].seq != base) {
+			base = 0; //too far behind (or nothing acknowledged yet); send everything
+		}
+
+		auto f = std::find_if(built.begin(), built.end(), [base](std::pair< uint32_t, SharedBuffer > const &b){ return b.first == base; });
+		if (f == built.end()) {
+			std::chrono::steady_clock::time_point before = std::chrono::steady_clock::now();
+			std::shared_ptr< std::vector< char > > message = std::make_shared< std::vector< char > >();
+			if (base == 0) {
+				state.write_sync(message.get(), seq);
+			} else {
+				state.write_delta(message.get(), seq, base, snapshots[base % SnapshotHistory].heads);
+			}
+			if (metrics) {
+				metrics->serialize.record(uint64_t(std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now() - before).count()));
+				metrics->snapshot_bytes.record(message->size());
+			}
+			built.emplace_back(base, message);
+			f = built.end() - 1;
+		}
+		staged_shared[slot] = f->second;
+	}
+}
+
+void Room::schedule(int slot, int dir, uint32_t tick) {
+	assert(tick >= lock.tick);
+	LockstepGame::Turn turn;
+	turn.tick = tick;
+	turn.player = uint8_t(slot);
+	turn.dir = uint8_t(dir);
+	//(keep 'scheduled' in tick order; turns for the same tick apply in the order they came in)
+	auto at = std::find_if(scheduled.begin(), scheduled.end(), [tick](LockstepGame::Turn const &t){ return t.tick > tick; });
+	scheduled.insert(at, turn);
+
+	//everyone (including the sender) applies it at the same tick:
+	TurnMessage msg;
+	msg.tick = turn.tick;
+	msg.player = turn.player;
+	msg.dir = turn.dir;
+	broadcast(msg);
+}
+
+void Room::send_check() {
+	TickMessage check;
+	check.tick = lock.tick;
+	check.checksum = lock.checksum();
+	//turns that arrive from now on are scheduled for lock.tick or later:
+	check.confirmed = lock.tick;
+	broadcast(check);
+}
+
+//---------------------------------
+
+RoomManager::RoomManager(unsigned workers, std::function< void() > const &on_output_, bool lockstep_, TickRates const &rates_)
+	: rates(rates_), lockstep(lockstep_), on_output(on_output_), pool(workers) {
+	std::random_device r;
+	std::seed_seq seed{r(), r(), r(), r(), r(), r(), r(), r()};
+	rnd.seed(seed);
+
+	simulation = std::thread(&RoomManager::simulate, this);
+}
+
+RoomManager::~RoomManager() {
+	quit = true;
+	simulation.join();
+	//(retired rooms stay in 'rooms' until flush(), so this frees everything)
+	for (Room *room : rooms) {
+		delete room;
+	}
+}
+
+void RoomManager::on_open(Connection *c) {
+	//drop rooms that were torn down while waiting for players:
+	while (!open_rooms.empty() && !open_rooms.back()->open) {
+		open_rooms.pop_back();
+	}
+
+	if (open_rooms.empty()) {
+		Room *room = new Room(rnd(), lockstep, float(1.0 / rates.simulation));
+		room->metrics = &metrics;
+		if (!record_dir.empty() && !lockstep) room->record();
+		rooms.insert(room);
+		open_rooms.emplace_back(room);
+		while (!created.push(std::move(room))) {
+			std::this_thread::yield();
+		}
+	}
+
+	Room *room = open_rooms.back();
+	auto slot = std::find(room->players.begin(), room->players.end(), nullptr);
+	assert(slot != room->players.end());
+	*slot = c;
+	room_of[c] = room;
+
+	Room::Event evt;
+	evt.type = Room::Event::Join;
+	evt.slot = int8_t(slot - room->players.begin());
+	while (!room->inbox.push(std::move(evt))) {
+		std::this_thread::yield();
+	}
+
+	if (std::find(room->players.begin(), room->players.end(), nullptr) == room->players.end()) {
+		room->open = false;
+		open_rooms.pop_back();
+	}
+}
+
+void RoomManager::on_close(Connection *c) {
+	auto f = room_of.find(c);
+	if (f == room_of.end()) return;
+	Room *room = f->second;
+	room_of.erase(f);
+
+	auto slot = std::find(room->players.begin(), room->players.end(), c);
+	assert(slot != room->players.end());
+	*slot = nullptr;
+	//(only the simulation knows whether the match has started; if it hasn't, the room
+	// says so and flush() reopens it)
+	room->open = false;
+
+	Room::Event evt;
+	evt.type = Room::Event::Leave;
+	evt.slot = int8_t(slot - room->players.begin());
+	while (!room->inbox.push(std::move(evt))) {
+		std::this_thread::yield();
+	}
+}
+
+void RoomManager::on_hello(Connection *c) {
+	auto f = room_of.find(c);
+	if (f == room_of.end()) return;
+	Room *room = f->second;
+
+	Room::Event evt;
+	evt.type = Room::Event::Hello;
+	evt.slot = int8_t(std::find(room->players.begin(), room->players.end(), c) - room->players.begin());
+	if (!room->inbox.push(std::move(evt))) {
+		log_warning("Room inbox full; dropping hello from {}.", c);
+	}
+}
+
+void RoomManager::on_move(Connection *c, char dir, glm::vec2 target) {
+	auto f = room_of.find(c);
+	if (f == room_of.end()) return;
+	Room *room = f->second;
+
+	Room::Event evt;
+	evt.type = Room::Event::Move;
+	evt.slot = int8_t(std::find(room->players.begin(), room->players.end(), c) - room->players.begin());
+	evt.dir = dir;
+	evt.target = target;
+	if (!room->inbox.push(std::move(evt))) {
+		log_warning("Room inbox full; dropping move from {}.", c);
+	}
+}
+
+void RoomManager::on_turn(Connection *c, char dir, uint32_t tick) {
+	auto f = room_of.find(c);
+	if (f == room_of.end()) return;
+	Room *room = f->second;
+
+	Room::Event evt;
+	evt.type = Room::Event::Turn;
+	evt.slot = int8_t(std::find(room->players.begin(), room->players.end(), c) - room->players.begin());
+	evt.dir = dir;
+	evt.seq = tick;
+	if (!room->inbox.push(std::move(evt))) {
+		log_warning("Room inbox full; dropping turn from {}.", c);
+	}
+}
+
+void RoomManager::on_ack(Connection *c, uint32_t seq) {
+	auto f = room_of.find(c);
+	if (f == room_of.end()) return;
+	Room *room = f->second;
+
+	Room::Event evt;
+	evt.type = Room::Event::Ack;
+	evt.slot = int8_t(std::find(room->players.begin(), room->players.end(), c) - room->players.begin());
+	evt.seq = seq;
+	//(a dropped ack just means the next snapshot is a bigger delta)
+	room->inbox.push(std::move(evt));
+}
+
+void RoomManager::on_desync(Connection *c, uint32_t tick) {
+	auto f = room_of.find(c);
+	if (f == room_of.end()) return;
+	Room *room = f->second;
+
+	Room::Event evt;
+	evt.type = Room::Event::Desync;
+	evt.slot = int8_t(std::find(room->players.begin(), room->players.end(), c) - room->players.begin());
+	evt.seq = tick;
+	if (!room->inbox.push(std::move(evt))) {
+		log_warning("Room inbox full; dropping desync from {}.", c);
+	}
+}
+
+void RoomManager::flush() {
+	//grab retired rooms first, so that all of their output is already in their outboxes:
+	std::vector< Room * > done;
+	Room *room;
+	while (retired.pop(&room)) {
+		done.emplace_back(room);
+	}
+
+	Room::Outgoing out;
+	for (Room *room : rooms) {
+		while (room->outbox.pop(&out)) {
+			if (out.freed) {
+				//a player left before the match started; the room can take someone else:
+				room->open = true;
+				if (std::find(open_rooms.begin(), open_rooms.end(), room) == open_rooms.end()) {
+					open_rooms.emplace_back(room);
+				}
+			}
+			Connection *c = room->players[out.slot];
+			if (!c) continue;
+			if (!out.data.empty()) c->send_raw(out.data.data(), out.data.size());
+			if (out.shared) c->send_shared(out.shared);
+		}
+	}
+
+	//retired rooms' remaining players go back to being unassigned:
+	for (Room *room : done) {
+		for (Connection *c : room->players) {
+			if (c) room_of.erase(c);
+		}
+		auto open = std::find(open_rooms.begin(), open_rooms.end(), room);
+		if (open != open_rooms.end()) open_rooms.erase(open);
+		if (room->replay && room->replay->ended()) {
+			std::string filename = record_dir + "/match-" + std::to_string(std::time(nullptr)) + "-" + std::to_string(recorded) + ".replay";
+			try {
+				room->replay->save(filename);
+				recorded += 1;
+			} catch (std::exception const &e) {
+				log_warning("[RoomManager] {}", e.what());
+			}
+		}
+		rooms.erase(room);
+		delete room;
+	}
+}
+
+void RoomManager::simulate() {
+	typedef std::chrono::steady_clock Clock;
+
+	//every room is ticked whenever any of these is due (so steps and snapshots handle input too):
+	Scheduler scheduler;
+	scheduler.add("input", rates.input);
+	size_t const step_task = scheduler.tasks.size();
+	uint32_t const Step = scheduler.add("step", rates.simulation);
+	uint32_t const Snapshot = scheduler.add("snapshot", rates.snapshot);
+
+	Clock::time_point report = Clock::now();
+	std::atomic< uint64_t > busy_ns(0);
+
+	while (!quit) {
+		uint32_t due = scheduler.wait();
+		bool simulate = (due & Step) != 0;
+		bool snapshot = (due & Snapshot) != 0;
+		Clock::time_point start = Clock::now();
+
+		Room *room;
+		while (created.pop(&room)) {
+			active.emplace_back(room);
+		}
+
+		if (simulate) {
+			metrics.step_late.record(uint64_t(scheduler.tasks[step_task].late * 1e9));
+		}
+
+		pool.run(active.size(), [this,&busy_ns,simulate,snapshot](size_t i){
+			Clock::time_point before = Clock::now();
+			active[i]->tick(simulate, snapshot);
+			uint64_t ns = uint64_t(std::chrono::duration_cast< std::chrono::nanoseconds >(Clock::now() - before).count());
+			busy_ns.fetch_add(ns, std::memory_order_relaxed);
+			if (simulate) metrics.room_tick.record(ns);
+		});
+
+		//stop ticking finished rooms and hand them back to the I/O thread to free:
+		for (size_t i = 0; i < active.size(); /*later*/) {
+			if (active[i]->finished) {
+				if (active[i]->started) metrics.matches_finished.add();
+				while (!retired.push(std::move(active[i]))) {
+					std::this_thread::yield();
+				}
+				active[i] = active.back();
+				active.pop_back();
+			} else {
+				++i;
+			}
+		}
+
+		if (on_output) on_output();
+
+		Clock::time_point end = Clock::now();
+		if (simulate) metrics.batch.record(uint64_t(std::chrono::duration_cast< std::chrono::nanoseconds >(end - start).count()));
+		metrics.rooms.set(int64_t(active.size()));
+		stats.batches += 1;
+		stats.batch_max = std::max(stats.batch_max, std::chrono::duration< double >(end - start).count());
+
+		double since_report = std::chrono::duration< double >(end - report).count();
+		if (since_report >= 5.0) {
+			stats.busy = busy_ns.exchange(0) * 1e-9;
+			//cores kept busy by simulation, on average:
+			double cores = stats.busy / since_report;
+			log_info("[RoomManager] {} rooms on {} workers; {} batches/s, batch max {}ms, {} matches/core, {} steals.",
+				active.size(), pool.size(), stats.batches / since_report, stats.batch_max * 1000.0,
+				(cores > 0.0 ? active.size() / cores : 0.0), pool.steals.load());
+			for (Scheduler::Task const &task : scheduler.tasks) {
+				log_info("\t{} {}/s (late max {}ms, {} skipped)", task.name, task.runs / since_report, task.late_max * 1000.0, task.skipped);
+			}
+			scheduler.reset_stats();
+			stats = Stats();
+			report = end;
+		}
+	}
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include "Connection.hpp"
+#include "Game.hpp"
+#include "Lockstep.hpp"
+#include "Metrics.hpp"
+#include "Protocol.hpp"
+#include "Replay.hpp"
+#include "Scheduler.hpp"
+#include "SpscQueue.hpp"
+#include "WorkerPool.hpp"
+
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+
+//How often the server does each part of its work (each on its own schedule):
+struct TickRates {
+	double simulation = 60.0; //fixed steps per second (lockstep rooms need LockstepGame::TicksPerSecond)
+	double input = 240.0; //times per second rooms handle queued messages and send what they produced
+	double snapshot = 5.0; //snapshots per second (rooms that aren't lockstep)
+};
+
+//A 'Room' is one independent match, with its own Game state and players.
+// Rooms are split between two threads:
+//  - the I/O thread (the one calling Server::poll) owns 'players' and talks to sockets;
+//  - the simulation runs Room::tick on some worker thread, at the input rate and whenever
+//    a fixed step or a snapshot is due.
+// The two sides only communicate through the lock-free 'inbox' and 'outbox' queues.
+//
+//A lockstep room (see Lockstep.hpp) runs a LockstepGame instead of 'state' and sends
+// players turns and checksums instead of snapshots.
+struct Room {
+	Room(uint32_t seed, bool lockstep = false, float step_seconds = 1.f / 60.f);
+
+	static const int PlayerCount = 2;
+	static const uint32_t SnapshotHistory = 16; //deltas can be built against any of the last 16 snapshots
+	static const uint32_t LockstepDelay = 10; //lockstep moves (no tick given) happen 10 ticks after the server gets them
+	static const uint32_t LockstepMaxLead = 30; //turns asked for further ahead than this are moved closer
+	static const uint32_t LockstepCheckTicks = 5; //send a checksum (and confirm the ticks before it) every 5 ticks
+
+	//------ I/O thread side ------
+	//players[slot] is the connection playing snake 'slot' (or nullptr if the slot is free / gone):
+	std::vector< Connection * > players;
+	bool open = true; //still taking new players
+
+	//------ queues between the I/O thread and the simulation ------
+	struct Event {
+		enum Type : uint8_t {
+			Join,
+			Hello,
+			Move,
+			Turn,
+			Ack,
+			Desync,
+			Leave
+		} type = Join;
+		int8_t slot = -1;
+		char dir = 0;
+		glm::vec2 target = glm::vec2(0.f);
+		uint32_t seq = 0; //(Ack: snapshot seq; Turn, Desync: tick)
+	};
+	struct Outgoing {
+		int8_t slot = -1;
+		bool freed = false; //player left before the match started, so the slot can take a new connection
+		std::vector< char > data;
+		SharedBuffer shared; //snapshot serialized once for several players (sent after 'data')
+	};
+	SpscQueue< Event > inbox; //I/O thread -> simulation
+	SpscQueue< Outgoing > outbox; //simulation -> I/O thread
+
+	//------ simulation side (only touched from tick()) ------
+	Game state;
+	float step_seconds; //length of a fixed step
+	Metrics *metrics = nullptr; //(if set) where to record timings and sizes
+	std::unique_ptr< Replay > replay; //(if set) recording of this match (see record())
+	std::mt19937 rnd;
+	std::vector< bool > joined; //got Join for this slot (and no Leave)
+	std::vector< bool > ready; //got 'h' from this slot
+	std::vector< bool > lost; //sent 'd' to this slot
+	bool started = false;
+	bool finished = false; //match is over; RoomManager will retire the room after this tick
+	uint32_t ticks = 0; //ticks since the match started
+
+	//snapshots are sent as deltas against the latest one each player has acknowledged,
+	// or in full when a player has no recent enough acknowledged snapshot:
+	struct Snapshot {
+		uint32_t seq = 0;
+		std::vector< int > heads; //each snake's head segment id when the snapshot was taken
+	};
+	std::vector< Snapshot > snapshots; //indexed by seq % SnapshotHistory
+	uint32_t sync_seq = 0; //seq of the latest snapshot (0 = none yet)
+	std::vector< uint32_t > acked; //latest snapshot each slot has acknowledged (0 = none)
+
+	//lockstep rooms:
+	bool lockstep = false;
+	LockstepGame lock;
+	std::deque< LockstepGame::Turn > scheduled; //turns for future ticks, in tick order
+
+	//process queued events; then, if playing, advance one fixed step (if 'simulate') and
+	// send a snapshot (if 'snapshot'); then queue output:
+	void tick(bool simulate, bool snapshot);
+
+	//start recording the match into 'replay' (before any events; not for lockstep rooms):
+	void record();
+
+	//helpers:
+	void handle(Event const &evt);
+	void step();
+	void new_apple();
+	void sync();
+	void schedule(int slot, int dir, uint32_t tick); //(lockstep) a turn, for everyone
+	void send_check(); //(lockstep) checksum of the current tick
+	//queue a frame for one player / all players (only players that have joined receive anything):
+	void send(int slot, MessageType type);
+	void broadcast(MessageType type);
+	template< typename T >
+	void send(int slot, T const &msg) {
+		assert(!staged_shared[slot]);
+		if (joined[slot]) write_message(&staged[slot], msg);
+	}
+	template< typename T >
+	void broadcast(T const &msg) {
+		for (int slot = 0; slot < int(staged.size()); ++slot) send(slot, msg);
+	}
+
+	//output accumulated during a tick, flushed to 'outbox' at the end of tick():
+	std::vector< std::vector< char > > staged;
+	std::vector< SharedBuffer > staged_shared; //(snapshots are the last thing sent in a tick)
+	std::vector< bool > freed; //(see Outgoing::freed)
+};
+
+//'RoomManager' puts new connections into open rooms (on the I/O thread) and
+// runs a simulation thread that ticks every active room on a WorkerPool, as 'rates' says.
+struct RoomManager {
+	//on_output is called from the simulation thread after each tick that may have produced output
+	// (e.g. to wake up a Server::poll that is waiting):
+	RoomManager(unsigned workers = std::thread::hardware_concurrency(), std::function< void() > const &on_output = nullptr,
+		bool lockstep = false, TickRates const &rates = TickRates());
+	~RoomManager();
+
+	TickRates rates;
+
+	//------ I/O thread side ------
+	std::unordered_set< Room * > rooms;
+	std::unordered_map< Connection *, Room * > room_of; //which room each connection is playing in
+	std::vector< Room * > open_rooms; //rooms that have a free player slot
+
+	std::mt19937 rnd; //seeds each room's own generator
+	bool lockstep; //create lockstep rooms
+	std::string record_dir; //(if set) save each finished match here, as a Replay
+	uint32_t recorded = 0; //replays saved so far
+
+	//connection lifecycle (call from Server::poll callbacks):
+	void on_open(Connection *c);
+	void on_close(Connection *c);
+	void on_hello(Connection *c);
+	void on_move(Connection *c, char dir, glm::vec2 target);
+	void on_turn(Connection *c, char dir, uint32_t tick);
+	void on_ack(Connection *c, uint32_t seq);
+	void on_desync(Connection *c, uint32_t tick);
+
+	//move simulation output into connections' send buffers and free retired rooms (call after Server::poll):
+	void flush();
+
+	Metrics metrics; //(recorded from every thread; see MetricsEndpoint)
+
+	//------ simulation side ------
+	std::function< void() > on_output;
+	WorkerPool pool;
+	std::thread simulation;
+	std::atomic< bool > quit{false};
+
+	SpscQueue< Room * > created; //I/O thread -> simulation: new rooms to start ticking
+	SpscQueue< Room * > retired; //simulation -> I/O thread: finished rooms (no longer ticked)
+	std::vector< Room * > active; //rooms being ticked (simulation thread only)
+
+	void simulate(); //simulation thread main loop
+
+	//summary (simulation thread), printed every few seconds:
+	struct Stats {
+		uint32_t batches = 0; //times every room was ticked
+		double busy = 0.0; //total seconds spent in Room::tick over all workers
+		double batch_max = 0.0; //longest tick batch (seconds)
+	} stats;
+};
@@ -7,6 +7,8 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
 
 glm::mat4 Scene::Transform::make_local_to_parent() const {
 	return glm::mat4( //translate
@@ -44,19 +46,37 @@ glm::mat4 Scene::Transform::make_parent_to_local() const {
 	);
 }
 
-glm::mat4 Scene::Transform::make_local_to_world() const {
-	if (parent) {
-		return parent->make_local_to_world() * make_local_to_parent();
-	} else {
-		return make_local_to_parent();
+glm::mat4 const &Scene::Transform::make_local_to_world() const {
+	if (local_to_world_dirty) {
+		if (parent) {
+			local_to_world = parent->make_local_to_world() * make_local_to_parent();
+		} else {
+			local_to_world = make_local_to_parent();
+		}
+		local_to_world_dirty = false;
 	}
+	return local_to_world;
 }
 
-glm::mat4 Scene::Transform::make_world_to_local() const {
-	if (parent) {
-		return make_parent_to_local() * parent->make_world_to_local();
-	} else {
-		return make_parent_to_local();
+glm::mat4 const &Scene::Transform::make_world_to_local() const {
+	if (world_to_local_dirty) {
+		if (parent) {
+			world_to_local = make_parent_to_local() * parent->make_world_to_local();
+		} else {
+			world_to_local = make_parent_to_local();
+		}
+		world_to_local_dirty = false;
+	}
+	return world_to_local;
+}
+
+void Scene::Transform::mark_dirty() {
+	//if both are already dirty, so is everything below (nothing below can be rebuilt without rebuilding this first):
+	if (local_to_world_dirty && world_to_local_dirty) return;
+	local_to_world_dirty = true;
+	world_to_local_dirty = true;
+	for (Transform *child = last_child; child != nullptr; child = child->prev_sibling) {
+		child->mark_dirty();
 	}
 }
 
@@ -99,6 +119,7 @@ void Scene::Transform::set_parent(Transform *new_parent, Transform *before) {
 		}
 		if (prev_sibling) prev_sibling->next_sibling = this;
 	}
+	mark_dirty(); //(new ancestors)
 	DEBUG_assert_valid_pointers();
 }
 
@@ -171,130 +192,292 @@ Scene::SnakeObject *Scene::new_snake(Snake *snake) {
 	return &snakes.back();
 }
 
-void Scene::draw(Scene::Camera const *camera) const {
-	assert(camera && "Must have a camera to draw scene from.");
-
-	glm::mat4 world_to_camera = camera->transform->make_world_to_local();
-	glm::mat4 world_to_clip = camera->make_projection() * world_to_camera;
+//render queue entry for an object (a Scene::Object or a FlatScene::Object):
+template< typename O >
+Scene::RenderItem make_render_item(O const &object, glm::mat4 const &local_to_world) {
+	Scene::RenderItem item;
+	item.program = object.program;
+	item.vao = object.vao;
+	item.material = object.material;
+	item.program_mvp_mat4 = object.program_mvp_mat4;
+	item.program_mv_mat4x3 = object.program_mv_mat4x3;
+	item.program_itmv_mat3 = object.program_itmv_mat3;
+	item.set_uniforms = &object.set_uniforms;
+	item.start = object.start;
+	item.count = object.count;
+	item.local_to_world = &local_to_world;
+	return item;
+}
 
-	for (Scene::Object *object = first_object; object != nullptr; object = object->alloc_next) {
-		glm::mat4 local_to_world = object->transform->make_local_to_world();
+bool Scene::use_program(GLuint program) {
+	if (program == bound_program) {
+		draw_stats.calls_saved += 1;
+		return false;
+	}
+	glUseProgram(program);
+	bound_program = program;
+	draw_stats.state_calls += 1;
+	return true;
+}
 
-		//compute modelview+projection (object space to clip space) matrix for this object:
-		glm::mat4 mvp = world_to_clip * local_to_world;
+void Scene::bind_vertex_array(GLuint vao) {
+	if (vao == bound_vao) {
+		draw_stats.calls_saved += 1;
+		return;
+	}
+	glBindVertexArray(vao);
+	bound_vao = vao;
+	draw_stats.state_calls += 1;
+}
 
-		//compute modelview (object space to camera local space) matrix for this object:
-		glm::mat4 mv = local_to_world;
+void Scene::draw(Scene::Camera const *camera) {
+	assert(camera && "Must have a camera to draw scene from.");
 
-		//NOTE: inverse cancels out transpose unless there is scale involved
-		glm::mat3 itmv = glm::inverse(glm::transpose(glm::mat3(mv)));
+	glm::mat4 const &world_to_camera = camera->transform->make_world_to_local();
+	glm::mat4 world_to_clip = camera->make_projection() * world_to_camera;
 
-		//set up program uniforms:
-		glUseProgram(object->program);
-		if (object->program_mvp_mat4 != -1U) {
-			glUniformMatrix4fv(object->program_mvp_mat4, 1, GL_FALSE, glm::value_ptr(mvp));
+	draw_stats = DrawStats();
+	bound_program = -1U;
+	bound_vao = -1U;
+
+	//gather everything in view (objects without bounds always count as in view), then sort
+	// so that objects sharing state end up next to each other:
+	Frustum frustum(world_to_clip);
+	render_queue.clear();
+	cull_items.clear();
+	cull_mins.clear();
+	cull_maxs.clear();
+	auto gather = [&](RenderItem const &item, bool has_bounds, glm::vec3 const &min, glm::vec3 const &max) {
+		if (!has_bounds) {
+			render_queue.emplace_back(item);
+			return;
 		}
-		if (object->program_mv_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(object->program_mv_mat4x3, 1, GL_FALSE, glm::value_ptr(mv));
+		glm::vec3 world_min, world_max;
+		transform_box(*item.local_to_world, min, max, &world_min, &world_max);
+		if (cull_with_bvh) {
+			cull_items.emplace_back(item);
+			cull_mins.emplace_back(world_min);
+			cull_maxs.emplace_back(world_max);
+		} else if (frustum.visible(world_min, world_max)) {
+			render_queue.emplace_back(item);
+		} else {
+			draw_stats.culled += 1;
 		}
-		if (object->program_itmv_mat3 != -1U) {
-			glUniformMatrix3fv(object->program_itmv_mat3, 1, GL_FALSE, glm::value_ptr(itmv));
+	};
+	for (Scene::Object *object = first_object; object != nullptr; object = object->alloc_next) {
+		gather(make_render_item(*object, object->transform->make_local_to_world()), object->has_bounds, object->bounds_min, object->bounds_max);
+	}
+	flat.update_world();
+	for (FlatScene::Object const &object : flat.objects) {
+		gather(make_render_item(object, flat.local_to_world(object.transform)), object.has_bounds, object.bounds_min, object.bounds_max);
+	}
+	if (!cull_items.empty()) {
+		cull_bvh.build(cull_mins.data(), cull_maxs.data(), uint32_t(cull_items.size()));
+		cull_visible.clear();
+		cull_bvh.query(frustum, cull_mins.data(), cull_maxs.data(), &cull_visible);
+		for (uint32_t i : cull_visible) {
+			render_queue.emplace_back(cull_items[i]);
 		}
-
-		if (object->set_uniforms) object->set_uniforms();
-
-		glBindVertexArray(object->vao);
-
-		//draw the object:
-		glDrawArrays(GL_TRIANGLES, object->start, object->count);
+		draw_stats.culled += uint32_t(cull_items.size() - cull_visible.size());
 	}
-
-	auto make_matrix = [](glm::vec2 pos, glm::vec2 scale) {
-		return glm::mat4(
-					glm::vec4(1.0f, 0.0f, 0.0f, 0.0f),
-					glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
-					glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
-					glm::vec4(pos, 0.f, 1.0f)
-				) * glm::mat4(
-					glm::vec4(scale.x, 0.0f, 0.0f, 0.f),
-					glm::vec4(0.f, scale.y, 0.f, 0.f),
-					glm::vec4(0.f, 0.f, 1.f, 0.f),
-					glm::vec4(0.f, 0.f, 0.f, 1.f)
-				);
+	std::sort(render_queue.begin(), render_queue.end(), [](RenderItem const &a, RenderItem const &b) {
+		if (a.program != b.program) return a.program < b.program;
+		if (a.vao != b.vao) return a.vao < b.vao;
+		return a.material < b.material;
+	});
+
+	//fill the uniform buffer: frame block first, then one (aligned) object block per render item:
+	if (uniform_buffer == 0) {
+		glGenBuffers(1, &uniform_buffer);
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_buffer_alignment);
+		if (uniform_buffer_alignment < 1) uniform_buffer_alignment = 256;
+	}
+	auto aligned = [this](size_t size) {
+		size_t alignment = size_t(uniform_buffer_alignment);
+		return (size + alignment - 1) / alignment * alignment;
 	};
+	size_t objects_offset = aligned(sizeof(FrameUniforms));
+	size_t object_stride = aligned(sizeof(ObjectUniforms));
+	uniform_data.resize(objects_offset + render_queue.size() * object_stride);
+	memcpy(uniform_data.data(), &frame_uniforms, sizeof(FrameUniforms));
+	for (size_t i = 0; i < render_queue.size(); ++i) {
+		RenderItem &item = render_queue[i];
+		glm::mat4 const &local_to_world = *item.local_to_world;
+
+		ObjectUniforms block;
+		//modelview+projection (object space to clip space):
+		block.object_to_clip = world_to_clip * local_to_world;
+		//modelview (object space to lighting space, which is world space):
+		block.object_to_light = local_to_world;
+		//NOTE: inverse cancels out transpose unless there is scale involved
+		glm::mat3 itmv = glm::inverse(glm::transpose(glm::mat3(local_to_world)));
+		for (int c = 0; c < 3; ++c) {
+			block.normal_to_light[c] = glm::vec4(itmv[c], 0.0f);
+		}
+		memcpy(uniform_data.data() + objects_offset + i * object_stride, &block, sizeof(ObjectUniforms));
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, uniform_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, uniform_data.size(), uniform_data.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferRange(GL_UNIFORM_BUFFER, FrameBlockBinding, uniform_buffer, 0, sizeof(FrameUniforms));
 
-	for (SnakeObject const &object : snakes) {
-
-		auto setup_draw = [&object, world_to_clip](glm::mat4 local_to_world) {
-			//compute modelview+projection (object space to clip space) matrix for this object:
-			glm::mat4 mvp = world_to_clip * local_to_world;
-
-			//compute modelview (object space to camera local space) matrix for this object:
-			glm::mat4 mv = local_to_world;
-
-			//NOTE: inverse cancels out transpose unless there is scale involved
-			glm::mat3 itmv = glm::inverse(glm::transpose(glm::mat3(mv)));
+	uint32_t material = 0; //material whose set_uniforms last ran (with the current program)
+	for (size_t i = 0; i < render_queue.size(); ++i) {
+		RenderItem const &item = render_queue[i];
+		size_t offset = objects_offset + i * object_stride;
 
-			//set up program uniforms:
-			glUseProgram(object.program);
-			if (object.program_mvp_mat4 != -1U) {
-				glUniformMatrix4fv(object.program_mvp_mat4, 1, GL_FALSE, glm::value_ptr(mvp));
+		//set up program uniforms:
+		if (use_program(item.program)) material = 0;
+		glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBlockBinding, uniform_buffer, offset, sizeof(ObjectUniforms));
+		//(programs without the block get loose uniforms)
+		if (item.program_mvp_mat4 != -1U || item.program_mv_mat4x3 != -1U || item.program_itmv_mat3 != -1U) {
+			ObjectUniforms block;
+			memcpy(&block, uniform_data.data() + offset, sizeof(ObjectUniforms));
+			if (item.program_mvp_mat4 != -1U) {
+				glUniformMatrix4fv(item.program_mvp_mat4, 1, GL_FALSE, glm::value_ptr(block.object_to_clip));
 			}
-			if (object.program_mv_mat4x3 != -1U) {
-				glUniformMatrix4x3fv(object.program_mv_mat4x3, 1, GL_FALSE, glm::value_ptr(mv));
+			if (item.program_mv_mat4x3 != -1U) {
+				glm::mat4x3 mv = glm::mat4x3(block.object_to_light);
+				glUniformMatrix4x3fv(item.program_mv_mat4x3, 1, GL_FALSE, glm::value_ptr(mv));
 			}
-			if (object.program_itmv_mat3 != -1U) {
-				glUniformMatrix3fv(object.program_itmv_mat3, 1, GL_FALSE, glm::value_ptr(itmv));
+			if (item.program_itmv_mat3 != -1U) {
+				glm::mat3 itmv = glm::mat3(glm::vec3(block.normal_to_light[0]), glm::vec3(block.normal_to_light[1]), glm::vec3(block.normal_to_light[2]));
+				glUniformMatrix3fv(item.program_itmv_mat3, 1, GL_FALSE, glm::value_ptr(itmv));
 			}
+		}
 
-			//if (object.set_uniforms) object.set_uniforms();
+		if (*item.set_uniforms) {
+			if (item.material == 0 || item.material != material) {
+				(*item.set_uniforms)();
+				draw_stats.state_calls += 1;
+			} else {
+				draw_stats.calls_saved += 1;
+			}
+		}
+		material = item.material;
+
+		bind_vertex_array(item.vao);
+
+		//draw the object:
+		glDrawArrays(GL_TRIANGLES, item.start, item.count);
+		draw_stats.draws += 1;
+	}
 
-			glBindVertexArray(object.vao);
-		};
+	draw_snakes(world_to_clip, frustum);
+}
 
-		auto draw_seg = [&object, &setup_draw](glm::mat4 local_to_world) {
-			setup_draw(local_to_world);
-			//draw the object:
-			glDrawArrays(GL_TRIANGLES, object.start, object.count);
-		};
+void Scene::draw_snakes(glm::mat4 const &world_to_clip, Frustum const &frustum) {
+	if (snakes.empty()) return;
+
+	//transforms for every segment and joint of every snake, in one buffer:
+	snake_instances.clear();
+	static glm::mat4 const turn_x = glm::mat4_cast(glm::angleAxis(3.14159265f/2.f, glm::vec3(1.0f, 0.0f, 0.0f)));
+	static glm::mat4 const turn_y = glm::mat4_cast(glm::angleAxis(3.14159265f/2.f, glm::vec3(0.0f, 1.0f, 0.0f)));
+	//(skipping instances whose mesh bounds, if given, are out of view)
+	auto add_instance = [this, &frustum](glm::vec2 pos, glm::vec2 scale, glm::mat4 const &turn, glm::vec3 const *min, glm::vec3 const *max) {
+		glm::mat4 local_to_world = glm::mat4(
+			glm::vec4(scale.x, 0.0f, 0.0f, 0.0f),
+			glm::vec4(0.0f, scale.y, 0.0f, 0.0f),
+			glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+			glm::vec4(pos, 0.0f, 1.0f)
+		) * turn;
+		if (min && max) {
+			glm::vec3 world_min, world_max;
+			transform_box(local_to_world, *min, *max, &world_min, &world_max);
+			if (!frustum.visible(world_min, world_max)) {
+				draw_stats.culled += 1;
+				return;
+			}
+		}
+		for (int row = 0; row < 3; ++row) {
+			snake_instances.emplace_back(local_to_world[0][row], local_to_world[1][row], local_to_world[2][row], local_to_world[3][row]);
+		}
+	};
 
-		auto draw_joint = [&object, &setup_draw](glm::mat4 local_to_world) {
-			setup_draw(local_to_world);
-			//draw the object:
-			glDrawArrays(GL_TRIANGLES, object.joint_start, object.joint_count);
-		};
+	snake_ranges.clear();
+	for (SnakeObject const &object : snakes) {
+		glm::vec3 const *segment_min = (object.has_bounds ? &object.segment_min : nullptr);
+		glm::vec3 const *segment_max = (object.has_bounds ? &object.segment_max : nullptr);
+		glm::vec3 const *joint_min = (object.has_bounds ? &object.joint_min : nullptr);
+		glm::vec3 const *joint_max = (object.has_bounds ? &object.joint_max : nullptr);
+		SnakeRange range;
+		range.segment_base = GLint(snake_instances.size() / 3);
+		for (auto body = object.snake->tail; body != nullptr; body = body->next) {
+			bool vertical = (body->dir == Snake::Direction::UP || body->dir == Snake::Direction::DOWN);
+			add_instance(body->front - (body->dir_vec() * body->length / 2.f),
+				glm::vec2(vertical ? 1.f : body->length, vertical ? body->length : 1.f), vertical ? turn_x : turn_y, segment_min, segment_max);
+		}
+		range.segment_count = GLint(snake_instances.size() / 3) - range.segment_base;
 
+		range.joint_base = GLint(snake_instances.size() / 3);
 		for (auto body = object.snake->tail; body != nullptr; body = body->next) {
-			
-			{ // Draw segment
-				glm::mat4 local_to_world = make_matrix(body->front - (body->dir_vec() * body->length / 2.f),
-											glm::vec2(body->dir == Snake::Direction::LEFT ||
-													body->dir == Snake::Direction::RIGHT ? body->length : 1.f,
-													body->dir == Snake::Direction::UP ||
-													body->dir == Snake::Direction::DOWN ? body->length : 1.f));
-				
-				draw_seg(local_to_world * glm::mat4_cast(glm::angleAxis(3.14159265f/2.f,
-											glm::vec3(body->dir == Snake::Direction::LEFT ||
-													body->dir == Snake::Direction::RIGHT ? 0.f : 1.f,
-													body->dir == Snake::Direction::UP ||
-													body->dir == Snake::Direction::DOWN ? 0.f : 1.f, 0.f))));
+			add_instance(body->front, glm::vec2(1.1f, 1.1f), glm::mat4(1.0f), joint_min, joint_max);
+			if (body == object.snake->tail) {
+				add_instance(body->front - (body->dir_vec() * body->length), glm::vec2(1.1f, 1.1f), glm::mat4(1.0f), joint_min, joint_max);
 			}
+		}
+		range.joint_count = GLint(snake_instances.size() / 3) - range.joint_base;
+		snake_ranges.emplace_back(range);
+	}
 
-			{ // Draw joint
-				glm::mat4 local_to_world = make_matrix(body->front, glm::vec2(1.1f, 1.1f));
-				draw_joint(local_to_world);
+	//upload (re-specifying the whole buffer, so the driver doesn't have to wait on last frame's draws):
+	if (snake_instance_buffer == 0) {
+		glGenBuffers(1, &snake_instance_buffer);
+		glGenTextures(1, &snake_instance_texture);
+		glBindBuffer(GL_TEXTURE_BUFFER, snake_instance_buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, snake_instance_texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, snake_instance_buffer);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, snake_instance_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, snake_instances.size() * sizeof(glm::vec4), snake_instances.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, snake_instance_texture);
+
+	//(at most) two draws per snake, however long it is:
+	for (size_t i = 0; i < snakes.size(); ++i) {
+		SnakeObject const &object = snakes[i];
+		SnakeRange const &range = snake_ranges[i];
+
+		use_program(object.program);
+		//(per-program uniforms only need setting the first time each program comes up)
+		bool first = (i == 0 || object.program != snakes[i-1].program);
+		uint32_t &count = (first ? draw_stats.state_calls : draw_stats.calls_saved);
+		if (object.program_world_to_clip_mat4 != -1U) {
+			if (first) glUniformMatrix4fv(object.program_world_to_clip_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
+			count += 1;
+		}
+		if (object.program_instances_samplerBuffer != -1U) {
+			if (first) glUniform1i(object.program_instances_samplerBuffer, 0);
+			count += 1;
+		}
+		bind_vertex_array(object.vao);
+
+		if (range.segment_count > 0) {
+			if (object.program_instance_base_int != -1U) {
+				glUniform1i(object.program_instance_base_int, range.segment_base);
 			}
+			glDrawArraysInstanced(GL_TRIANGLES, object.start, object.count, range.segment_count);
+			draw_stats.draws += 1;
+		}
 
-			if (body == object.snake->tail) {
-				glm::mat4 local_to_world = make_matrix(body->front - (body->dir_vec() * body->length), glm::vec2(1.1f, 1.1f));
-				draw_joint(local_to_world);
+		if (range.joint_count > 0) {
+			if (object.program_instance_base_int != -1U) {
+				glUniform1i(object.program_instance_base_int, range.joint_base);
 			}
+			glDrawArraysInstanced(GL_TRIANGLES, object.joint_start, object.joint_count, range.joint_count);
+			draw_stats.draws += 1;
 		}
 	}
-}
 
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
 
 Scene::~Scene() {
+	if (uniform_buffer) glDeleteBuffers(1, &uniform_buffer);
+	if (snake_instance_buffer) glDeleteBuffers(1, &snake_instance_buffer);
+	if (snake_instance_texture) glDeleteTextures(1, &snake_instance_texture);
 	while (first_camera) {
 		delete_camera(first_camera);
 	}
@@ -382,9 +565,9 @@ void Scene::load(std::string const &filename,
 				throw std::runtime_error("scene file '" + filename + "' contains hierarchy entry with invalid name indices");
 		}
 
-		t->position = h.position;
-		t->rotation = h.rotation;
-		t->scale = h.scale;
+		t->set_position(h.position);
+		t->set_rotation(h.rotation);
+		t->set_scale(h.scale);
 
 		hierarchy_transforms.emplace_back(t);
 	}
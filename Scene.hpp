@@ -3,6 +3,9 @@
 #include "GL.hpp"
 
 #include "Snake.hpp"
+#include "FlatScene.hpp"
+#include "uniform_blocks.hpp"
+#include "Frustum.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -23,6 +26,12 @@ struct Scene {
 		glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
 		glm::quat rotation = glm::quat(0.0f, 0.0f, 0.0f, 1.0f);
 		glm::vec3 scale = glm::vec3(1.0f, 1.0f, 1.0f);
+		//NOTE: change these with the setters below (or call mark_dirty() after writing them directly),
+		// so that cached matrices for this transform and everything under it get rebuilt:
+		void set_position(glm::vec3 const &position_) { position = position_; mark_dirty(); }
+		void set_rotation(glm::quat const &rotation_) { rotation = rotation_; mark_dirty(); }
+		void set_scale(glm::vec3 const &scale_) { scale = scale_; mark_dirty(); }
+		void mark_dirty();
 
 		//hierarchy information:
 		Transform *parent = nullptr;
@@ -40,8 +49,9 @@ struct Scene {
 		//computed from the above:
 		glm::mat4 make_local_to_parent() const;
 		glm::mat4 make_parent_to_local() const;
-		glm::mat4 make_local_to_world() const;
-		glm::mat4 make_world_to_local() const;
+		//(cached; rebuilt only when this transform or an ancestor has changed since the last call)
+		glm::mat4 const &make_local_to_world() const;
+		glm::mat4 const &make_world_to_local() const;
 
 		//constructor/destructor:
 		Transform() = default;
@@ -58,6 +68,12 @@ struct Scene {
 		//used by Scene to manage allocation:
 		Transform **alloc_prev_next = nullptr;
 		Transform *alloc_next = nullptr;
+
+		//cached matrices (a dirty transform's descendants are always dirty too):
+		mutable glm::mat4 local_to_world = glm::mat4(1.0f);
+		mutable glm::mat4 world_to_local = glm::mat4(1.0f);
+		mutable bool local_to_world_dirty = true;
+		mutable bool world_to_local_dirty = true;
 	};
 
 	//"Object"s contain information needed to render meshes:
@@ -67,7 +83,7 @@ struct Scene {
 			assert(transform);
 		}
 
-		//program info:
+		//program info (programs with an 'Object' uniform block get these matrices from that instead, see uniform_blocks.hpp):
 		GLuint program = 0;
 		GLuint program_mvp_mat4 = -1U; //uniform index for object-to-clip matrix (mat4)
 		GLuint program_mv_mat4x3 = -1U; //uniform index for model-to-lighting-space matrix (mat4x3)
@@ -75,12 +91,19 @@ struct Scene {
 
 		//material info:
 		std::function< void() > set_uniforms; //will be called before rendering object, use to set material parameters (e.g. glossiness)
+		uint32_t material = 0; //objects with the same (nonzero) material and program promise identical set_uniforms; it is called once per run of them
 
 		//attribute info:
 		GLuint vao = 0;
 		GLuint start = 0;
 		GLuint count = 0;
 
+		//bounding box in local space (e.g. from MeshBuffer::Mesh) for view-frustum culling;
+		// objects without one are always drawn:
+		bool has_bounds = false;
+		glm::vec3 bounds_min = glm::vec3(0.0f);
+		glm::vec3 bounds_max = glm::vec3(0.0f);
+
 		//used by Scene to manage allocation:
 		Object **alloc_prev_next = nullptr;
 		Object *alloc_next = nullptr;
@@ -106,16 +129,18 @@ struct Scene {
 		Camera *alloc_next = nullptr;
 	};
 
+	//"SnakeObject"s draw all of a snake's body segments with one instanced draw call, and
+	// all of its joints with another (see snake_program.hpp):
 	struct SnakeObject {
 		SnakeObject(Snake *);
 
 		Snake * snake; // The snake the object represents
 
-		//program info:
+		//program info (an instanced program, like SnakeProgram):
 		GLuint program = 0;
-		GLuint program_mvp_mat4 = -1U; //uniform index for object-to-clip matrix (mat4)
-		GLuint program_mv_mat4x3 = -1U; //uniform index for model-to-lighting-space matrix (mat4x3)
-		GLuint program_itmv_mat3 = -1U; //uniform index for normal-to-lighting-space matrix (mat3)
+		GLuint program_world_to_clip_mat4 = -1U; //uniform index for world-to-clip matrix (mat4)
+		GLuint program_instances_samplerBuffer = -1U; //uniform index for the per-instance transforms (samplerBuffer)
+		GLuint program_instance_base_int = -1U; //uniform index for the first instance's transform index (int)
 
 		//attribute info:
 		GLuint vao = 0;
@@ -123,6 +148,12 @@ struct Scene {
 		GLuint count = 0;
 		GLuint joint_start = 0;
 		GLuint joint_count = 0;
+
+		//bounding boxes of the segment and joint meshes (in mesh space), for culling segments
+		// and joints one by one; without them, the whole snake is always drawn:
+		bool has_bounds = false;
+		glm::vec3 segment_min = glm::vec3(0.0f), segment_max = glm::vec3(0.0f);
+		glm::vec3 joint_min = glm::vec3(0.0f), joint_max = glm::vec3(0.0f);
 	};
 
 	//------ functions to create / destroy scene things -----
@@ -154,11 +185,77 @@ struct Scene {
 	// List of snakes to be rendered
 	std::vector<SnakeObject> snakes;
 
+	//every snake segment's and joint's local-to-world transform, rebuilt each draw;
+	// three texels (the rows of a mat4x3) per instance, uploaded to a buffer texture:
+	std::vector< glm::vec4 > snake_instances;
+	//where each snake's segment and joint instances are in snake_instances (also rebuilt each draw):
+	struct SnakeRange {
+		GLint segment_base = 0, joint_base = 0;
+		GLsizei segment_count = 0, joint_count = 0;
+	};
+	std::vector< SnakeRange > snake_ranges;
+	GLuint snake_instance_buffer = 0;
+	GLuint snake_instance_texture = 0;
+
+	//transforms and objects in flat (structure-of-arrays) storage, for big scenes; drawn along with the above:
+	FlatScene flat;
+
+	//"RenderItem"s are what draw() actually submits: every Object and flat object, each frame,
+	// sorted by program, then vertex array, then material, so that objects sharing state are
+	// drawn together and the state is only set when it changes. (So objects are not drawn
+	// in creation order.)
+	struct RenderItem {
+		GLuint program;
+		GLuint vao;
+		uint32_t material;
+		GLuint program_mvp_mat4, program_mv_mat4x3, program_itmv_mat3;
+		std::function< void() > const *set_uniforms;
+		GLuint start, count;
+		glm::mat4 const *local_to_world;
+	};
+	std::vector< RenderItem > render_queue; //(rebuilt every draw)
+
+	//what the last draw() sent to OpenGL, and the state changes it skipped because they were redundant:
+	struct DrawStats {
+		uint32_t draws = 0; //glDraw* calls
+		uint32_t state_calls = 0; //glUseProgram, glBindVertexArray, set_uniforms, and per-program uniform calls made
+		uint32_t calls_saved = 0; //ones skipped (compared to setting everything for every draw)
+		uint32_t culled = 0; //objects, snake segments, and joints not drawn because they were out of view
+	} draw_stats;
+
+	//cull objects against the view frustum through a BoxBVH (rebuilt every draw) instead of
+	// one at a time -- worth it for big scenes with much of the scene out of view:
+	bool cull_with_bvh = false;
+	//(scratch space for culling)
+	BoxBVH cull_bvh;
+	std::vector< RenderItem > cull_items;
+	std::vector< glm::vec3 > cull_mins, cull_maxs;
+	std::vector< uint32_t > cull_visible;
+
+	//lights etc. for the 'Frame' uniform block; set before calling draw():
+	FrameUniforms frame_uniforms;
+
+	//draw() writes frame_uniforms and then every render item's ObjectUniforms into this buffer
+	// (re-specified each frame, so the driver can hand back fresh memory instead of waiting
+	// on last frame's draws), then binds ranges of it:
+	GLuint uniform_buffer = 0;
+	GLint uniform_buffer_alignment = 0; //GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	std::vector< char > uniform_data;
+
+	//state set by the draw in progress (-1U: unknown -- anything else may have changed it since the last frame):
+	GLuint bound_program = -1U;
+	GLuint bound_vao = -1U;
+
 	//------ functions to traverse the scene ------
 
 	//Draw the scene from a given camera by computing appropriate matrices and sending all objects to OpenGL:
 	//"camera" must be non-null!
-	void draw(Camera const *camera) const;
+	//(also brings flat.transforms' world matrices up to date)
+	void draw(Camera const *camera);
+	//(helpers for draw; use_program returns true if the program actually changed)
+	void draw_snakes(glm::mat4 const &world_to_clip, Frustum const &frustum);
+	bool use_program(GLuint program);
+	void bind_vertex_array(GLuint vao);
 
 	~Scene(); //destructor deallocates transforms, objects, cameras
 
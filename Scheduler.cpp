@@ -0,0 +1,107 @@
+#include "Scheduler.hpp"
+
+#include <thread>
+#include <system_error>
+#include <stdexcept>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+
+#ifdef __linux__
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+namespace {
+//a task more than this many periods behind skips ahead instead of running back-to-back:
+const int MaxBehind = 5;
+}
+
+Scheduler::Scheduler() {
+	#ifdef __linux__
+	//(std::chrono::steady_clock is CLOCK_MONOTONIC on linux, so deadlines convert directly)
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		throw std::system_error(errno, std::system_category(), "failed to create scheduler timerfd");
+	}
+	#endif
+}
+
+Scheduler::~Scheduler() {
+	#ifdef __linux__
+	if (timer_fd >= 0) close(timer_fd);
+	#endif
+}
+
+uint32_t Scheduler::add(std::string const &name, double hz) {
+	if (!(hz > 0.0)) throw std::runtime_error("Rate for '" + name + "' must be positive.");
+	if (tasks.size() >= 32) throw std::runtime_error("Scheduler only handles 32 tasks.");
+
+	Task task;
+	task.name = name;
+	task.period = std::max< Clock::duration >(Clock::duration(1),
+		std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(1.0 / hz)));
+	task.next = Clock::now() + task.period;
+	tasks.emplace_back(task);
+	return uint32_t(1) << (tasks.size() - 1);
+}
+
+uint32_t Scheduler::wait() {
+	assert(!tasks.empty());
+
+	Clock::time_point earliest = tasks[0].next;
+	for (Task const &task : tasks) {
+		earliest = std::min(earliest, task.next);
+	}
+	sleep_until(earliest);
+
+	Clock::time_point now = Clock::now();
+	uint32_t due = 0;
+	for (size_t i = 0; i < tasks.size(); ++i) {
+		Task &task = tasks[i];
+		if (task.next > now) continue;
+		due |= uint32_t(1) << i;
+		task.runs += 1;
+		task.late = std::chrono::duration< double >(now - task.next).count();
+		task.late_max = std::max(task.late_max, task.late);
+
+		task.next += task.period;
+		if (now > task.next + MaxBehind * task.period) {
+			//far behind (e.g. machine was suspended); don't try to catch up in a burst:
+			Clock::time_point resume = now + task.period;
+			task.skipped += uint64_t((resume - task.next) / task.period);
+			task.next = resume;
+		}
+	}
+	return due;
+}
+
+void Scheduler::reset_stats() {
+	for (Task &task : tasks) {
+		task.runs = 0;
+		task.skipped = 0;
+		task.late_max = 0.0;
+	}
+}
+
+void Scheduler::sleep_until(Clock::time_point when) {
+	#ifdef __linux__
+	auto since_epoch = std::chrono::duration_cast< std::chrono::nanoseconds >(when.time_since_epoch()).count();
+	if (since_epoch <= 0) return;
+
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = 0;
+	spec.it_interval.tv_nsec = 0;
+	spec.it_value.tv_sec = time_t(since_epoch / 1000000000);
+	spec.it_value.tv_nsec = long(since_epoch % 1000000000);
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) != 0) {
+		throw std::system_error(errno, std::system_category(), "failed to arm scheduler timerfd");
+	}
+
+	//(a deadline already in the past fires right away)
+	uint64_t expirations;
+	while (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR) { }
+	#else
+	std::this_thread::sleep_until(when);
+	#endif
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//Scheduler keeps several periodic deadlines (each at its own rate) and sleeps until the
+// next one is due. Deadlines are absolute, so a late wake-up doesn't push back the ones
+// after it; a task that falls far behind skips ahead instead of catching up in a burst.
+//
+//For example:
+//	Scheduler scheduler;
+//	uint32_t const Step = scheduler.add("step", 60.0);
+//	uint32_t const Snapshot = scheduler.add("snapshot", 5.0);
+//	while (true) {
+//		uint32_t due = scheduler.wait();
+//		if (due & Step) ...
+//		if (due & Snapshot) ...
+//	}
+//
+//On linux the sleep is a blocking read() of a timerfd armed for the earliest deadline
+// (so it is as precise as the kernel's high-resolution timers allow); elsewhere it is
+// std::this_thread::sleep_until.
+
+struct Scheduler {
+	typedef std::chrono::steady_clock Clock;
+
+	Scheduler();
+	~Scheduler();
+	Scheduler(Scheduler const &) = delete;
+
+	//add a task due 'hz' times per second (first one period from now); returns its bit in wait()'s result:
+	uint32_t add(std::string const &name, double hz);
+
+	//sleep until some task is due; returns the bits of every task that is due now:
+	uint32_t wait();
+
+	struct Task {
+		std::string name;
+		Clock::duration period;
+		Clock::time_point next; //upcoming deadline
+		double late = 0.0; //how late the latest wait() that returned this task was (seconds)
+		//stats, since the last reset_stats():
+		uint64_t runs = 0;
+		uint64_t skipped = 0; //deadlines dropped after falling far behind
+		double late_max = 0.0; //latest a wait() returned after this task's deadline (seconds)
+	};
+	std::vector< Task > tasks;
+
+	void reset_stats();
+
+	//internals:
+	int timer_fd = -1; //(linux)
+	void sleep_until(Clock::time_point when);
+};
@@ -0,0 +1,91 @@
+#include "SegmentBatch.hpp"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SEGMENT_BATCH_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SEGMENT_BATCH_SSE2 1
+#endif
+
+//All versions compute the squared distance from p to the closest point on each segment
+// front->back the same way (as in Snake.cpp's minimum_distance_2):
+//	d = back - front, q = p - front
+//	t = clamp(dot(q, d) / dot(d, d), 0, 1)   (0 if the segment is a point)
+//	distance^2 = |q - t * d|^2
+
+bool SegmentBatch::any_within_scalar(glm::vec2 pt, float radius) const {
+	float r2 = radius * radius;
+	for (size_t i = 0; i < count; ++i) {
+		float dx = back_x[i] - front_x[i];
+		float dy = back_y[i] - front_y[i];
+		float qx = pt.x - front_x[i];
+		float qy = pt.y - front_y[i];
+		float l2 = dx * dx + dy * dy;
+		float t = (qx * dx + qy * dy) / std::max(l2, FLT_MIN);
+		t = std::min(std::max(t, 0.f), 1.f);
+		float ex = qx - t * dx;
+		float ey = qy - t * dy;
+		if (ex * ex + ey * ey <= r2) return true;
+	}
+	return false;
+}
+
+bool SegmentBatch::any_within(glm::vec2 pt, float radius) const {
+	if (count == 0) return false;
+	//(lanes past 'count' hold stale data, so their results are masked off)
+	int live = (1 << count) - 1;
+
+	#if defined(SEGMENT_BATCH_AVX)
+	static_assert(Capacity == 8, "AVX kernel tests exactly eight segments");
+	__m256 px = _mm256_set1_ps(pt.x);
+	__m256 py = _mm256_set1_ps(pt.y);
+	__m256 fx = _mm256_loadu_ps(front_x);
+	__m256 fy = _mm256_loadu_ps(front_y);
+	__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(back_x), fx);
+	__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(back_y), fy);
+	__m256 qx = _mm256_sub_ps(px, fx);
+	__m256 qy = _mm256_sub_ps(py, fy);
+	__m256 l2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+	__m256 t = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(qx, dx), _mm256_mul_ps(qy, dy)), _mm256_max_ps(l2, _mm256_set1_ps(FLT_MIN)));
+	t = _mm256_min_ps(_mm256_max_ps(t, _mm256_setzero_ps()), _mm256_set1_ps(1.f));
+	__m256 ex = _mm256_sub_ps(qx, _mm256_mul_ps(t, dx));
+	__m256 ey = _mm256_sub_ps(qy, _mm256_mul_ps(t, dy));
+	__m256 d2 = _mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey));
+	int hits = _mm256_movemask_ps(_mm256_cmp_ps(d2, _mm256_set1_ps(radius * radius), _CMP_LE_OQ));
+	return (hits & live) != 0;
+
+	#elif defined(SEGMENT_BATCH_SSE2)
+	static_assert(Capacity % 4 == 0, "SSE2 kernel tests four segments at a time");
+	__m128 px = _mm_set1_ps(pt.x);
+	__m128 py = _mm_set1_ps(pt.y);
+	__m128 r2 = _mm_set1_ps(radius * radius);
+	__m128 min_l2 = _mm_set1_ps(FLT_MIN);
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.f);
+	for (size_t i = 0; i < count; i += 4) {
+		__m128 fx = _mm_loadu_ps(front_x + i);
+		__m128 fy = _mm_loadu_ps(front_y + i);
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(back_x + i), fx);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(back_y + i), fy);
+		__m128 qx = _mm_sub_ps(px, fx);
+		__m128 qy = _mm_sub_ps(py, fy);
+		__m128 l2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+		__m128 t = _mm_div_ps(_mm_add_ps(_mm_mul_ps(qx, dx), _mm_mul_ps(qy, dy)), _mm_max_ps(l2, min_l2));
+		t = _mm_min_ps(_mm_max_ps(t, zero), one);
+		__m128 ex = _mm_sub_ps(qx, _mm_mul_ps(t, dx));
+		__m128 ey = _mm_sub_ps(qy, _mm_mul_ps(t, dy));
+		__m128 d2 = _mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey));
+		int hits = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+		if (hits & (live >> i)) return true;
+	}
+	return false;
+
+	#else
+	(void)live;
+	return any_within_scalar(pt, radius);
+	#endif
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+//SegmentBatch gathers body segments (front and back points) into separate arrays of
+// x's and y's, so one point can be tested against a whole batch with SIMD instructions:
+// eight segments at a time with AVX, or two steps of four with SSE2 (the default on x86-64).
+// Other platforms use the scalar version.
+struct SegmentBatch {
+	static const size_t Capacity = 8;
+
+	alignas(32) float front_x[Capacity] = {};
+	alignas(32) float front_y[Capacity] = {};
+	alignas(32) float back_x[Capacity] = {};
+	alignas(32) float back_y[Capacity] = {};
+	size_t count = 0;
+
+	bool full() const { return count == Capacity; }
+	void clear() { count = 0; }
+	void add(glm::vec2 front, glm::vec2 back) {
+		front_x[count] = front.x;
+		front_y[count] = front.y;
+		back_x[count] = back.x;
+		back_y[count] = back.y;
+		++count;
+	}
+
+	//is 'pt' within 'radius' of any segment in the batch?
+	bool any_within(glm::vec2 pt, float radius) const;
+	//same, one segment at a time (the fallback; also for comparison):
+	bool any_within_scalar(glm::vec2 pt, float radius) const;
+};
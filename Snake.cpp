@@ -1,4 +1,6 @@
 #include "Snake.hpp"
+#include "SpatialGrid.hpp"
+#include "SegmentBatch.hpp"
 
 #include <stdio.h>
 #include <glm/gtc/quaternion.hpp>
@@ -67,20 +69,44 @@ bool Snake::BodySegment::collides_with(vec2 pt, float radius) {
     return dist2 <= comb_radius * comb_radius;
 }
 
+Snake::BodySegment * Snake::SegmentPool::allocate(vec2 pos, int dir, int id) {
+    if (free_first == nullptr) {
+        // Out of segments; add a block and put all of it on the free list (in address order)
+        blocks.emplace_back(size_t(BlockSize), BodySegment(vec2(), 0, 0));
+        for (BodySegment &seg : blocks.back()) {
+            release(&seg);
+        }
+    }
+    BodySegment * seg = free_first;
+    free_first = seg->next;
+    if (free_first == nullptr) {
+        free_last = nullptr;
+    }
+    *seg = BodySegment(pos, dir, id);
+    return seg;
+}
+
+void Snake::SegmentPool::release(BodySegment * seg) {
+    seg->next = nullptr;
+    seg->prev = nullptr;
+    if (free_last != nullptr) {
+        free_last->next = seg;
+    } else {
+        free_first = seg;
+    }
+    free_last = seg;
+}
+
 Snake::Snake(vec2 pos, float length, int dir) {
-    head = new BodySegment(pos, dir, 0);
+    head = pool.allocate(pos, dir, 0);
     head->length = length;
     tail = head;
     this->dir = dir;
 }
 
 Snake::~Snake() {
-    while(tail != head) {
-        BodySegment * next = tail->next;
-        delete tail;
-        tail = next;
-    }
-    delete head;
+    set_grid(nullptr);
+    // (segments go away with the pool)
 }
 
 void Snake::update(float elapsed) {
@@ -88,6 +114,9 @@ void Snake::update(float elapsed) {
     float dist = speed * elapsed;
     head->front += dir_to_vec[dir] * dist;
     head->length += dist;
+    if (grid) {
+        grid->update(this, head);
+    }
 
     // Now, update tail
     extra_length -= dist;
@@ -101,9 +130,13 @@ void Snake::update(float elapsed) {
             } else {
                 BodySegment * next = tail->next;
                 dist -= tail->length;
-                delete tail;
+                if (grid) {
+                    grid->remove(tail);
+                }
+                pool.release(tail);
                 tail = next;
                 next->prev = nullptr;
+                segment_count--;
 
             }
         }
@@ -111,11 +144,15 @@ void Snake::update(float elapsed) {
 }
 
 void Snake::change_dir(int new_dir) {
-    BodySegment * new_seg = new BodySegment(head->front, new_dir, head->id + 1);
+    BodySegment * new_seg = pool.allocate(head->front, new_dir, head->id + 1);
 
     new_seg->prev = head;
     head->next = new_seg;
     head = new_seg;
+    segment_count++;
+    if (grid) {
+        grid->update(this, new_seg);
+    }
 
     this->dir = new_dir;
 }
@@ -135,29 +172,94 @@ vec2 Snake::revert_and_change(vec2 target_pos, int new_dir, float max_backtrack)
     change_dir(new_dir);
     head->front += dist * dir_to_vec[new_dir];
     head->length = dist;
+    if (grid) {
+        grid->update(this, head);
+    }
 
     // Return turn point
     return ret;
 }
 
+namespace {
+
+// Collision checks gather candidate segments and test the head against a batch at a
+// time (same test as BodySegment::collides_with, see SegmentBatch.hpp)
+struct HeadTest {
+    vec2 pt;
+    SegmentBatch batch;
+
+    HeadTest(vec2 pt_) : pt(pt_) { }
+
+    // Returns true once a hit is found
+    bool add(Snake::BodySegment *seg) {
+        batch.add(seg->front, seg->front - dir_to_vec[seg->dir] * seg->length);
+        if (!batch.full()) {
+            return false;
+        }
+        bool hit = batch.any_within(pt, 2.f * SNAKE_RADIUS);
+        batch.clear();
+        return hit;
+    }
+    bool finish() {
+        return batch.any_within(pt, 2.f * SNAKE_RADIUS);
+    }
+};
+
+} // namespace
+
 bool Snake::collision_with_self() {
     if (head->prev != nullptr && head->prev->prev != nullptr) {
+        HeadTest test(head->front);
+        if (grid) {
+            // Same segments as below: everything older than head->prev->prev (ids increase toward the head)
+            int newest = head->prev->prev->id;
+            if (grid->any_near(test.pt, 2.f * SNAKE_RADIUS, [this, newest, &test](SpatialGrid::Entry const &entry) {
+                return entry.snake == this && entry.seg->id < newest && test.add(entry.seg);
+            })) {
+                return true;
+            }
+            return test.finish();
+        }
         for(BodySegment *seg = head->prev->prev->prev; seg != nullptr; seg = seg->prev) {
-            if (seg->collides_with(head->front, SNAKE_RADIUS)) {
+            if (test.add(seg)) {
                 return true;
             }
         }
+        return test.finish();
     }
     return false;
 }
 
 bool Snake::collision_with_other(Snake *other) {
+    HeadTest test(head->front);
+    if (grid && other->grid == grid) {
+        if (grid->any_near(test.pt, 2.f * SNAKE_RADIUS, [other, &test](SpatialGrid::Entry const &entry) {
+            return entry.snake == other && test.add(entry.seg);
+        })) {
+            return true;
+        }
+        return test.finish();
+    }
     for(BodySegment *seg = other->tail; seg != nullptr; seg = seg->next) {
-        if (seg->collides_with(head->front, SNAKE_RADIUS)) {
+        if (test.add(seg)) {
             return true;
         }
     }
-    return false;
+    return test.finish();
+}
+
+void Snake::set_grid(SpatialGrid *new_grid) {
+    if (grid) {
+        for (BodySegment *seg = tail; seg != nullptr; seg = seg->next) {
+            grid->remove(seg);
+        }
+    }
+    grid = new_grid;
+    if (grid) {
+        for (BodySegment *seg = tail; seg != nullptr; seg = seg->next) {
+            grid->update(this, seg);
+        }
+    }
 }
 
 // Network functions
@@ -165,13 +267,9 @@ bool Snake::collision_with_other(Snake *other) {
 int Snake::serial_length() {
     // Each segment has direction, length, id, and front point
     int body_size = 1 + sizeof(int) + sizeof(float) + sizeof(float) + sizeof(float);
-    int body_length = 1;
-    for(BodySegment * node = tail; node != head; node = node->next) {
-        body_length++;
-    }
 
     // All the bodies, 1 for direction, float for extra_length, and int for this number itself
-    return body_size * body_length + 1 + sizeof(float) + sizeof(int);
+    return body_size * segment_count + 1 + sizeof(float) + sizeof(int);
 }
 
 int Snake::serialize(void *target_buf) {
@@ -209,8 +307,8 @@ int Snake::serialize(void *target_buf) {
     return serial_size;
 }
 
-int Snake::deserialize(void *buf) {
-    char *old_buf = (char *) buf;
+int Snake::deserialize(void const *buf) {
+    char const *old_buf = (char const *) buf;
 
     int offset = 0;
     auto recv_data = [&offset, old_buf](void *data, int size) {
@@ -231,51 +329,207 @@ int Snake::deserialize(void *buf) {
     // Get extra_length
     recv_data(&this->extra_length, sizeof(float));
 
-    int id;
-
-    // Get all segments, stop if exceding size (as server may not have all bodyparts we have)
+    // Get all segments (the server may not have all bodyparts we have, e.g. a turn we just made)
     // May have more/less bodyparts on server, in which case update to those body parts
-    for(BodySegment *seg = this->tail; offset < size; seg = seg->next) {
+    BodySegment *old_head = head;
+    int tail_id = -1;
+    while (offset < size) {
+        int id;
         recv_data(&id, sizeof(int));
-        // check if directions line up
-        if (seg->id - id > 0) {
-            // New node the server has that we don't
-            BodySegment * next = seg;
-            seg = new BodySegment(vec2(), 0, id);
-            seg->next = next;
-            seg->prev = next->prev;
-            if (next->prev != nullptr) {
-                next->prev->next = seg;
-            } else {
-                this->tail = seg;
-            }
-            next->prev = seg;
-
-        } else {
-            while (seg->id - id < 0) {
-                // our segment is extra
-                if (seg->prev != nullptr) {
-                    seg->prev->next = seg->next;
-                } else {
-                    this->tail = seg->next;
-                }
-                seg->next->prev = seg->prev;
-                seg = seg->next;
-                delete seg->prev;
-            }
+        if (tail_id < 0) {
+            tail_id = id;
         }
+        BodySegment *seg = segment_for_id(id);
 
         recv_data(&dir, 1);
         seg->dir = dir;
         recv_data(&seg->front.x, sizeof(float));
         recv_data(&seg->front.y, sizeof(float));
         recv_data(&seg->length, sizeof(float));
-
-        (void)offset; // To shut the compiler up about modifying offset in the loop
+        if (grid) {
+            grid->update(this, seg);
+        }
+    }
+    // Segments older than the server's tail are gone (trimmed last, since the
+    // server's tail may be newer than everything we had)
+    if (tail_id >= 0) {
+        trim_tail(tail_id);
+    }
+    if (head != old_head) {
+        this->dir = head->dir;
     }
 
     //std::cout << "HEAD: " << this->head->id << ", SHOULD BE: " << id << std::endl;
 
+    assert(offset == size);
+    return size;
+}
+
+void Snake::trim_tail(int id) {
+    while (tail != head && tail->id < id) {
+        BodySegment * next = tail->next;
+        if (grid) {
+            grid->remove(tail);
+        }
+        pool.release(tail);
+        tail = next;
+        tail->prev = nullptr;
+        segment_count--;
+    }
+}
+
+void Snake::trim_head(int id) {
+    bool trimmed = false;
+    while (head != tail && head->id > id) {
+        BodySegment * prev = head->prev;
+        if (grid) {
+            grid->remove(head);
+        }
+        pool.release(head);
+        head = prev;
+        head->next = nullptr;
+        segment_count--;
+        trimmed = true;
+    }
+    if (trimmed) {
+        this->dir = head->dir;
+    }
+}
+
+Snake::BodySegment *Snake::segment_for_id(int id) {
+    // Received segments are usually near the head, so search backwards from there
+    BodySegment *seg = head;
+    while (seg != nullptr && seg->id > id) {
+        seg = seg->prev;
+    }
+    if (seg != nullptr && seg->id == id) {
+        return seg;
+    }
+
+    // New segment the server has that we don't; goes right after 'seg'
+    BodySegment *added = pool.allocate(vec2(), 0, id);
+    segment_count++;
+    added->prev = seg;
+    added->next = (seg != nullptr ? seg->next : tail);
+    if (added->prev != nullptr) {
+        added->prev->next = added;
+    } else {
+        tail = added;
+    }
+    if (added->next != nullptr) {
+        added->next->prev = added;
+    } else {
+        // A turn we haven't heard about yet (callers follow the new head's direction)
+        head = added;
+    }
+    return added;
+}
+
+// Delta functions
+
+// id, direction, front point, length
+static const int SegmentSerialSize = sizeof(int) + 1 + sizeof(float) + sizeof(float) + sizeof(float);
+
+int Snake::delta_length(int base_head) {
+    int segments = 0;
+    for(BodySegment * node = head; node != nullptr && node->id >= base_head; node = node->prev) {
+        segments++;
+    }
+
+    // size, direction, extra_length, tail id, tail length, then the segments
+    return sizeof(int) + 1 + sizeof(float) + sizeof(int) + sizeof(float) + segments * SegmentSerialSize;
+}
+
+int Snake::serialize_delta(int base_head, void *target_buf) {
+    char *buf = (char *)target_buf;
+    int serial_size = delta_length(base_head);
+
+    int offset = 0;
+    auto send_data = [&offset, buf](void const *data, int size) {
+        memcpy(buf + offset, data, size);
+        offset += size;
+    };
+
+    send_data(&serial_size, sizeof(int));
+
+    char dir = (char) this->dir;
+    send_data(&dir, 1);
+
+    send_data(&this->extra_length, sizeof(float));
+
+    // Tail trim
+    send_data(&tail->id, sizeof(int));
+    send_data(&tail->length, sizeof(float));
+
+    // Segments changed or added since the baseline, oldest first
+    BodySegment *first = head;
+    while (first->prev != nullptr && first->prev->id >= base_head) {
+        first = first->prev;
+    }
+    for (BodySegment *seg = first; seg != nullptr; seg = seg->next) {
+        send_data(&seg->id, sizeof(int));
+
+        dir = (char)seg->dir;
+        send_data(&dir, 1);
+
+        send_data(&seg->front.x, sizeof(float));
+        send_data(&seg->front.y, sizeof(float));
+        send_data(&seg->length, sizeof(float));
+    }
+
+    assert(offset == serial_size);
+    return serial_size;
+}
+
+int Snake::deserialize_delta(void const *buf) {
+    char const *old_buf = (char const *) buf;
+
+    int offset = 0;
+    auto recv_data = [&offset, old_buf](void *data, int size) {
+        memcpy(data, old_buf + offset, size);
+        offset += size;
+    };
+
+    int size;
+    recv_data(&size, sizeof(int));
+
+    // Direction isn't updated because our info is correct (same as a full sync)
+    char dir;
+    recv_data(&dir, 1);
+
+    recv_data(&this->extra_length, sizeof(float));
+
+    int tail_id;
+    float tail_length;
+    recv_data(&tail_id, sizeof(int));
+    recv_data(&tail_length, sizeof(float));
+
+    BodySegment *old_head = head;
+    while (offset < size) {
+        int id;
+        recv_data(&id, sizeof(int));
+        BodySegment *seg = segment_for_id(id);
+
+        recv_data(&dir, 1);
+        seg->dir = dir;
+        recv_data(&seg->front.x, sizeof(float));
+        recv_data(&seg->front.y, sizeof(float));
+        recv_data(&seg->length, sizeof(float));
+        if (grid) {
+            grid->update(this, seg);
+        }
+    }
+
+    // Trim segments the server has already dropped (after adding new ones, in
+    // case the server's tail is one of them)
+    trim_tail(tail_id);
+    if (tail->id == tail_id) {
+        tail->length = tail_length;
+    }
+    if (head != old_head) {
+        this->dir = head->dir;
+    }
+
     assert(offset == size);
     return size;
 }
\ No newline at end of file
@@ -2,10 +2,14 @@
 
 #include <glm/glm.hpp>
 
+#include <vector>
+
 #include "Connection.hpp"
 
 using namespace glm;
 
+struct SpatialGrid;
+
 struct Snake {
 
     enum Direction {
@@ -26,14 +30,34 @@ struct Snake {
 
         int id;
 
+        // Cells this segment is listed in, if the snake uses a SpatialGrid (empty if lo > hi)
+        ivec2 grid_lo = ivec2(0);
+        ivec2 grid_hi = ivec2(-1);
 
         BodySegment(vec2 pos, int dir, int id);
         bool collides_with(vec2 pt, float radius);
         vec2 dir_vec();
     };
 
+    // Segments are allocated from a per-snake pool: blocks that are never moved or freed
+    // (so segment pointers stay valid), with released segments reused oldest-first. Since
+    // segments are created at the head and released at the tail, the body cycles through the
+    // blocks in order like a ring buffer, and turns don't allocate once the pool is big enough.
+    struct SegmentPool {
+        static const int BlockSize = 64;
+
+        BodySegment * allocate(vec2 pos, int dir, int id);
+        void release(BodySegment * seg);
+
+        std::vector< std::vector< BodySegment > > blocks;
+        BodySegment * free_first = nullptr; // free list, linked through 'next'
+        BodySegment * free_last = nullptr;
+    };
+    SegmentPool pool;
+
     BodySegment * head;
     BodySegment * tail;
+    int segment_count = 1; // kept up to date as segments are added and removed (for serial_length)
 
     float speed = 6.f;
     float extra_length = 0.f;
@@ -41,6 +65,8 @@ struct Snake {
 
     Snake(vec2 pos, float length, int dir);
     ~Snake();
+    Snake(Snake const &) = delete; // (segments point into this snake's own pool)
+    Snake & operator=(Snake const &) = delete;
 
     void update(float elapsed);
     void change_dir(int new_dir);
@@ -51,10 +77,27 @@ struct Snake {
     bool collision_with_self();
     bool collision_with_other(Snake *);
 
+    // If set, segments are indexed in 'grid' as they change and collision checks only look
+    // at nearby cells (otherwise they walk every segment)
+    SpatialGrid * grid = nullptr;
+    void set_grid(SpatialGrid * grid); // (re)index every segment in 'grid' (nullptr to stop)
+
     bool dead = false;
 
     // Networking functions
     int serial_length();
     int serialize(void * target_buf);
-    int deserialize(void * buf);
+    int deserialize(void const * buf);
+
+    // Delta against a baseline the receiver already has, where 'base_head' was the head id:
+    // carries the tail trim, extra_length and every segment with id >= base_head
+    // (older segments never change once they stop being the head)
+    int delta_length(int base_head);
+    int serialize_delta(int base_head, void * target_buf);
+    int deserialize_delta(void const * buf);
+
+    // Helpers for deserializing
+    void trim_tail(int id); // drop segments older than 'id' (never the head)
+    void trim_head(int id); // drop segments newer than 'id' (never the tail)
+    BodySegment * segment_for_id(int id); // find segment 'id', inserting it in order if we don't have it
 };
\ No newline at end of file
@@ -1,9 +1,10 @@
 #include "Sound.hpp"
+#include "Log.hpp"
 
 #include <SDL.h>
 
 #include <algorithm>
-#include <iostream>
+#include <stdexcept>
 #include <list>
 #include <string>
 
@@ -186,12 +187,14 @@ void mix_audio(void *, Uint8 *stream, int len) {
 		}
 	}
 
-	//DEBUG: report output power:
-	float max_power = 0.0f;
-	for (uint32_t s = 0; s < MixSamples; ++s) {
-		max_power = std::max(max_power, (buffer[s].l * buffer[s].l + buffer[s].r * buffer[s].r));
+	//DEBUG: report output power (GAME_LOG=debug):
+	if (log_enabled(LogDebug)) {
+		float max_power = 0.0f;
+		for (uint32_t s = 0; s < MixSamples; ++s) {
+			max_power = std::max(max_power, (buffer[s].l * buffer[s].l + buffer[s].r * buffer[s].r));
+		}
+		log_debug("Max Power: {}", std::sqrt(max_power));
 	}
-	//std::cout << "Max Power: " << std::sqrt(max_power) << std::endl; //DEBUG
 
 };
 
@@ -215,7 +218,7 @@ Sample::Sample(std::string const &filename) {
 	SDL_AudioCVT cvt;
 	SDL_BuildAudioCVT(&cvt, have->format, have->channels, have->freq, AUDIO_F32SYS, 1, AudioRate);
 	if (cvt.needed) {
-		std::cout << "WAV file '" + filename + "' didn't load as " + std::to_string(AudioRate) + " Hz, float32, mono; converting." << std::endl;
+		log_info("WAV file '{}' didn't load as {} Hz, float32, mono; converting.", filename, AudioRate);
 		cvt.len = audio_len;
 		cvt.buf = (Uint8 *)SDL_malloc(cvt.len * cvt.len_mult);
 		SDL_memcpy(cvt.buf, audio_buf, audio_len);
@@ -233,7 +236,7 @@ Sample::Sample(std::string const &filename) {
 		min = std::min(min, d);
 		max = std::max(max, d);
 	}
-	std::cout << "Range: " << min << ", " << max << std::endl;
+	log_debug("Range: {}, {}", min, max);
 }
 
 std::shared_ptr< PlayingSample > Sample::play(glm::vec3 const &position, float volume, LoopOrOnce loop_or_once) const {
@@ -293,7 +296,7 @@ void Listener::set_right(glm::vec3 const &new_right, float ramp) {
 
 void init() {
 	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
-		std::cerr << "Failed to initialize SDL audio subsytem:\n" << SDL_GetError() << std::endl;
+		log_error("Failed to initialize SDL audio subsytem:\n{}", SDL_GetError());
 		return;
 	}
 
@@ -308,11 +311,11 @@ void init() {
 
 	device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
 	if (device == 0) {
-		std::cerr << "Failed to open audio device:\n" << SDL_GetError() << std::endl;
+		log_error("Failed to open audio device:\n{}", SDL_GetError());
 	} else {
 		//start audio playback:
 		SDL_PauseAudioDevice(device, 0);
-		std::cout << "Audio output initialized." << std::endl;
+		log_info("Audio output initialized.");
 	}
 }
 
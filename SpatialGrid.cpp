@@ -0,0 +1,68 @@
+#include "SpatialGrid.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+SpatialGrid::SpatialGrid(glm::vec2 half_extent, float cell_size_) : origin(-half_extent), cell_size(cell_size_) {
+	assert(cell_size > 0.f);
+	size = glm::ivec2(
+		std::max(1, int(std::ceil(2.f * half_extent.x / cell_size))),
+		std::max(1, int(std::ceil(2.f * half_extent.y / cell_size)))
+	);
+	cells.resize(size.x * size.y);
+}
+
+glm::ivec2 SpatialGrid::cell_of(glm::vec2 pt) const {
+	glm::vec2 at = (pt - origin) / cell_size;
+	//(clamp as floats first, so far-off or non-finite points don't overflow the int conversion)
+	return glm::ivec2(
+		int(std::max(0.f, std::min(float(size.x - 1), std::floor(at.x)))),
+		int(std::max(0.f, std::min(float(size.y - 1), std::floor(at.y))))
+	);
+}
+
+void SpatialGrid::update(Snake *snake, Snake::BodySegment *seg) {
+	glm::vec2 back = seg->front - seg->dir_vec() * seg->length;
+	glm::ivec2 a = cell_of(seg->front);
+	glm::ivec2 b = cell_of(back);
+	glm::ivec2 lo = glm::min(a, b);
+	glm::ivec2 hi = glm::max(a, b);
+
+	bool listed = (seg->grid_lo.x <= seg->grid_hi.x);
+	if (listed) {
+		//(usually the head growing by a fraction of a cell)
+		if (lo.x >= seg->grid_lo.x && lo.y >= seg->grid_lo.y && hi.x <= seg->grid_hi.x && hi.y <= seg->grid_hi.y) return;
+		lo = glm::min(lo, seg->grid_lo);
+		hi = glm::max(hi, seg->grid_hi);
+	}
+
+	Entry entry;
+	entry.snake = snake;
+	entry.seg = seg;
+	for (int y = lo.y; y <= hi.y; ++y) {
+		for (int x = lo.x; x <= hi.x; ++x) {
+			if (listed && x >= seg->grid_lo.x && x <= seg->grid_hi.x && y >= seg->grid_lo.y && y <= seg->grid_hi.y) continue;
+			cells[y * size.x + x].emplace_back(entry);
+		}
+	}
+	seg->grid_lo = lo;
+	seg->grid_hi = hi;
+}
+
+void SpatialGrid::remove(Snake::BodySegment *seg) {
+	for (int y = seg->grid_lo.y; y <= seg->grid_hi.y; ++y) {
+		for (int x = seg->grid_lo.x; x <= seg->grid_hi.x; ++x) {
+			std::vector< Entry > &cell = cells[y * size.x + x];
+			for (size_t i = 0; i < cell.size(); ++i) {
+				if (cell[i].seg == seg) {
+					cell[i] = cell.back();
+					cell.pop_back();
+					break;
+				}
+			}
+		}
+	}
+	seg->grid_lo = glm::ivec2(0);
+	seg->grid_hi = glm::ivec2(-1);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "Snake.hpp"
+
+//SpatialGrid is a uniform grid over the board that indexes every body segment by
+// the cells it passes through, so collision checks only look at segments near a
+// snake's head instead of walking every segment of every snake.
+//
+//Snakes keep it up to date as they change (see Snake::set_grid): a segment is added
+// when it is created, its cells are extended as it grows, and it is removed when it
+// is deleted. Cells a shrinking segment no longer covers aren't cleaned up until the
+// segment goes away; queries always test the segment's actual geometry, so a cell
+// list only needs to be a superset of what is really there.
+struct SpatialGrid {
+	//cover [-half_extent, half_extent] with square cells of size 'cell_size';
+	// anything outside is indexed in the nearest edge cell:
+	SpatialGrid(glm::vec2 half_extent, float cell_size);
+
+	struct Entry {
+		Snake *snake;
+		Snake::BodySegment *seg;
+	};
+
+	//make sure 'seg' is listed in every cell it currently covers:
+	void update(Snake *snake, Snake::BodySegment *seg);
+	//remove 'seg' from every cell it was listed in (call before deleting it):
+	void remove(Snake::BodySegment *seg);
+
+	//call f(entry) for each segment listed in a cell within 'radius' of 'pt'
+	// (a segment may come up more than once); stops early if f returns true:
+	template< typename F >
+	bool any_near(glm::vec2 pt, float radius, F const &f) const {
+		glm::ivec2 lo = cell_of(pt - glm::vec2(radius));
+		glm::ivec2 hi = cell_of(pt + glm::vec2(radius));
+		for (int y = lo.y; y <= hi.y; ++y) {
+			for (int x = lo.x; x <= hi.x; ++x) {
+				for (Entry const &entry : cells[y * size.x + x]) {
+					if (f(entry)) return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	glm::ivec2 cell_of(glm::vec2 pt) const;
+
+	glm::vec2 origin; //lower-left corner of cell (0,0)
+	float cell_size;
+	glm::ivec2 size; //cells along x and y
+	std::vector< std::vector< Entry > > cells; //row-major
+};
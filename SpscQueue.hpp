@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cassert>
+#include <cstddef>
+
+//SpscQueue is a bounded lock-free queue for handing values from exactly one
+// producer thread to exactly one consumer thread.
+// push() fails (returns false) when the queue is full; pop() fails when empty.
+
+template< typename T >
+struct SpscQueue {
+	//capacity is rounded up to a power of two:
+	explicit SpscQueue(size_t capacity = 1024) {
+		size_t size = 1;
+		while (size < capacity) size *= 2;
+		slots.resize(size);
+		mask = size - 1;
+	}
+	SpscQueue(SpscQueue const &) = delete;
+
+	//producer side:
+	bool push(T &&value) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head_cache == slots.size()) {
+			head_cache = head.load(std::memory_order_acquire);
+			if (t - head_cache == slots.size()) return false;
+		}
+		slots[t & mask] = std::move(value);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	//consumer side:
+	bool pop(T *value) {
+		assert(value);
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail_cache) {
+			tail_cache = tail.load(std::memory_order_acquire);
+			if (h == tail_cache) return false;
+		}
+		*value = std::move(slots[h & mask]);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	//approximate (exact if called from the producer or consumer while the other side is idle):
+	size_t size() const {
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+	//internals:
+	std::vector< T > slots;
+	size_t mask = 0;
+
+	//head/tail are padded onto separate cache lines so producer and consumer don't false-share:
+	char pad0[64];
+	std::atomic< size_t > head{0}; //next slot to pop (written by consumer)
+	size_t tail_cache = 0; //consumer's last view of tail
+	char pad1[64];
+	std::atomic< size_t > tail{0}; //next slot to push (written by producer)
+	size_t head_cache = 0; //producer's last view of head
+	char pad2[64];
+};
@@ -0,0 +1,470 @@
+#include "Udp.hpp"
+#include "Protocol.hpp"
+#include "NetSim.hpp"
+#include "Log.hpp"
+
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+#ifdef CONNECTION_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+namespace {
+
+const uint16_t Magic = 0x4e53; //"SN" on the wire
+enum PacketKind : uint8_t {
+	PacketData = 0,
+	PacketClose = 1,
+};
+const size_t HeaderSize = 2 + 1 + 4 + 4 + 4 + 4 + 2;
+
+struct Header {
+	uint16_t magic = Magic;
+	uint8_t kind = PacketData;
+	uint32_t seq = 0;
+	uint32_t ack = 0; //sender's reliable_expected
+	uint32_t reliable_total = 0; //sender's reliable_next when the packet was built
+	uint32_t reliable_first = 0; //id of the first reliable frame in this packet
+	uint16_t reliable_count = 0;
+
+	void write(char *to) const {
+		memcpy(to, &magic, 2); to += 2;
+		memcpy(to, &kind, 1); to += 1;
+		memcpy(to, &seq, 4); to += 4;
+		memcpy(to, &ack, 4); to += 4;
+		memcpy(to, &reliable_total, 4); to += 4;
+		memcpy(to, &reliable_first, 4); to += 4;
+		memcpy(to, &reliable_count, 2);
+	}
+	void read(char const *from) {
+		memcpy(&magic, from, 2); from += 2;
+		memcpy(&kind, from, 1); from += 1;
+		memcpy(&seq, from, 4); from += 4;
+		memcpy(&ack, from, 4); from += 4;
+		memcpy(&reliable_total, from, 4); from += 4;
+		memcpy(&reliable_first, from, 4); from += 4;
+		memcpy(&reliable_count, from, 2);
+	}
+};
+
+double now() {
+	return std::chrono::duration< double >(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//(test shim) fraction of outgoing packets to drop, from GAME_UDP_LOSS:
+bool drop_packet() {
+	static double loss = []() -> double {
+		char const *env = getenv("GAME_UDP_LOSS");
+		double l = (env ? atof(env) : 0.0);
+		if (l > 0.0) log_info("[udp] dropping {}% of outgoing packets (GAME_UDP_LOSS).", l * 100.0);
+		return l;
+	}();
+	if (loss <= 0.0) return false;
+	static thread_local std::mt19937 rnd(std::random_device{}());
+	return std::uniform_real_distribution< double >(0.0, 1.0)(rnd) < loss;
+}
+
+//size of the frame starting at 'data', or 0 if it isn't a complete, known frame going 'direction':
+size_t frame_size(char const *data, size_t available, MessageDirection direction) {
+	if (available < MessageHeaderSize) return 0;
+	uint32_t size;
+	memcpy(&size, data + 1, sizeof(uint32_t));
+	MessageInfo const *info = message_info(uint8_t(data[0]));
+	if (!info || !(info->directions & direction)) return 0;
+	if (size < info->min_size || size > info->max_size) return 0;
+	if (available - MessageHeaderSize < size) return 0;
+	return MessageHeaderSize + size;
+}
+
+//which way frames travel on a peer's connection (clients own their sockets; server-side peers share one):
+MessageDirection outgoing(UdpPeer const &peer) {
+	return (peer.owns_socket ? MessageToServer : MessageToClient);
+}
+MessageDirection incoming(UdpPeer const &peer) {
+	return (peer.owns_socket ? MessageToClient : MessageToServer);
+}
+
+void send_now(Connection &c, char const *data, size_t size) {
+	UdpPeer &peer = *c.udp;
+	ssize_t ret;
+	if (peer.owns_socket) {
+		ret = send(c.socket, data, int(size), MSG_DONTWAIT);
+	} else {
+		ret = sendto(c.socket, data, int(size), MSG_DONTWAIT, reinterpret_cast< struct sockaddr const * >(&peer.addr), peer.addr_len);
+	}
+	//a full socket buffer is just another dropped packet as far as the protocol is concerned;
+	// anything else is worth knowing about (once, rather than on every resend):
+	if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNREFUSED) {
+		if (errno != peer.send_error) {
+			log_warning("[udp] send of {} bytes returned error {}({}).", size, errno, strerror(errno));
+			peer.send_error = errno;
+		}
+	} else if (ret >= 0) {
+		peer.send_error = 0;
+	}
+}
+
+void send_packet(Connection &c, std::vector< char > const &packet) {
+	if (drop_packet()) return;
+	if (c.netsim) {
+		c.netsim->up.push(packet.data(), packet.size(), now());
+		return;
+	}
+	send_now(c, packet.data(), packet.size());
+}
+
+Header make_header(UdpPeer &peer, uint8_t kind) {
+	Header header;
+	header.kind = kind;
+	header.seq = ++peer.send_seq;
+	header.ack = peer.reliable_expected;
+	header.reliable_total = peer.reliable_next;
+	header.reliable_first = peer.reliable_next - uint32_t(peer.unacked.size());
+	return header;
+}
+
+//move newly queued frames into the reliable/unreliable queues and send whatever is due:
+void flush(char const *where, Connection &c, double t) {
+	UdpPeer &peer = *c.udp;
+
+	peer.queued.clear();
+	while (!c.send_buffer.empty()) {
+		SendQueue::Span spans[16];
+		size_t count = c.send_buffer.gather(spans, 16);
+		size_t bytes = 0;
+		for (size_t i = 0; i < count; ++i) {
+			peer.queued.insert(peer.queued.end(), spans[i].data, spans[i].data + spans[i].size);
+			bytes += spans[i].size;
+		}
+		c.send_buffer.consume(bytes);
+	}
+
+	bool new_reliable = false;
+	for (size_t at = 0; at < peer.queued.size(); /*later*/) {
+		size_t size = frame_size(peer.queued.data() + at, peer.queued.size() - at, outgoing(peer));
+		if (size == 0) {
+			log_warning("[{}] can't send data that isn't a message frame over UDP; dropping {} bytes.", where, peer.queued.size() - at);
+			break;
+		}
+		if (HeaderSize + size > UdpMaxDatagram) {
+			//(no fragmentation; sending it would fail every time, and a reliable frame would block everything behind it)
+			log_warning("[{}] message '{}' of {} bytes is too big for a UDP packet; dropping it.", where, peer.queued[at], size);
+			at += size;
+			continue;
+		}
+		std::vector< char > frame(peer.queued.begin() + at, peer.queued.begin() + at + size);
+		if (message_info(uint8_t(frame[0]))->reliable) {
+			peer.unacked.emplace_back(std::move(frame));
+			peer.reliable_next += 1;
+			new_reliable = true;
+		} else {
+			peer.unreliable.emplace_back(std::move(frame));
+		}
+		at += size;
+	}
+
+	bool resend = !peer.unacked.empty() && t - peer.last_send >= UdpResendInterval;
+	//(until we've heard anything back, keep knocking at the resend rate)
+	double keepalive = (peer.recv_seq == 0 ? UdpResendInterval : UdpKeepaliveInterval);
+	if (!new_reliable && !resend && !peer.ack_due && peer.unreliable.empty() && t - peer.last_send < keepalive) return;
+
+	//first packet: as many unacknowledged reliable frames as fit (but always at least one), then unreliable frames:
+	std::vector< char > packet(HeaderSize);
+	Header header = make_header(peer, PacketData);
+	for (auto const &frame : peer.unacked) {
+		if (header.reliable_count > 0 && packet.size() + frame.size() > UdpMaxPacket) break;
+		if (header.reliable_count == 0xffff) break;
+		packet.insert(packet.end(), frame.begin(), frame.end());
+		header.reliable_count += 1;
+	}
+
+	size_t next = 0;
+	do {
+		while (next < peer.unreliable.size() && (packet.size() == HeaderSize || packet.size() + peer.unreliable[next].size() <= UdpMaxPacket)) {
+			packet.insert(packet.end(), peer.unreliable[next].begin(), peer.unreliable[next].end());
+			++next;
+		}
+		header.write(packet.data());
+		send_packet(c, packet);
+
+		//leftover unreliable frames go in packets of their own:
+		packet.resize(HeaderSize);
+		header = make_header(peer, PacketData);
+		header.reliable_count = 0;
+	} while (next < peer.unreliable.size());
+
+	peer.unreliable.clear();
+	peer.last_send = t;
+	peer.ack_due = false;
+}
+
+//process one packet; returns true if anything was delivered to recv_buffer:
+bool receive(char const *where, Connection &c, char const *data, size_t size, double t) {
+	UdpPeer &peer = *c.udp;
+	if (size < HeaderSize) return false;
+	Header header;
+	header.read(data);
+	if (header.magic != Magic) return false;
+
+	peer.last_recv = t;
+	if (header.kind == PacketClose) {
+		return false; //(caller closes)
+	}
+	if (header.seq > peer.recv_seq) peer.recv_seq = header.seq;
+
+	//drop reliable frames the other side now has:
+	uint32_t first_unacked = peer.reliable_next - uint32_t(peer.unacked.size());
+	while (!peer.unacked.empty() && int32_t(header.ack - first_unacked) > 0) {
+		peer.unacked.pop_front();
+		first_unacked += 1;
+	}
+
+	bool delivered = false;
+	size_t at = HeaderSize;
+	for (uint32_t i = 0; i < header.reliable_count; ++i) {
+		size_t frame = frame_size(data + at, size - at, incoming(peer));
+		if (frame == 0) {
+			log_warning("[{}] malformed UDP packet; ignoring the rest of it.", where);
+			return delivered;
+		}
+		uint32_t id = header.reliable_first + i;
+		if (id == peer.reliable_expected) {
+			c.recv_buffer.push(data + at, frame);
+			peer.reliable_expected += 1;
+			delivered = true;
+			//anything that was waiting on this one:
+			for (auto f = peer.early.begin(); f != peer.early.end() && f->first == peer.reliable_expected; f = peer.early.erase(f)) {
+				c.recv_buffer.push(f->second.data(), f->second.size());
+				peer.reliable_expected += 1;
+			}
+		} else if (int32_t(id - peer.reliable_expected) > 0 && peer.early.size() < 1024) {
+			peer.early.emplace(id, std::vector< char >(data + at, data + at + frame));
+		}
+		at += frame;
+	}
+	if (header.reliable_count > 0) peer.ack_due = true;
+
+	//unreliable frames: only the newest, and only once we have every reliable frame sent before them:
+	if (at < size) {
+		if (header.seq > peer.unreliable_seq && int32_t(peer.reliable_expected - header.reliable_total) >= 0) {
+			peer.unreliable_seq = header.seq;
+			while (at < size) {
+				size_t frame = frame_size(data + at, size - at, incoming(peer));
+				if (frame == 0) {
+					log_warning("[{}] malformed UDP packet; ignoring the rest of it.", where);
+					break;
+				}
+				c.recv_buffer.push(data + at, frame);
+				delivered = true;
+				at += frame;
+			}
+		}
+	}
+	return delivered;
+}
+
+bool timed_out(Connection const &c, double t) {
+	return t - c.udp->last_recv > UdpTimeout;
+}
+
+const size_t RecvSize = 65536;
+
+} //namespace
+
+UdpPeer::UdpPeer() : last_recv(now()) {
+	memset(&addr, 0, sizeof(addr));
+}
+
+void udp_close(Connection &c) {
+	assert(c.udp);
+	//best effort; the other side times out if this gets lost:
+	// (sent directly, since the socket is about to go away)
+	std::vector< char > packet(HeaderSize);
+	make_header(*c.udp, PacketClose).write(packet.data());
+	send_now(c, packet.data(), packet.size());
+	if (c.udp->owns_socket) ::closesocket(c.socket);
+}
+
+void udp_server_poll(char const *where, Server &server, std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
+	assert(server.udp);
+	double t = now();
+
+	//send anything queued since the last poll before (possibly) sleeping:
+	for (auto &c : server.connections) {
+		if (c.socket != INVALID_SOCKET) flush(where, c, t);
+	}
+
+	//wait for packets (or a wake()):
+	#ifdef CONNECTION_USE_EPOLL
+	{
+		const int MaxEvents = 4;
+		struct epoll_event events[MaxEvents];
+		int timeout_ms = (timeout <= 0.0 ? 0 : int(std::ceil(timeout * 1000.0)));
+		int count = epoll_wait(server.epoll_fd, events, MaxEvents, timeout_ms);
+		for (int e = 0; e < count; ++e) {
+			if (events[e].data.ptr == &server.wake_fd) {
+				uint64_t value;
+				while (read(server.wake_fd, &value, sizeof(value)) > 0) { }
+			}
+		}
+	}
+	#else
+	{
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(server.listen_socket, &read_fds);
+		struct timeval tv;
+		tv.tv_sec = std::lround(std::floor(timeout));
+		tv.tv_usec = std::lround((timeout - std::floor(timeout)) * 1e6);
+		select(int(server.listen_socket) + 1, &read_fds, NULL, NULL, &tv);
+	}
+	#endif
+	t = now();
+
+	static thread_local std::vector< char > buffer(RecvSize);
+	while (true) {
+		struct sockaddr_storage addr;
+		socklen_t addr_len = sizeof(addr);
+		ssize_t ret = recvfrom(server.listen_socket, buffer.data(), int(buffer.size()), MSG_DONTWAIT, reinterpret_cast< struct sockaddr * >(&addr), &addr_len);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+				log_warning("[{}] recvfrom() returned error {}({}).", where, errno, strerror(errno));
+			}
+			break;
+		}
+		if (size_t(ret) < HeaderSize) continue;
+
+		std::string key(reinterpret_cast< char const * >(&addr), addr_len);
+		auto f = server.udp->peers.find(key);
+		Connection *c;
+		if (f == server.udp->peers.end()) {
+			Header header;
+			header.read(buffer.data());
+			if (header.magic != Magic || header.kind == PacketClose) continue;
+
+			server.connections.emplace_back();
+			c = &server.connections.back();
+			c->socket = server.listen_socket;
+			c->udp = std::make_shared< UdpPeer >();
+			memcpy(&c->udp->addr, &addr, addr_len);
+			c->udp->addr_len = addr_len;
+			server.udp->peers.emplace(key, c);
+			log_info("[{}] client connected over UDP.", where);
+			if (on_event) on_event(c, Connection::OnOpen);
+		} else {
+			c = f->second;
+		}
+		if (c->socket == INVALID_SOCKET) continue;
+
+		bool delivered = receive(where, *c, buffer.data(), size_t(ret), t);
+		if (delivered && on_event) on_event(c, Connection::OnRecv);
+
+		Header header;
+		header.read(buffer.data());
+		if (header.kind == PacketClose && c->socket != INVALID_SOCKET) {
+			log_info("[{}] client closed UDP connection.", where);
+			c->socket = INVALID_SOCKET; //(no need to send them a close)
+			if (on_event) on_event(c, Connection::OnClose);
+		}
+	}
+
+	//send responses and acks, and drop peers that went quiet:
+	for (auto &c : server.connections) {
+		if (c.socket == INVALID_SOCKET) continue;
+		if (timed_out(c, t)) {
+			log_info("[{}] UDP client timed out, disconnecting.", where);
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			continue;
+		}
+		flush(where, c, t);
+	}
+
+	//reap closed peers:
+	for (auto c = server.connections.begin(); c != server.connections.end(); /*later*/) {
+		auto old = c;
+		++c;
+		if (old->socket == INVALID_SOCKET) {
+			server.udp->peers.erase(std::string(reinterpret_cast< char const * >(&old->udp->addr), old->udp->addr_len));
+			server.connections.erase(old);
+		}
+	}
+}
+
+void udp_client_poll(char const *where, Client &client, std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
+	Connection &c = client.connection;
+	assert(c.udp);
+	if (c.socket == INVALID_SOCKET) return;
+
+	//(with simulated network conditions, packets pass through c.netsim on the way out and in)
+	auto send_due = [&c](double t) {
+		if (!c.netsim) return;
+		c.netsim->up.pop_due(t, [&c](char const *data, size_t size){
+			if (c.socket != INVALID_SOCKET) send_now(c, data, size);
+		});
+	};
+
+	double t = now();
+	flush(where, c, t);
+	send_due(t);
+
+	{ //wait for packets (or for the next simulated delivery):
+		if (c.netsim) timeout = std::max(0.0, std::min(timeout, c.netsim->next_due() - t));
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(c.socket, &read_fds);
+		struct timeval tv;
+		tv.tv_sec = std::lround(std::floor(timeout));
+		tv.tv_usec = std::lround((timeout - std::floor(timeout)) * 1e6);
+		select(int(c.socket) + 1, &read_fds, NULL, NULL, &tv);
+	}
+	t = now();
+
+	auto handle = [&](char const *data, size_t size) {
+		if (c.socket == INVALID_SOCKET) return;
+		bool delivered = receive(where, c, data, size, t);
+		if (delivered && on_event) on_event(&c, Connection::OnRecv);
+
+		Header header;
+		if (size >= HeaderSize) header.read(data);
+		if (header.magic == Magic && header.kind == PacketClose && c.socket != INVALID_SOCKET) {
+			log_info("[{}] server closed UDP connection.", where);
+			::closesocket(c.socket);
+			c.socket = INVALID_SOCKET;
+			if (on_event) on_event(&c, Connection::OnClose);
+		}
+	};
+
+	static thread_local std::vector< char > buffer(RecvSize);
+	while (c.socket != INVALID_SOCKET) {
+		ssize_t ret = recv(c.socket, buffer.data(), int(buffer.size()), MSG_DONTWAIT);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			//(ECONNREFUSED just means nobody's listening yet; keep trying until the timeout)
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+				log_warning("[{}] recv() returned error {}({}).", where, errno, strerror(errno));
+			}
+			break;
+		}
+		if (c.netsim) c.netsim->down.push(buffer.data(), size_t(ret), t);
+		else handle(buffer.data(), size_t(ret));
+	}
+	if (c.netsim) c.netsim->down.pop_due(t, handle);
+
+	if (c.socket == INVALID_SOCKET) return;
+	if (timed_out(c, t)) {
+		log_info("[{}] server timed out, disconnecting.", where);
+		c.close();
+		if (on_event) on_event(&c, Connection::OnClose);
+		return;
+	}
+	flush(where, c, t);
+	send_due(t);
+}
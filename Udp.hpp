@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Connection.hpp"
+
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+//UDP transport for Server and Client (construct them with TransportUDP).
+//
+//Connections still look like byte streams of Protocol.hpp frames: the transport
+// splits queued frames by the 'reliable' flag in the message registry:
+//  - reliable frames (turns, lifecycle) get ids and are resent in every packet
+//    until cumulatively acknowledged, then delivered in order;
+//  - unreliable frames (snapshots, snapshot acks) are sent once and are latest-wins:
+//    frames from a packet older than the newest one already delivered are dropped.
+//    They are also dropped if a reliable frame sent before them hasn't been delivered
+//    yet, so a snapshot never gets ahead of a turn it already includes (the next
+//    snapshot supersedes it anyway).
+//
+//There is no fragmentation: frames that don't fit in one datagram (UdpMaxDatagram)
+// are dropped, with a warning, instead of sent.
+//
+//Each packet is:
+//	[magic:u16][kind:u8][seq:u32][ack:u32][reliable total:u32][first reliable id:u32][reliable count:u16]
+//	[reliable frames...][unreliable frames...]
+//
+//Set GAME_UDP_LOSS (e.g. =0.2) to drop that fraction of outgoing packets, for testing over loopback.
+// (For latency, jitter, and reordering as well, see NetSim.hpp.)
+
+struct UdpPeer {
+	UdpPeer(); //(starts the timeout clock)
+
+	//where to send (server side; a client's socket is connect()ed to the server):
+	struct sockaddr_storage addr;
+	socklen_t addr_len = 0;
+	bool owns_socket = false; //(client) close the socket along with the connection
+
+	uint32_t send_seq = 0; //seq of the last packet sent
+	uint32_t recv_seq = 0; //newest packet seq received
+
+	//reliable channel, outgoing: frames with ids [reliable_next - unacked.size(), reliable_next)
+	uint32_t reliable_next = 0;
+	std::deque< std::vector< char > > unacked;
+	//reliable channel, incoming:
+	uint32_t reliable_expected = 0; //id of the next reliable frame to deliver (sent back as 'ack')
+	std::map< uint32_t, std::vector< char > > early; //frames that arrived after a gap
+
+	uint32_t unreliable_seq = 0; //packet seq of the newest unreliable frames delivered
+
+	double last_send = -1.0e9;
+	double last_recv = 0.0; //(or when the peer was created, if nothing has arrived yet)
+	bool ack_due = false; //got reliable frames since we last sent anything
+	int send_error = 0; //errno of the last failed send (so a persistent error is only logged once)
+
+	//scratch (reused between flushes):
+	std::vector< char > queued;
+	std::vector< std::vector< char > > unreliable;
+};
+
+//Server-side state: one socket shared by every peer, looked up by address.
+struct UdpHost {
+	std::unordered_map< std::string, Connection * > peers;
+};
+
+const double UdpResendInterval = 0.1; //seconds between resends of unacknowledged reliable frames
+const double UdpKeepaliveInterval = 0.5; //send at least this often so the other side knows we're here
+const double UdpTimeout = 10.0; //drop a peer we haven't heard from for this long
+const size_t UdpMaxPacket = 1200; //bundle frames up to this size (a single bigger frame still gets its own packet)
+const size_t UdpMaxDatagram = 65507; //largest UDP payload (over IPv4); bigger frames can't be sent at all
+
+void udp_server_poll(char const *where, Server &server, std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout);
+void udp_client_poll(char const *where, Client &client, std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout);
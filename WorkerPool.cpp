@@ -0,0 +1,99 @@
+#include "WorkerPool.hpp"
+
+#include <cassert>
+
+WorkerPool::WorkerPool(unsigned workers) {
+	if (workers == 0) workers = 1;
+	for (unsigned i = 0; i < workers; ++i) {
+		queues.emplace_back(new Queue);
+	}
+	//worker 0 is whoever calls run():
+	for (unsigned i = 1; i < workers; ++i) {
+		threads.emplace_back(&WorkerPool::worker_main, this, i);
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard< std::mutex > guard(batch_mutex);
+		quit = true;
+	}
+	batch_cv.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+void WorkerPool::run(size_t count, std::function< void(size_t) > const &task_) {
+	if (count == 0) return;
+
+	{ //deal tasks out round-robin and wake the workers:
+		std::lock_guard< std::mutex > guard(batch_mutex);
+		assert(task == nullptr && "WorkerPool::run is not re-entrant.");
+		task = &task_;
+		remaining.store(count);
+		for (size_t i = 0; i < count; ++i) {
+			Queue &queue = *queues[i % queues.size()];
+			std::lock_guard< std::mutex > queue_guard(queue.lock);
+			queue.tasks.push_back(i);
+		}
+		++generation;
+	}
+	batch_cv.notify_all();
+
+	work(0);
+
+	{ //wait for tasks still running on other workers:
+		std::unique_lock< std::mutex > lock(batch_mutex);
+		done_cv.wait(lock, [this](){ return remaining.load() == 0; });
+		task = nullptr;
+	}
+}
+
+bool WorkerPool::take(unsigned self, size_t *index) {
+	{ //own work first (newest first):
+		Queue &queue = *queues[self];
+		std::lock_guard< std::mutex > guard(queue.lock);
+		if (!queue.tasks.empty()) {
+			*index = queue.tasks.back();
+			queue.tasks.pop_back();
+			return true;
+		}
+	}
+	//then steal (oldest first) from everyone else:
+	for (unsigned offset = 1; offset < queues.size(); ++offset) {
+		Queue &queue = *queues[(self + offset) % queues.size()];
+		std::lock_guard< std::mutex > guard(queue.lock);
+		if (!queue.tasks.empty()) {
+			*index = queue.tasks.front();
+			queue.tasks.pop_front();
+			steals.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkerPool::work(unsigned self) {
+	size_t index;
+	while (take(self, &index)) {
+		(*task)(index);
+		if (remaining.fetch_sub(1) == 1) {
+			std::lock_guard< std::mutex > guard(batch_mutex);
+			done_cv.notify_all();
+		}
+	}
+}
+
+void WorkerPool::worker_main(unsigned self) {
+	uint64_t seen = 0;
+	while (true) {
+		{
+			std::unique_lock< std::mutex > lock(batch_mutex);
+			batch_cv.wait(lock, [&](){ return quit || generation != seen; });
+			if (quit) return;
+			seen = generation;
+		}
+		work(self);
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+
+//WorkerPool runs batches of independent tasks across several threads.
+// Each batch is spread over per-worker deques; a worker pops from the back of
+// its own deque and, when that runs dry, steals from the front of the others.
+//
+//For example:
+//	WorkerPool pool(4);
+//	pool.run(rooms.size(), [&](size_t i){ rooms[i]->tick(); });
+//
+//The thread that calls run() works on the batch too (as worker 0), so a pool
+// of N workers starts N-1 threads.
+
+struct WorkerPool {
+	WorkerPool(unsigned workers = std::thread::hardware_concurrency());
+	~WorkerPool();
+	WorkerPool(WorkerPool const &) = delete;
+
+	//call task(i) for every i in [0,count), returning once all calls are done:
+	void run(size_t count, std::function< void(size_t) > const &task);
+
+	unsigned size() const { return unsigned(queues.size()); }
+
+	//number of tasks taken from another worker's deque since construction:
+	std::atomic< uint64_t > steals{0};
+
+	//internals:
+	struct Queue {
+		std::mutex lock;
+		std::deque< size_t > tasks;
+	};
+	std::vector< std::unique_ptr< Queue > > queues;
+	std::vector< std::thread > threads;
+
+	std::mutex batch_mutex;
+	std::condition_variable batch_cv; //signalled when a batch starts (or on shutdown)
+	std::condition_variable done_cv; //signalled when the last task of a batch finishes
+	uint64_t generation = 0; //batch counter (guarded by batch_mutex)
+	bool quit = false;
+
+	std::function< void(size_t) > const *task = nullptr;
+	std::atomic< size_t > remaining{0};
+
+	bool take(unsigned self, size_t *index);
+	void work(unsigned self);
+	void worker_main(unsigned self);
+};
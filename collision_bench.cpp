@@ -0,0 +1,167 @@
+//Benchmark for snake collision checks: times the per-tick checks Game::update does on
+// the server (every head against itself and every other snake), with and without a
+// SpatialGrid, as the snakes get longer.
+//
+//Snakes this long can't fit on the real board without running into something (and a
+// head that hits something stops checking early), so each snake here winds back and
+// forth in its own lane of a board sized to fit them all. Nothing collides, so every
+// check is a full one -- the common case in a real match.
+//
+//It also times the segment distance test itself: one segment at a time through
+// BodySegment::collides_with, and a batch at a time through SegmentBatch (scalar and SIMD).
+//
+//Usage: ./collision_bench [snakes] [ticks per size]
+
+#include "Snake.hpp"
+#include "SpatialGrid.hpp"
+#include "SegmentBatch.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <functional>
+#include <cstdlib>
+
+namespace {
+
+const float RowLength = 6.f; //length of each back-and-forth run
+const float RowSpacing = 1.f; //(more than twice the snake radius apart)
+const float LaneWidth = RowLength + 2.f;
+
+//move the head 'distance' along its current direction (never losing length):
+void advance(Snake &snake, float distance) {
+	snake.extra_length = 1.0e9f;
+	snake.update(distance / snake.speed);
+}
+
+//a snake winding up its lane, starting at the bottom left corner, with 'segments' segments:
+Snake *make_snake(glm::vec2 corner, int segments) {
+	Snake *snake = new Snake(corner + glm::vec2(0.5f, 0.5f), 0.5f, Snake::Direction::RIGHT);
+	bool right = true;
+	while (true) {
+		advance(*snake, RowLength);
+		if (snake->segment_count + 2 > segments) break;
+		snake->change_dir(Snake::Direction::UP);
+		advance(*snake, RowSpacing);
+		right = !right;
+		snake->change_dir(right ? Snake::Direction::RIGHT : Snake::Direction::LEFT);
+	}
+	return snake;
+}
+
+//one tick's worth of checks, like Game::update(..., true); returns how many heads collided:
+int check_all(std::vector< Snake * > const &snakes) {
+	int hits = 0;
+	for (Snake *snake : snakes) {
+		bool hit = snake->collision_with_self();
+		for (Snake *other : snakes) {
+			if (hit) break;
+			if (other != snake) hit = snake->collision_with_other(other);
+		}
+		if (hit) hits += 1;
+	}
+	return hits;
+}
+
+//time the distance test on its own: many points against a field of random segments
+// (all in batches already, as collision checks gather them), mostly missing, so
+// every segment gets tested:
+void bench_kernel() {
+	std::mt19937 rnd(1);
+	std::uniform_real_distribution< float > coord(-10.f, 10.f);
+	std::uniform_real_distribution< float > len(0.2f, 3.f);
+
+	const int SegmentCount = 4096;
+	std::vector< Snake::BodySegment > segments;
+	std::vector< SegmentBatch > batches((SegmentCount + SegmentBatch::Capacity - 1) / SegmentBatch::Capacity);
+	for (int i = 0; i < SegmentCount; ++i) {
+		segments.emplace_back(glm::vec2(coord(rnd), coord(rnd)), int(rnd() % 4), i);
+		segments.back().length = len(rnd);
+		glm::vec2 back = segments.back().front - segments.back().dir_vec() * segments.back().length;
+		batches[i / SegmentBatch::Capacity].add(segments.back().front, back);
+	}
+	//(points well off to the side of the field miss everything)
+	std::vector< glm::vec2 > points;
+	for (int i = 0; i < 256; ++i) {
+		points.emplace_back(coord(rnd) + (i % 2 ? 25.f : 0.f), coord(rnd));
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	auto time = [&](char const *name, std::function< bool(glm::vec2) > const &any_hit) {
+		int hits = 0;
+		auto before = Clock::now();
+		for (glm::vec2 pt : points) {
+			if (any_hit(pt)) hits += 1;
+		}
+		double ns = std::chrono::duration< double, std::nano >(Clock::now() - before).count() / (double(points.size()) * SegmentCount);
+		std::cout << std::setw(24) << name << std::setw(10) << std::fixed << std::setprecision(3) << ns << " ns/segment (" << hits << " hits)" << std::endl;
+		return ns;
+	};
+
+	//(each version tests every segment, without stopping early, so the work is the same)
+	std::cout << "distance test, " << SegmentCount << " segments x " << points.size() << " points:" << std::endl;
+	double one = time("collides_with", [&](glm::vec2 pt) {
+		bool hit = false;
+		for (auto &seg : segments) hit |= seg.collides_with(pt, 0.4f);
+		return hit;
+	});
+	double scalar = time("SegmentBatch (scalar)", [&](glm::vec2 pt) {
+		bool hit = false;
+		for (auto const &batch : batches) hit |= batch.any_within_scalar(pt, 0.8f);
+		return hit;
+	});
+	double simd = time("SegmentBatch", [&](glm::vec2 pt) {
+		bool hit = false;
+		for (auto const &batch : batches) hit |= batch.any_within(pt, 0.8f);
+		return hit;
+	});
+	std::cout << std::setprecision(2) << "SegmentBatch speedup: " << one / simd << "x over collides_with, " << scalar / simd << "x over scalar batches" << std::endl << std::endl;
+}
+
+} //namespace
+
+int main(int argc, char **argv) {
+	int snake_count = (argc > 1 ? std::max(1, std::atoi(argv[1])) : 8);
+	int ticks = (argc > 2 ? std::max(1, std::atoi(argv[2])) : 100);
+
+	bench_kernel();
+
+	std::cout << snake_count << " snakes, " << ticks << " ticks of checks per size:" << std::endl;
+	std::cout << std::setw(10) << "segments" << std::setw(14) << "linear us" << std::setw(14) << "grid us" << std::setw(10) << "speedup" << std::endl;
+
+	for (int segments : {16, 64, 256, 1024, 4096, 16384}) {
+		//lanes side by side, each tall enough for its snake:
+		float lane_height = (segments / 2 + 1) * RowSpacing + 1.f;
+		glm::vec2 half_extent = 0.5f * glm::vec2(snake_count * LaneWidth, lane_height);
+		SpatialGrid grid(half_extent, 1.f);
+
+		std::vector< Snake * > snakes;
+		for (int i = 0; i < snake_count; ++i) {
+			snakes.emplace_back(make_snake(-half_extent + glm::vec2(i * LaneWidth, 0.f), segments));
+		}
+
+		typedef std::chrono::steady_clock Clock;
+		auto time = [&]() {
+			int hits = 0;
+			auto before = Clock::now();
+			for (int i = 0; i < ticks; ++i) {
+				hits += check_all(snakes);
+			}
+			if (hits != 0) std::cout << "(unexpected collisions: " << hits << ") ";
+			return std::chrono::duration< double, std::micro >(Clock::now() - before).count() / ticks;
+		};
+
+		double linear = time();
+		for (Snake *snake : snakes) snake->set_grid(&grid);
+		double gridded = time();
+
+		std::cout << std::fixed << std::setprecision(2)
+			<< std::setw(10) << snakes[0]->segment_count << std::setw(14) << linear << std::setw(14) << gridded
+			<< std::setw(9) << linear / gridded << "x" << std::endl;
+
+		for (Snake *snake : snakes) delete snake;
+	}
+	return 0;
+}
@@ -0,0 +1,398 @@
+//Headless load generator: plays many simulated clients against a server at once and
+// reports how the server is holding up, for sizing hardware.
+//
+//Each client speaks the same protocol as the game client (answers 'p' with 'h', turns
+// with 'm', acknowledges snapshots), turning at random and away from walls. When a match
+// ends, the client reconnects to keep the load steady.
+//
+//Against a '--lockstep' server, clients run the lockstep simulation instead (predicting
+// their own turns); turn latency is then measured until the server sends the turn back
+// to its sender, scheduled for a tick.
+
+#include "Connection.hpp"
+#include "Protocol.hpp"
+#include "Game.hpp"
+#include "NetSim.hpp"
+#include "Lockstep.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <map>
+#include <tuple>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+double now() {
+	return std::chrono::duration< double >(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//a set of timing samples (in seconds), summarized in milliseconds:
+struct Series {
+	std::vector< double > samples;
+	void add(double s) { samples.emplace_back(s); }
+	std::string summary() {
+		if (samples.empty()) return "no samples";
+		std::sort(samples.begin(), samples.end());
+		double total = 0.0;
+		for (double s : samples) total += s;
+		auto at = [this](double f) { return samples[std::min(samples.size() - 1, size_t(f * samples.size()))] * 1000.0; };
+		std::ostringstream out;
+		out << std::fixed << std::setprecision(1)
+			<< "n=" << samples.size() << " mean " << total / samples.size() * 1000.0
+			<< " p50 " << at(0.5) << " p99 " << at(0.99) << " max " << samples.back() * 1000.0;
+		return out.str();
+	}
+};
+
+//everything reported; one for the current interval and one for the whole run:
+struct Stats {
+	Series relay; //turn sent -> other player in the room receives it
+	Series snapshot_interval; //time between snapshots arriving at a client
+	uint64_t unmatched = 0; //relayed turns we couldn't match to a send (e.g., the server clamped the turn point)
+	uint64_t recv_messages = 0, recv_bytes = 0, sync_bytes = 0, fulls = 0, deltas = 0;
+	uint64_t checks = 0, desyncs = 0, rollbacks = 0, rollback_ticks = 0; //(lockstep)
+	uint64_t sent_messages = 0, sent_bytes = 0;
+	uint64_t matches = 0, disconnects = 0, failed_connects = 0;
+	double client_seconds = 0.0; //sum over clients of time connected (to report per-connection rates)
+
+	void report(std::string const &label, double seconds, size_t clients, size_t playing, double snapshot_hz) {
+		double cs = std::max(client_seconds, 1e-9);
+		std::cout << std::fixed << std::setprecision(1);
+		std::cout << "[loadgen] " << label << " (" << seconds << "s): " << clients << " clients (" << playing << " playing), "
+			<< matches << " matches finished, " << disconnects << " disconnects, " << failed_connects << " failed connects\n";
+		std::cout << "\tturn relay latency (ms): " << relay.summary() << " (" << unmatched << " unmatched)\n";
+		std::cout << "\tsnapshot interval (ms): " << snapshot_interval.summary() << " (server aims for "
+			<< 1000.0 / snapshot_hz << ")\n";
+		std::cout << "\tper connection: in " << recv_messages / cs << " msg/s, " << recv_bytes / cs << " B/s (snapshots "
+			<< sync_bytes / cs << " B/s; " << deltas << " deltas, " << fulls << " full); out "
+			<< sent_messages / cs << " msg/s, " << sent_bytes / cs << " B/s" << std::endl;
+		if (checks > 0) {
+			std::cout << "\tlockstep: " << checks << " checks, " << desyncs << " desyncs, " << rollbacks << " rollbacks ("
+				<< (rollbacks ? double(rollback_ticks) / rollbacks : 0.0) << " ticks each)" << std::endl;
+		}
+	}
+};
+
+//turns in flight, keyed on what the server relays to the other player (turn point and direction):
+typedef std::tuple< uint32_t, uint32_t, uint8_t > TurnKey;
+TurnKey turn_key(glm::vec2 target, uint8_t dir) {
+	uint32_t x, y;
+	memcpy(&x, &target.x, sizeof(x));
+	memcpy(&y, &target.y, sizeof(y));
+	return std::make_tuple(x, y, dir);
+}
+
+struct Options {
+	std::string host, port;
+	size_t clients = 10;
+	double seconds = 30.0;
+	double turns = 2.0; //random turns per second per client
+	double snapshot_hz = 5.0; //what the server was started with (TickRates::snapshot), for reporting
+	Transport transport = TransportTCP;
+	NetSimConfig netsim;
+};
+
+struct Bot {
+	Bot(Options const &options) : client(new Client(options.host, options.port, options.transport)), connected_at(now()) {
+		if (options.netsim.enabled()) client->simulate_network(options.netsim);
+	}
+	std::unique_ptr< Client > client;
+	Game state;
+	Snake *snake = nullptr;
+	int slot = 0;
+	LockstepClient lockstep;
+	std::deque< double > turns_sent; //(lockstep) send times of our turns the server hasn't sent back yet
+	uint32_t desyncs = 0, rollbacks = 0, rollback_ticks = 0; //(lockstep) already counted
+	bool initiated = false;
+	bool started = false;
+	bool done = false; //match over or connection lost; replace this bot
+	double connected_at;
+	double last_snapshot = -1.0;
+};
+
+struct LoadGen {
+	Options options;
+	std::mt19937 rnd{std::random_device()()};
+	std::vector< std::unique_ptr< Bot > > bots;
+	std::map< TurnKey, double > turns_in_flight;
+	Stats interval, total;
+
+	template< typename F >
+	void count(F const &f) { f(interval); f(total); }
+
+	void count_sent(uint32_t size) {
+		count([size](Stats &s){ s.sent_messages += 1; s.sent_bytes += MessageHeaderSize + size; });
+	}
+
+	void connect(std::unique_ptr< Bot > *slot) {
+		try {
+			slot->reset(new Bot(options));
+		} catch (std::exception const &e) {
+			std::cerr << "[loadgen] failed to connect: " << e.what() << std::endl;
+			count([](Stats &s){ s.failed_connects += 1; });
+			slot->reset();
+		}
+	}
+
+	//random turns, plus turning away from walls so matches last a while:
+	void steer(Bot &bot, double t, float elapsed) {
+		Snake &snake = *bot.snake;
+		if (snake.dead) return;
+
+		int left = (snake.dir + 1) % 4, right = (snake.dir + 3) % 4;
+		int new_dir = -1;
+		glm::vec2 ahead = snake.head->front + snake.dir_vec() * 1.5f;
+		if (std::abs(ahead.x) >= Game::MAX_X || std::abs(ahead.y) >= Game::MAX_Y) {
+			//turn whichever way points more toward the center ('left' is dir_vec() rotated a quarter turn counterclockwise):
+			glm::vec2 to_left = glm::vec2(-snake.dir_vec().y, snake.dir_vec().x);
+			new_dir = (glm::dot(to_left, -snake.head->front) > 0.f ? left : right);
+		} else if (std::uniform_real_distribution< float >(0.f, 1.f)(rnd) < options.turns * elapsed) {
+			new_dir = (std::uniform_int_distribution< int >(0, 1)(rnd) ? left : right);
+		}
+		if (new_dir < 0) return;
+
+		if (bot.lockstep.active) {
+			if (!bot.lockstep.game.can_turn(bot.slot, new_dir)) return;
+			bot.lockstep.turn(new_dir, bot.client->connection);
+			count_sent(TurnMessage::Size);
+			bot.turns_sent.emplace_back(t);
+			bot.lockstep.write_to(&bot.state);
+			return;
+		}
+
+		//same rule as GameMode: don't double back onto our own body:
+		if (!(snake.head->length > 0.4f && (snake.head->prev == nullptr || snake.head->prev->dir == new_dir || snake.head->length > 0.9f))) return;
+
+		MoveMessage move;
+		move.dir = uint8_t(new_dir);
+		move.target = snake.head->front;
+		send_message(bot.client->connection, move);
+		count_sent(MoveMessage::Size);
+		turns_in_flight[turn_key(move.target, move.dir)] = t;
+		snake.change_dir(new_dir);
+	}
+
+	void handle(Bot &bot, Connection &c, double t) {
+		MessageView msg;
+		ParseResult result;
+		while ((result = next_message(c, &msg, MessageToClient)) == ParseOk) {
+			count([&msg](Stats &s){ s.recv_messages += 1; s.recv_bytes += MessageHeaderSize + msg.size; });
+
+			PlayersMessage players;
+			MoveMessage move;
+			AppleMessage apple;
+			TurnMessage turn;
+			if (!bot.initiated) {
+				if (!msg.read(&players) || players.slot >= players.count) {
+					std::cerr << "[loadgen] expected players message, got '" << message_info(msg.type)->name << "'." << std::endl;
+					continue;
+				}
+				bot.state.new_game(int(players.count));
+				bot.snake = bot.state.snakes[players.slot];
+				bot.slot = players.slot;
+				bot.lockstep.player = players.slot;
+				bot.state.apple_pos = players.apple;
+				bot.initiated = true;
+				send_message(c, MessageHello);
+				count_sent(0);
+			} else if (bot.lockstep.handle(c, msg)) {
+				if (msg.type == MessageLockState || msg.type == MessageTick) {
+					bool full = (msg.type == MessageLockState);
+					count([&msg, full](Stats &s){
+						s.sync_bytes += MessageHeaderSize + msg.size;
+						if (full) s.fulls += 1;
+						else s.checks += 1;
+					});
+				} else if (msg.read(&turn) && turn.player == bot.slot && !bot.turns_sent.empty()) {
+					double latency = t - bot.turns_sent.front();
+					bot.turns_sent.pop_front();
+					count([latency](Stats &s){ s.relay.add(latency); });
+				}
+				if (bot.lockstep.active) bot.lockstep.write_to(&bot.state);
+			} else if (msg.type == MessageStart) {
+				bot.started = true;
+			} else if (msg.read(&move) && move.player < bot.state.snakes.size()) {
+				bot.state.snakes[move.player]->revert_and_change(move.target, move.dir);
+				auto f = turns_in_flight.find(turn_key(move.target, move.dir));
+				if (f != turns_in_flight.end()) {
+					double latency = t - f->second;
+					count([latency](Stats &s){ s.relay.add(latency); });
+					turns_in_flight.erase(f);
+				} else {
+					count([](Stats &s){ s.unmatched += 1; });
+				}
+			} else if (msg.type == MessageSync || msg.type == MessageDelta) {
+				bool delta = (msg.type == MessageDelta);
+				count([&msg, delta](Stats &s){
+					s.sync_bytes += MessageHeaderSize + msg.size;
+					if (delta) s.deltas += 1;
+					else s.fulls += 1;
+				});
+				if (bot.last_snapshot >= 0.0) {
+					double gap = t - bot.last_snapshot;
+					count([gap](Stats &s){ s.snapshot_interval.add(gap); });
+				}
+				bot.last_snapshot = t;
+
+				AckMessage ack;
+				ack.seq = bot.state.recv_sync(msg);
+				if (ack.seq != 0) {
+					send_message(c, ack);
+					count_sent(AckMessage::Size);
+				}
+			} else if (msg.read(&apple)) {
+				bot.state.apple_pos = apple.pos;
+			} else if (msg.type == MessageDeath || msg.type == MessageVictory) {
+				count([](Stats &s){ s.matches += 1; });
+				bot.done = true;
+			}
+		}
+		if (result == ParseError) {
+			std::cerr << "[loadgen] malformed message from server; disconnecting." << std::endl;
+			c.close();
+			bot.done = true;
+		}
+	}
+
+	void run() {
+		bots.resize(options.clients);
+		for (auto &bot : bots) connect(&bot);
+
+		double start = now();
+		double last = start;
+		double interval_start = start;
+		const double ReportInterval = 5.0;
+		while (true) {
+			double t = now();
+			float elapsed = float(t - last);
+			last = t;
+
+			for (auto &slot : bots) {
+				if (!slot) {
+					connect(&slot);
+					if (!slot) continue;
+				}
+				Bot &bot = *slot;
+				if (bot.started) {
+					if (bot.lockstep.active) {
+						bot.lockstep.update(elapsed, bot.client->connection);
+						bot.lockstep.write_to(&bot.state);
+					} else {
+						bot.state.update(elapsed, false);
+					}
+					steer(bot, t, elapsed);
+				}
+				bot.client->poll([&](Connection *c, Connection::Event event){
+					if (event == Connection::OnRecv) {
+						handle(bot, *c, t);
+					} else if (event == Connection::OnClose) {
+						if (!bot.done) count([](Stats &s){ s.disconnects += 1; });
+						bot.done = true;
+					}
+				}, 0.0);
+
+				if (bot.lockstep.desyncs != bot.desyncs || bot.lockstep.rollbacks != bot.rollbacks) {
+					uint32_t desyncs = bot.lockstep.desyncs - bot.desyncs;
+					uint32_t rollbacks = bot.lockstep.rollbacks - bot.rollbacks;
+					uint32_t ticks = bot.lockstep.rollback_ticks - bot.rollback_ticks;
+					count([desyncs, rollbacks, ticks](Stats &s){ s.desyncs += desyncs; s.rollbacks += rollbacks; s.rollback_ticks += ticks; });
+					bot.desyncs = bot.lockstep.desyncs;
+					bot.rollbacks = bot.lockstep.rollbacks;
+					bot.rollback_ticks = bot.lockstep.rollback_ticks;
+				}
+
+				if (bot.done) {
+					interval.client_seconds += t - std::max(bot.connected_at, interval_start);
+					total.client_seconds += t - bot.connected_at;
+					bot.client->connection.close();
+					slot.reset();
+				}
+			}
+
+			t = now();
+			if (t - interval_start >= ReportInterval || t - start >= options.seconds) {
+				//connected time of the clients still going counts toward this interval:
+				for (auto &slot : bots) {
+					if (!slot) continue;
+					interval.client_seconds += t - std::max(slot->connected_at, interval_start);
+				}
+				size_t clients = 0, playing = 0;
+				for (auto &slot : bots) {
+					if (!slot) continue;
+					clients += 1;
+					if (slot->started) playing += 1;
+				}
+				interval.report("interval", t - interval_start, clients, playing, options.snapshot_hz);
+				interval = Stats();
+				interval_start = t;
+
+				//forget turns the server never relayed (e.g., the other player had left):
+				for (auto f = turns_in_flight.begin(); f != turns_in_flight.end(); /*later*/) {
+					if (t - f->second > ReportInterval) f = turns_in_flight.erase(f);
+					else ++f;
+				}
+
+				if (t - start >= options.seconds) {
+					for (auto &slot : bots) {
+						if (slot) total.client_seconds += t - slot->connected_at;
+					}
+					total.report("total", t - start, clients, playing, options.snapshot_hz);
+					return;
+				}
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+};
+
+} //namespace
+
+int main(int argc, char **argv) {
+	LoadGen gen;
+	Options &options = gen.options;
+
+	bool usage = (argc < 3);
+	if (!usage) {
+		options.host = argv[1];
+		options.port = argv[2];
+	}
+	for (int i = 3; i < argc && !usage; ++i) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if (arg == "--udp") {
+			options.transport = TransportUDP;
+		} else if (arg == "--clients" && has_value) {
+			options.clients = size_t(std::max(1, std::atoi(argv[++i])));
+		} else if (arg == "--seconds" && has_value) {
+			options.seconds = std::max(0.1, std::atof(argv[++i]));
+		} else if (arg == "--turns" && has_value) {
+			options.turns = std::max(0.0, std::atof(argv[++i]));
+		} else if (arg == "--snapshot-hz" && has_value) {
+			options.snapshot_hz = std::max(0.001, std::atof(argv[++i]));
+		} else if (arg == "--netsim" && has_value) {
+			options.netsim = NetSimConfig::parse(argv[++i]);
+		} else {
+			usage = true;
+		}
+	}
+	if (usage) {
+		std::cerr << "Usage:\n\t./loadgen <host> <port> [--clients N] [--seconds S] [--turns per-second] [--snapshot-hz 5] [--udp] [--netsim latency=100,jitter=20,...]" << std::endl;
+		return 1;
+	}
+
+	gen.run();
+	return 0;
+}
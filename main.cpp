@@ -10,6 +10,9 @@
 //The 'Sound' header has functions for managing sound:
 #include "Sound.hpp"
 
+//NetSim.hpp is included to (optionally) simulate a bad connection to the server:
+#include "NetSim.hpp"
+
 //GL.hpp will include a non-namespace-polluting set of opengl prototypes:
 #include "GL.hpp"
 
@@ -40,12 +43,26 @@ int main(int argc, char **argv) {
 	} config;
 
 	//----- start connection to server ----
-	if (argc != 3) {
-		std::cout << "Usage:\n\t./client <host> <port>" << std::endl;
+	Transport transport = TransportTCP;
+	NetSimConfig netsim = NetSimConfig::from_env(); //(GAME_NETSIM)
+	bool usage = (argc < 3);
+	for (int i = 3; i < argc && !usage; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--udp") {
+			transport = TransportUDP;
+		} else if (arg == "--netsim" && i + 1 < argc) {
+			netsim = NetSimConfig::parse(argv[++i]);
+		} else {
+			usage = true;
+		}
+	}
+	if (usage) {
+		std::cout << "Usage:\n\t./client <host> <port> [--udp] [--netsim latency=100,jitter=20,bandwidth=20000,reorder=0.01,loss=0.02]" << std::endl;
 		return 1;
 	}
 
-	Client client(argv[1], argv[2]);
+	Client client(argv[1], argv[2], transport);
+	if (netsim.enabled()) client.simulate_network(netsim);
 
 	//------------  initialization ------------
 
@@ -0,0 +1,158 @@
+//Re-runs recorded matches (see Replay.hpp; 'server --record dir' makes them) through
+// Game::update as fast as it will go, with no networking or rendering.
+//
+//Each replay is first run once checking every recorded checksum (and apple, and the
+// ending) against the re-simulated state, so any change to the simulation that changes
+// how a match plays out shows up as a mismatch (and a non-zero exit code). Then it is
+// run 'repeat' more times without checks, for a simulation throughput number.
+//
+//Usage: ./replay <file.replay> [more.replay ...] [--repeat 10]
+
+#include "Replay.hpp"
+#include "Game.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+struct RunResult {
+	uint32_t ticks = 0;
+	uint32_t checks = 0; //checksums compared (including the ending)
+	bool ended = false; //reached the recorded ending
+	bool diverged = false;
+	uint32_t diverged_tick = 0;
+	std::string problem; //what diverged first
+};
+
+//play 'replay' from the start in 'game'; if 'verify', compare against what was recorded:
+RunResult run(Replay const &replay, Game &game, bool verify) {
+	RunResult result;
+	auto diverge = [&result](uint32_t tick, std::string const &problem) {
+		if (result.diverged) return;
+		result.diverged = true;
+		result.diverged_tick = tick;
+		result.problem = problem;
+	};
+
+	game.new_game(replay.players);
+	game.apple_pos = replay.apple;
+
+	uint32_t tick = 0;
+	bool eaten = false;
+	size_t next = 0;
+	while (next < replay.records.size()) {
+		//what the server recorded at this tick: results of the step just taken, then moves for the next one:
+		for (; next < replay.records.size() && replay.records[next].tick == tick; ++next) {
+			ReplayRecord const &record = replay.records[next];
+			if (record.type == ReplayMove) {
+				game.snakes[record.slot]->revert_and_change(record.pos, record.dir, 2.f);
+			} else if (record.type == ReplayApple) {
+				if (verify && !eaten) diverge(tick, "recorded a new apple, but nothing ate the old one");
+				eaten = false;
+				game.apple_pos = record.pos;
+			} else if (record.type == ReplayCheck) {
+				if (verify) {
+					result.checks += 1;
+					if (replay_checksum(game) != record.checksum) diverge(tick, "state doesn't match the recorded checksum");
+				}
+			} else if (record.type == ReplayEnd) {
+				if (verify) {
+					result.checks += 1;
+					if (replay_dead(game) != record.dead) diverge(tick, "a different set of snakes died");
+					else if (replay_checksum(game) != record.checksum) diverge(tick, "final state doesn't match the recorded checksum");
+				}
+				result.ended = true;
+				result.ticks = tick;
+				return result;
+			}
+		}
+		if (verify && eaten) diverge(tick, "ate an apple the recording didn't");
+		eaten = false;
+		if (next >= replay.records.size()) break;
+
+		eaten = game.update(replay.step_seconds, true);
+		tick += 1;
+	}
+
+	result.ticks = tick;
+	return result;
+}
+
+} //namespace
+
+int main(int argc, char **argv) {
+	std::vector< std::string > files;
+	int repeat = 10;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--repeat" && i + 1 < argc) {
+			repeat = std::max(0, std::atoi(argv[++i]));
+		} else {
+			files.emplace_back(arg);
+		}
+	}
+	if (files.empty()) {
+		std::cerr << "Usage:\n\t./replay <file.replay> [more.replay ...] [--repeat 10]" << std::endl;
+		return 1;
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	Game game;
+	uint64_t total_ticks = 0;
+	double total_seconds = 0.0;
+	uint32_t failed = 0;
+
+	std::cout << std::fixed << std::setprecision(1);
+	for (std::string const &file : files) {
+		Replay replay;
+		try {
+			replay.load(file);
+		} catch (std::exception const &e) {
+			std::cout << file << ": " << e.what() << std::endl;
+			failed += 1;
+			continue;
+		}
+
+		RunResult checked = run(replay, game, true);
+		std::cout << file << ": " << int(replay.players) << " players, " << checked.ticks << " ticks, "
+			<< replay.records.size() << " records; ";
+		if (checked.diverged) {
+			std::cout << "DIVERGED at tick " << checked.diverged_tick << " (" << checked.problem << ")";
+			failed += 1;
+		} else if (!checked.ended) {
+			std::cout << "recording has no ending (" << checked.checks << " checks matched)";
+		} else {
+			std::cout << "matches (" << checked.checks << " checks)";
+		}
+
+		if (repeat > 0) {
+			Clock::time_point before = Clock::now();
+			uint64_t ticks = 0;
+			for (int r = 0; r < repeat; ++r) {
+				ticks += run(replay, game, false).ticks;
+			}
+			double seconds = std::chrono::duration< double >(Clock::now() - before).count();
+			total_ticks += ticks;
+			total_seconds += seconds;
+			std::cout << "; " << (seconds > 0.0 ? ticks / seconds : 0.0) << " ticks/sec";
+		}
+		std::cout << std::endl;
+	}
+
+	if (total_ticks) {
+		std::cout << "total: " << total_ticks << " ticks in " << std::setprecision(3) << total_seconds << "s; "
+			<< std::setprecision(1) << total_ticks / total_seconds << " ticks/sec"
+			<< " (" << std::setprecision(3) << total_seconds / total_ticks * 1e6 << " us/tick)" << std::endl;
+	}
+	if (failed) {
+		std::cout << failed << " of " << files.size() << " replays failed." << std::endl;
+		return 1;
+	}
+	return 0;
+}
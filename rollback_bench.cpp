@@ -0,0 +1,158 @@
+//Benchmark for lockstep rollback: times LockstepClient::resimulate (going back some
+// ticks and stepping forward again, saving each tick to the history ring and working out
+// the corrections to ease in) for rollbacks of 10 to 20 ticks, as the snakes get longer.
+//
+//Each snake winds up and down in its own lane of the board, so nobody dies during the
+// ticks being simulated again (a dead snake costs nothing to step); the turns that keep
+// it winding are the inputs replayed by every rollback.
+//
+//Usage: ./rollback_bench [players] [rollbacks per depth]
+
+#include "Lockstep.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+const Fixed LaneGap = FixedOne; //(more than twice the snake radius between lanes)
+const Fixed ColumnWidth = FixedOne; //(likewise between the runs up and down)
+
+struct Lane {
+	Fixed bottom, top;
+};
+
+//the turn (if any) that keeps 'snake' winding in 'lane'; returns -1 for none:
+int wind(LockstepGame::SnakeState const &snake, Lane const &lane) {
+	LockstepGame::Segment const &head = snake.body.back();
+	if (head.dir == Snake::Direction::UP && head.front.y >= lane.top) return Snake::Direction::RIGHT;
+	if (head.dir == Snake::Direction::DOWN && head.front.y <= lane.bottom) return Snake::Direction::RIGHT;
+	if (head.dir == Snake::Direction::RIGHT && head.length >= ColumnWidth) {
+		uint8_t last = snake.body[snake.body.size() - 2].dir;
+		return (last == Snake::Direction::UP ? Snake::Direction::DOWN : Snake::Direction::UP);
+	}
+	return -1;
+}
+
+//the turns that keep every snake winding, for the current tick:
+std::vector< LockstepGame::Turn > wind_all(LockstepGame const &game, std::vector< Lane > const &lanes) {
+	std::vector< LockstepGame::Turn > turns;
+	for (size_t i = 0; i < game.snakes.size(); ++i) {
+		if (game.snakes[i].dead) continue;
+		int dir = wind(game.snakes[i], lanes[i]);
+		if (dir < 0 || !game.can_turn(int(i), dir)) continue;
+		LockstepGame::Turn turn;
+		turn.tick = game.tick;
+		turn.player = uint8_t(i);
+		turn.dir = uint8_t(dir);
+		turns.emplace_back(turn);
+	}
+	return turns;
+}
+
+//a game where every snake has grown to about 'segments' segments:
+LockstepGame make_game(int players, size_t segments, std::vector< Lane > *lanes) {
+	Fixed lane_height = (2 * 10 * FixedOne) / players;
+	lanes->clear();
+
+	LockstepGame game;
+	game.new_game(players, 1);
+	for (int i = 0; i < players; ++i) {
+		Lane lane;
+		lane.bottom = -10 * FixedOne + i * lane_height + LaneGap / 2;
+		lane.top = lane.bottom + lane_height - LaneGap;
+		lanes->emplace_back(lane);
+
+		LockstepGame::Segment head;
+		head.dir = Snake::Direction::UP;
+		head.front = glm::ivec2(-9 * FixedOne, lane.bottom + FixedOne / 2);
+		head.length = FixedOne / 2;
+		game.snakes[i].body.assign(1, head);
+		game.snakes[i].dir = head.dir;
+		game.snakes[i].extra_length = 1000 * FixedOne;
+	}
+
+	while (true) {
+		bool grown = true;
+		for (LockstepGame::SnakeState &snake : game.snakes) {
+			if (snake.body.size() < segments) grown = false;
+			else snake.extra_length = 0;
+		}
+		if (grown) break;
+		for (LockstepGame::Turn const &turn : wind_all(game, *lanes)) {
+			game.turn(turn.player, turn.dir);
+		}
+		game.step();
+	}
+	return game;
+}
+
+} //namespace
+
+int main(int argc, char **argv) {
+	int players = (argc > 1 ? std::max(1, std::min(16, std::atoi(argv[1]))) : 8);
+	int rollbacks = (argc > 2 ? std::max(1, std::atoi(argv[2])) : 2000);
+
+	std::cout << players << " players, " << rollbacks << " rollbacks per depth (history of "
+		<< LockstepClient::RollbackTicks << " ticks):" << std::endl;
+	std::cout << std::setw(10) << "segments" << std::setw(10) << "ticks" << std::setw(16) << "us/rollback"
+		<< std::setw(14) << "us/tick" << std::setw(16) << "step us/tick" << std::endl;
+
+	for (size_t segments : {4, 12, 24}) {
+		std::vector< Lane > lanes;
+		LockstepClient client;
+		client.game = make_game(players, segments, &lanes);
+		client.player = 0;
+		client.active = true;
+		client.history.reset(client.game);
+		client.corrections.assign(players, std::vector< LockstepClient::Correction >());
+
+		//as far ahead as the client ever predicts, with the turns that keep everyone alive:
+		while (client.game.tick < client.history.oldest() + LockstepClient::MaxPrediction) {
+			for (LockstepGame::Turn const &turn : wind_all(client.game, lanes)) {
+				client.add(turn, false);
+			}
+			client.advance();
+		}
+		uint32_t newest = client.game.tick;
+		uint32_t checksum = client.game.checksum();
+		int dead = 0;
+		for (LockstepGame::SnakeState const &snake : client.game.snakes) dead += snake.dead;
+		if (dead) std::cout << "(unexpected deaths: " << dead << ") ";
+
+		typedef std::chrono::steady_clock Clock;
+
+		//plain stepping, for comparison (no turns, no saving):
+		double step_us;
+		{
+			LockstepGame start = client.history.at(newest - LockstepClient::MaxPrediction);
+			LockstepGame game;
+			auto before = Clock::now();
+			for (int i = 0; i < rollbacks; ++i) {
+				game = start;
+				for (uint32_t t = 0; t < LockstepClient::MaxPrediction; ++t) game.step();
+			}
+			step_us = std::chrono::duration< double, std::micro >(Clock::now() - before).count()
+				/ (double(rollbacks) * LockstepClient::MaxPrediction);
+		}
+
+		for (uint32_t depth : {10u, 15u, 20u}) {
+			auto before = Clock::now();
+			for (int i = 0; i < rollbacks; ++i) {
+				client.rewind_to = newest - depth;
+				client.resimulate();
+			}
+			double us = std::chrono::duration< double, std::micro >(Clock::now() - before).count() / rollbacks;
+			if (client.game.tick != newest || client.game.checksum() != checksum) std::cout << "(resimulation changed the result) ";
+
+			std::cout << std::fixed << std::setprecision(2)
+				<< std::setw(10) << client.game.snakes[0].body.size() << std::setw(10) << depth << std::setw(16) << us
+				<< std::setw(14) << us / depth << std::setw(16) << step_us << std::endl;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,149 @@
+//Benchmark for scene transform storage: times what Scene::draw does with transforms each
+// frame (change some of them, then fetch every object's local-to-world matrix) for a big
+// random hierarchy, stored as Scene::Transforms (one heap allocation each, chained by
+// pointers) and as FlatScene arrays (one linear sweep).
+//
+//Both copies get the same changes, so the matrices they produce are compared as a
+// sanity check.
+//
+//Usage: ./scene_bench [transforms] [frames]
+
+#include "Scene.hpp"
+#include "FlatScene.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Change {
+	uint32_t transform;
+	glm::vec3 position;
+	glm::quat rotation;
+};
+
+//(sums a column of every matrix, so the fetches can't be skipped)
+float checksum(glm::mat4 const &m) {
+	return m[3].x + m[3].y + m[3].z + m[0].x;
+}
+
+} //namespace
+
+int main(int argc, char **argv) {
+	uint32_t count = (argc > 1 ? uint32_t(std::atoi(argv[1])) : 50000);
+	int frames = (argc > 2 ? std::atoi(argv[2]) : 100);
+	if (count < 2 || frames < 1) {
+		std::cerr << "Usage:\n\t./scene_bench [transforms] [frames]" << std::endl;
+		return 1;
+	}
+
+	std::mt19937 mt(0x5cede);
+	auto random_position = [&mt]() {
+		std::uniform_real_distribution< float > d(-1.0f, 1.0f);
+		return glm::vec3(d(mt), d(mt), d(mt));
+	};
+	auto random_rotation = [&mt]() {
+		std::uniform_real_distribution< float > d(0.0f, 6.2831853f);
+		return glm::angleAxis(d(mt), glm::vec3(0.0f, 0.0f, 1.0f));
+	};
+
+	//the same random tree both ways (each transform's parent is some earlier transform):
+	Scene scene;
+	FlatScene &flat = scene.flat;
+	std::vector< Scene::Transform * > pointers;
+	std::vector< FlatScene::TransformHandle > handles;
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t parent = (i == 0 ? -1U : uint32_t(mt() % i));
+		glm::vec3 position = random_position();
+		glm::quat rotation = random_rotation();
+
+		Scene::Transform *t = scene.new_transform();
+		if (parent != -1U) t->set_parent(pointers[parent]);
+		t->set_position(position);
+		t->set_rotation(rotation);
+		scene.new_object(t);
+		pointers.emplace_back(t);
+
+		FlatScene::TransformHandle h = flat.new_transform(parent != -1U ? handles[parent] : FlatScene::TransformHandle());
+		flat.set_position(h, position);
+		flat.set_rotation(h, rotation);
+		flat.new_object(h);
+		handles.emplace_back(h);
+	}
+
+	std::cout << count << " transforms (one object each), " << frames << " frames per row:" << std::endl;
+	std::cout << std::fixed;
+	float worst = 0.0f;
+	for (float fraction : {0.0f, 0.01f, 0.1f, 1.0f}) {
+		//pick this row's changes up front, so both versions do exactly the same work:
+		std::vector< std::vector< Change > > changes(frames);
+		uint32_t per_frame = uint32_t(std::ceil(fraction * count));
+		for (auto &frame : changes) {
+			for (uint32_t c = 0; c < per_frame; ++c) {
+				Change change;
+				change.transform = (per_frame == count ? c : uint32_t(mt() % count));
+				change.position = random_position();
+				change.rotation = random_rotation();
+				frame.emplace_back(change);
+			}
+		}
+
+		float pointer_sum = 0.0f, flat_sum = 0.0f;
+
+		Clock::time_point before = Clock::now();
+		for (auto const &frame : changes) {
+			for (Change const &change : frame) {
+				pointers[change.transform]->set_position(change.position);
+				pointers[change.transform]->set_rotation(change.rotation);
+			}
+			for (Scene::Object *object = scene.first_object; object != nullptr; object = object->alloc_next) {
+				pointer_sum += checksum(object->transform->make_local_to_world());
+			}
+		}
+		double pointer_seconds = std::chrono::duration< double >(Clock::now() - before).count();
+
+		before = Clock::now();
+		for (auto const &frame : changes) {
+			for (Change const &change : frame) {
+				flat.set_position(handles[change.transform], change.position);
+				flat.set_rotation(handles[change.transform], change.rotation);
+			}
+			flat.update_world();
+			for (FlatScene::Object const &object : flat.objects) {
+				flat_sum += checksum(flat.local_to_world(object.transform));
+			}
+		}
+		double flat_seconds = std::chrono::duration< double >(Clock::now() - before).count();
+
+		for (uint32_t i = 0; i < count; ++i) {
+			glm::mat4 const &a = pointers[i]->make_local_to_world();
+			glm::mat4 const &b = flat.local_to_world(handles[i]);
+			for (int c = 0; c < 4; ++c) {
+				for (int r = 0; r < 4; ++r) {
+					worst = std::max(worst, std::abs(a[c][r] - b[c][r]));
+				}
+			}
+		}
+
+		double scale = 1e9 / (double(frames) * count);
+		std::cout << "  " << std::setw(5) << std::setprecision(1) << fraction * 100.0f << "% changed per frame: "
+			<< "pointers " << std::setprecision(2) << std::setw(7) << pointer_seconds * scale << " ns/transform, "
+			<< "flat " << std::setw(7) << flat_seconds * scale << " ns/transform"
+			<< " (" << std::setprecision(2) << pointer_seconds / flat_seconds << "x)"
+			<< "  [sums " << std::setprecision(1) << pointer_sum << " " << flat_sum << "]" << std::endl;
+	}
+
+	std::cout << "largest difference between the two: " << std::scientific << std::setprecision(2) << worst << std::endl;
+	if (!(worst < 1e-3f)) {
+		std::cout << "MISMATCH" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -1,163 +1,165 @@
 #include "Connection.hpp"
-#include "Game.hpp"
-#include "Snake.hpp"
+#include "Room.hpp"
+#include "Protocol.hpp"
+#include "Metrics.hpp"
+#include "Udp.hpp"
+#include "Log.hpp"
 
 #include <iostream>
-#include <set>
-#include <chrono>
-#include <unordered_map>
-#include <random>
+#include <thread>
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <memory>
 
 int main(int argc, char **argv) {
-	if (argc != 2) {
-		std::cerr << "Usage:\n\t./server <port>" << std::endl;
+	//'--udp' (anywhere) switches to the UDP transport; '--lockstep' runs lockstep matches;
+	// '--sim-hz', '--input-hz', and '--snapshot-hz' set TickRates; '--metrics-port' opens a MetricsEndpoint;
+	// '--record' saves every finished match to a directory as a Replay:
+	Transport transport = TransportTCP;
+	bool lockstep = false;
+	TickRates rates;
+	std::string metrics_port;
+	std::string record_dir;
+	bool usage = false;
+	std::vector< char * > args;
+	for (int i = 0; i < argc; ++i) {
+		std::string arg = argv[i];
+		double *rate = nullptr;
+		if (arg == "--udp") transport = TransportUDP;
+		else if (arg == "--lockstep") lockstep = true;
+		else if (arg == "--sim-hz") rate = &rates.simulation;
+		else if (arg == "--input-hz") rate = &rates.input;
+		else if (arg == "--snapshot-hz") rate = &rates.snapshot;
+		else if (arg == "--metrics-port") {
+			if (i + 1 >= argc) {
+				usage = true;
+				break;
+			}
+			metrics_port = argv[++i];
+		}
+		else if (arg == "--record") {
+			if (i + 1 >= argc) {
+				usage = true;
+				break;
+			}
+			record_dir = argv[++i];
+		}
+		else args.emplace_back(argv[i]);
+
+		if (rate) {
+			if (i + 1 >= argc) {
+				usage = true;
+				break;
+			}
+			*rate = std::atof(argv[++i]);
+			if (!(*rate > 0.0)) {
+				std::cerr << "Rates must be positive (got '" << argv[i] << "' for " << arg << ")." << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	if (usage || (args.size() != 2 && args.size() != 3)) {
+		std::cerr << "Usage:\n\t./server <port> [simulation threads] [--udp] [--lockstep] [--sim-hz 60] [--input-hz 240] [--snapshot-hz 5] [--metrics-port 9100] [--record dir]" << std::endl;
 		return 1;
 	}
-	
-	Server server(argv[1]);
 
-	std::random_device r;
-	std::seed_seq seed{r(), r(), r(), r(), r(), r(), r(), r()};
-	std::mt19937 rnd{seed};
+	if (lockstep && rates.simulation != LockstepGame::TicksPerSecond) {
+		//(clients step their own copy at this rate)
+		std::cerr << "Lockstep matches always simulate at " << LockstepGame::TicksPerSecond << " steps per second." << std::endl;
+		return 1;
+	}
 
-	Game state;
-	std::unordered_map<Connection *, char> players;
-	char player_count = 0;
-	int start_count = 2;
+	if (lockstep && !record_dir.empty()) {
+		//(replays re-run Game::update; lockstep matches run a LockstepGame)
+		std::cerr << "Lockstep matches can't be recorded." << std::endl;
+		return 1;
+	}
 
-	auto initialize_game = [&state, &players, &player_count, &start_count, &rnd]() {
-		state.new_game(2);
+	unsigned threads = std::thread::hardware_concurrency();
+	if (args.size() == 3) {
+		threads = unsigned(std::max(1, std::atoi(args[2])));
+	}
+
+	Server server(args[1], transport);
 
-		state.apple_pos = vec2(((int)(rnd() % (2 * Game::BOARD_WIDTH + 1))) - Game::BOARD_WIDTH,
-								((int)(rnd() % (2 * Game::BOARD_HEIGHT + 1))) - Game::BOARD_HEIGHT);
-		std::cout << "Initial apple: " << state.apple_pos.x << ", " << state.apple_pos.y << std::endl;
+	//every connection gets put into a room; each room runs its own independent match.
+	//rooms are ticked on a separate simulation thread (spread over 'threads' workers):
+	RoomManager rooms(threads, [&server](){ server.wake(); }, lockstep, rates);
+	rooms.record_dir = record_dir;
+
+	//stats for anyone who asks (the I/O thread only adds per-connection ones when asked):
+	std::unique_ptr< MetricsEndpoint > endpoint;
+	if (!metrics_port.empty()) {
+		endpoint.reset(new MetricsEndpoint(metrics_port, rooms.metrics, [&server](){ server.wake(); }));
+	}
 
-		player_count = 0;
-		start_count = 2;
-		players.clear();
-	};
-	initialize_game();
+	//packets and simulation output both wake poll() right away, so the only reason to wake up
+	// without them is the UDP transport's own resend / keepalive timers:
+	double const PollTimeout = (transport == TransportUDP ? UdpResendInterval / 4.0 : 1.0);
 
 	while (1) {
 		server.poll([&](Connection *c, Connection::Event evt){
 			if (evt == Connection::OnOpen) {
-				if (player_count <= 2) {
-					c->send_raw("p\2", 2);
-					c->send_raw(&player_count, 1);
-					c->send_raw(&state.apple_pos.x, sizeof(float));
-					c->send_raw(&state.apple_pos.y, sizeof(float));
-					players.insert(std::make_pair(c, player_count));
-					player_count++;
-				}
+				rooms.metrics.connections_total.add();
+				rooms.on_open(c);
 			} else if (evt == Connection::OnClose) {
-				initialize_game();
+				rooms.metrics.connection_closed(*c);
+				rooms.on_close(c);
 			} else { assert(evt == Connection::OnRecv);
-				if (c->recv_buffer[0] == 'h') {
-					c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 1);
-					std::cout << c << ": Got hello." << std::endl;
-					start_count--;
-
-					if (start_count == 0) {
-						std::cout << "Starting game" << std::endl;
-						for(Connection &other : server.connections) {
-							other.send_raw("s", 1);
-						}
-					}
-				} else if (c->recv_buffer[0] == 'm') {
-					if (c->recv_buffer.size() < 2 + sizeof(float) + sizeof(float)) {
-						return; //wait for more data
+				MessageView msg;
+				ParseResult result;
+				while ((result = next_message(*c, &msg, MessageToServer)) == ParseOk) {
+					MoveMessage move;
+					AckMessage ack;
+					TurnMessage turn;
+					DesyncMessage desync;
+					if (msg.type == MessageHello) {
+						log_info("{}: Got hello.", c);
+						rooms.on_hello(c);
+					} else if (msg.read(&move)) {
+						rooms.on_move(c, char(move.dir), move.target);
+					} else if (msg.read(&turn)) {
+						rooms.on_turn(c, char(turn.dir), turn.tick);
+					} else if (msg.read(&ack)) {
+						rooms.on_ack(c, ack.seq);
+					} else if (msg.read(&desync)) {
+						rooms.on_desync(c, desync.tick);
 					} else {
-						char dir = c->recv_buffer[1];
-						vec2 target;
-						memcpy(&target.x, c->recv_buffer.data() + 2, sizeof(float));
-						memcpy(&target.y, c->recv_buffer.data() + 2 + sizeof(float), sizeof(float));
-						c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 2 + sizeof(float) + sizeof(float));
-					
-						auto player_num = players.find(c);
-						if (player_num != players.end()) {
-							char player = player_num->second;
-							target = state.snakes[player]->revert_and_change(target, dir, 2.f);
-
-							for(Connection &other : server.connections) {
-								auto other_num = players.find(&other);
-								if (other_num != players.end() && other_num->second != player) {
-									other.send_raw("m", 1);
-									other.send_raw(&player, 1);
-									other.send_raw(&dir, 1);
-									other.send_raw(&target.x, sizeof(float));
-									other.send_raw(&target.y, sizeof(float));
-								}
-							}
-
-							std::cout << "Updated dir: " << ((int)dir) << ", for player: " << ((int)player) << std::endl;
-						}
-					}
-				} else {
-					std::cerr << "Unknown message header: " << c->recv_buffer[0] << std::endl;
-					c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 1);
-				}
-			}
-		}, 0.01);
-		
-		auto current_time = std::chrono::high_resolution_clock::now();
-		static auto previous_time = current_time;
-		if (start_count <= 0) {
-			float elapsed = std::chrono::duration< float >(current_time - previous_time).count();
-
-			static float total = 0.f;
-			static float sync_time = 0.f;
-
-			total += elapsed;
-			sync_time += elapsed;
-			while(total > 1.f/60.f) {
-				total -= 1.f/60.f;
-				if (state.update(1.f/60.f, true)) {
-					// New apple pos
-					state.apple_pos = vec2(((int)(rnd() % (2 * Game::BOARD_WIDTH + 1))) - Game::BOARD_WIDTH,
-											((int)(rnd() % (2 * Game::BOARD_HEIGHT + 1))) - Game::BOARD_HEIGHT);
-					for (Connection &conn : server.connections) {
-						conn.send_raw("a", 1);
-						conn.send_raw(&state.apple_pos.x, sizeof(float));
-						conn.send_raw(&state.apple_pos.y, sizeof(float));
+						log_warning("{}: Unexpected message '{}'; ignoring.", c, message_info(msg.type)->name);
 					}
 				}
-
-				// Check for dead sneks
-				int dead = 0;
-				for (int i=0; i<state.snakes.size(); i++) {
-					Snake *snake = state.snakes[i];
-					if (snake->dead) {
-						dead++;
-						for (auto pair : players) {
-							if (pair.second == i) {
-								// Send death
-								pair.first->send_raw("d", 1);
-								players.erase(pair.first);
-								break;
-							}
-						}
-					}
+				if (result == ParseError) {
+					log_warning("{}: Malformed message; disconnecting.", c);
+					rooms.metrics.connection_closed(*c);
+					c->close();
+					rooms.on_close(c);
 				}
+			}
+		}, PollTimeout);
 
-				if (dead == 1 && !players.empty()) {
-
-					std::cout << "DEAD: " << dead << std::endl;
+		//send whatever the simulation produced since the last poll:
+		rooms.flush();
 
-					// Send victory
-					players.begin()->first->send_raw("v", 1);
-					initialize_game();
-					break;
-				}
+		if (endpoint) endpoint->answer([&server](std::ostream &out){
+			size_t open = 0;
+			for (Connection const &c : server.connections) {
+				if (c.socket != INVALID_SOCKET) ++open;
 			}
-
-			if (sync_time >= .2f && start_count <= 0) {
-				// Sync states
-				state.send_sync(server.connections);
-				sync_time -= 0.2f;
-				std::cout << state.snakes[0]->head->front.x << ", " << state.snakes[0]->head->front.y << std::endl;
+			out << "# HELP connections connections open\n";
+			out << "# TYPE connections gauge\n";
+			out << "connections " << open << "\n";
+			out << "# HELP open_connection_bytes bytes received / sent / queued to send so far, per open connection\n";
+			out << "# TYPE open_connection_bytes gauge\n";
+			for (Connection const &c : server.connections) {
+				if (c.socket == INVALID_SOCKET) continue;
+				out << "open_connection_bytes{connection=\"" << &c << "\",dir=\"in\"} " << c.recv_buffer.added << "\n";
+				out << "open_connection_bytes{connection=\"" << &c << "\",dir=\"out\"} " << c.send_buffer.sent << "\n";
+				out << "open_connection_bytes{connection=\"" << &c << "\",dir=\"queued\"} " << c.send_buffer.size() << "\n";
 			}
-		}
-
-		previous_time = current_time;
+		});
 	}
 }
@@ -0,0 +1,71 @@
+#include "snake_program.hpp"
+
+#include "compile_program.hpp"
+#include "uniform_blocks.hpp"
+
+SnakeProgram::SnakeProgram() {
+	program = compile_program(
+		"#version 330\n"
+		"uniform mat4 world_to_clip;\n"
+		"uniform samplerBuffer instances;\n"
+		"uniform int instance_base;\n"
+		"layout(location=0) in vec4 Position;\n" //note: layout keyword used to make sure that the location-0 attribute is always bound to something
+		"in vec3 Normal;\n"
+		"in vec4 Color;\n"
+		"out vec3 position;\n"
+		"out vec3 normal;\n"
+		"out vec4 color;\n"
+		"void main() {\n"
+		"	int at = 3 * (instance_base + gl_InstanceID);\n"
+		"	vec4 row0 = texelFetch(instances, at);\n"
+		"	vec4 row1 = texelFetch(instances, at + 1);\n"
+		"	vec4 row2 = texelFetch(instances, at + 2);\n"
+		"	position = vec3(dot(row0, Position), dot(row1, Position), dot(row2, Position));\n"
+		"	gl_Position = world_to_clip * vec4(position, 1.0);\n"
+		//the cofactor matrix is the inverse transpose times the determinant, and 'normal' gets normalized anyway:
+		"	vec3 x = vec3(row0.x, row1.x, row2.x);\n"
+		"	vec3 y = vec3(row0.y, row1.y, row2.y);\n"
+		"	vec3 z = vec3(row0.z, row1.z, row2.z);\n"
+		"	normal = mat3(cross(y, z), cross(z, x), cross(x, y)) * Normal;\n"
+		"	color = Color;\n"
+		"}\n"
+		,
+		"#version 330\n"
+		"layout(std140) uniform Frame {\n" //(see uniform_blocks.hpp)
+		"	vec3 sun_direction;\n"
+		"	vec3 sun_color;\n"
+		"	vec3 sky_direction;\n"
+		"	vec3 sky_color;\n"
+		"};\n"
+		"in vec3 position;\n"
+		"in vec3 normal;\n"
+		"in vec4 color;\n"
+		"out vec4 fragColor;\n"
+		"void main() {\n"
+		"	vec3 total_light = vec3(0.0, 0.0, 0.0);\n"
+		"	vec3 n = normalize(normal);\n"
+		"	{ //sky (hemisphere) light:\n"
+		"		vec3 l = sky_direction;\n"
+		"		float nl = 0.5 + 0.5 * dot(n,l);\n"
+		"		total_light += nl * sky_color;\n"
+		"	}\n"
+		"	{ //sun (directional) light:\n"
+		"		vec3 l = sun_direction;\n"
+		"		float nl = max(0.0, dot(n,l));\n"
+		"		total_light += nl * sun_color;\n"
+		"	}\n"
+		"	fragColor = vec4(color.rgb * total_light, color.a);\n"
+		"}\n"
+	);
+
+	world_to_clip_mat4 = glGetUniformLocation(program, "world_to_clip");
+	instances_samplerBuffer = glGetUniformLocation(program, "instances");
+	instance_base_int = glGetUniformLocation(program, "instance_base");
+
+	//lights come from the 'Frame' uniform block:
+	bind_uniform_blocks(program);
+}
+
+Load< SnakeProgram > snake_program(LoadTagInit, [](){
+	return new SnakeProgram();
+});
@@ -0,0 +1,21 @@
+#include "GL.hpp"
+#include "Load.hpp"
+
+//"SnakeProgram" draws many copies of a mesh in one instanced draw call, lit like
+// VertexColorProgram. Each instance's local-to-world transform comes from a buffer
+// texture ('instances'): three RGBA32F texels per instance, the rows of a mat4x3.
+// Instance i of a draw uses the transform at index 'instance_base' + i.
+struct SnakeProgram {
+	//opengl program object:
+	GLuint program = 0;
+
+	//uniform locations:
+	GLuint world_to_clip_mat4 = -1U;
+	GLuint instances_samplerBuffer = -1U;
+	GLuint instance_base_int = -1U;
+	//(lights come from the 'Frame' block in uniform_blocks.hpp)
+
+	SnakeProgram();
+};
+
+extern Load< SnakeProgram > snake_program;
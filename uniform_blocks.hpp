@@ -0,0 +1,47 @@
+#pragma once
+
+#include "GL.hpp"
+
+#include <glm/glm.hpp>
+
+//Uniform blocks shared by the scene's programs. Scene::draw packs one FrameUniforms and
+// every object's ObjectUniforms into a single uniform buffer each frame, and binds ranges
+// of it at these binding points, instead of uploading uniforms one by one.
+//
+//The structs mirror the std140 layout of the GLSL blocks (vec3s and matrix columns each
+// take a full vec4):
+//
+//	layout(std140) uniform Frame {
+//		vec3 sun_direction; vec3 sun_color; vec3 sky_direction; vec3 sky_color;
+//	};
+//	layout(std140) uniform Object {
+//		mat4 object_to_clip; mat4x3 object_to_light; mat3 normal_to_light;
+//	};
+
+enum UniformBlockBinding : GLuint {
+	FrameBlockBinding = 0,
+	ObjectBlockBinding = 1,
+};
+
+struct FrameUniforms {
+	glm::vec4 sun_direction = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+	glm::vec4 sun_color = glm::vec4(0.0f);
+	glm::vec4 sky_direction = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+	glm::vec4 sky_color = glm::vec4(0.0f);
+};
+static_assert(sizeof(FrameUniforms) == 4*16, "FrameUniforms matches std140 layout.");
+
+struct ObjectUniforms {
+	glm::mat4 object_to_clip;
+	glm::mat4 object_to_light; //(mat4x3: xyz of each column)
+	glm::vec4 normal_to_light[3]; //(mat3: xyz of each column)
+};
+static_assert(sizeof(ObjectUniforms) == 4*16 + 4*16 + 3*16, "ObjectUniforms matches std140 layout.");
+
+//point a program's blocks (if it uses them) at the binding points above:
+inline void bind_uniform_blocks(GLuint program) {
+	GLuint frame = glGetUniformBlockIndex(program, "Frame");
+	if (frame != GL_INVALID_INDEX) glUniformBlockBinding(program, frame, FrameBlockBinding);
+	GLuint object = glGetUniformBlockIndex(program, "Object");
+	if (object != GL_INVALID_INDEX) glUniformBlockBinding(program, object, ObjectBlockBinding);
+}
@@ -1,13 +1,16 @@
 #include "vertex_color_program.hpp"
 
 #include "compile_program.hpp"
+#include "uniform_blocks.hpp"
 
 VertexColorProgram::VertexColorProgram() {
 	program = compile_program(
 		"#version 330\n"
-		"uniform mat4 object_to_clip;\n"
-		"uniform mat4x3 object_to_light;\n"
-		"uniform mat3 normal_to_light;\n"
+		"layout(std140) uniform Object {\n" //(see uniform_blocks.hpp)
+		"	mat4 object_to_clip;\n"
+		"	mat4x3 object_to_light;\n"
+		"	mat3 normal_to_light;\n"
+		"};\n"
 		"layout(location=0) in vec4 Position;\n" //note: layout keyword used to make sure that the location-0 attribute is always bound to something
 		"in vec3 Normal;\n"
 		"in vec4 Color;\n"
@@ -22,10 +25,12 @@ VertexColorProgram::VertexColorProgram() {
 		"}\n"
 		,
 		"#version 330\n"
-		"uniform vec3 sun_direction;\n"
-		"uniform vec3 sun_color;\n"
-		"uniform vec3 sky_direction;\n"
-		"uniform vec3 sky_color;\n"
+		"layout(std140) uniform Frame {\n" //(see uniform_blocks.hpp)
+		"	vec3 sun_direction;\n"
+		"	vec3 sun_color;\n"
+		"	vec3 sky_direction;\n"
+		"	vec3 sky_color;\n"
+		"};\n"
 		"in vec3 position;\n"
 		"in vec3 normal;\n"
 		"in vec4 color;\n"
@@ -47,14 +52,8 @@ VertexColorProgram::VertexColorProgram() {
 		"}\n"
 	);
 
-	object_to_clip_mat4 = glGetUniformLocation(program, "object_to_clip");
-	object_to_light_mat4x3 = glGetUniformLocation(program, "object_to_light");
-	normal_to_light_mat3 = glGetUniformLocation(program, "normal_to_light");
-
-	sun_direction_vec3 = glGetUniformLocation(program, "sun_direction");
-	sun_color_vec3 = glGetUniformLocation(program, "sun_color");
-	sky_direction_vec3 = glGetUniformLocation(program, "sky_direction");
-	sky_color_vec3 = glGetUniformLocation(program, "sky_color");
+	//matrices and lights come from the 'Object' and 'Frame' uniform blocks:
+	bind_uniform_blocks(program);
 }
 
 Load< VertexColorProgram > vertex_color_program(LoadTagInit, [](){